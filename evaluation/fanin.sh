@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Runs the fan-in benchmark for an increasing number of clients on this host
+# and collects the client and server summaries in fanin-{tcp,udp}-$MUX.csv.
+# Pass "-u" as first argument to use UDP. MULTIPLEXER=poll runs fanin-poll.
+
+mux=${MULTIPLEXER:-epoll}
+bin=../build/bin/fanin
+if [ "$mux" != "epoll" ]; then
+  bin="${bin}-${mux}"
+fi
+proto="tcp"
+flags=""
+if [ "$1" == "-u" ]; then
+  proto="udp"
+  flags="--udp"
+fi
+messages=100
+port=12345
+
+file="fanin-${proto}-${mux}.csv"
+rm -f $file
+echo "clients, connected, finished, messages, elapsed_ms, msgs_per_s, connect_ms, connects_per_s, client_rss_kb, client_per_conn_kb, server_accept_rate, server_rss_kb, server_per_conn_kb" >> $file
+for clients in 1 10 100 1000 10000
+do
+  $bin -s $flags --multiplexer=$mux -c $clients -m $messages -P $port > server.out 2> server.err &
+  server=$!
+  sleep 1
+  $bin $flags --multiplexer=$mux -c $clients -m $messages -P $port > client.out 2> client.err
+  sleep 1
+  kill $server 2> /dev/null
+  wait $server 2> /dev/null
+  client=$(tail -n 1 client.out | sed 's/[a-z_]*=//g' | tr ' ' ',')
+  server=$(grep final server.out | sed 's/final //; s/[a-z_]*=//g' | tr ' ' ',' | cut -d ',' -f 3-5)
+  echo "${client},${server}" >> $file
+  port=$((port + 1))
+done
+rm -f server.out server.err client.out client.err
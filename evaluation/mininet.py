@@ -105,11 +105,18 @@ def main():
     parser.add_argument('-T', '--threads', help='set number of threads      (1)', type=int, default=1)
     parser.add_argument('-R', '--rto',     help='set min rto for TCP       (40)', type=int, default=40)
     parser.add_argument('-o', '--ordered', help='enable ordering for UDP       ', action='store_true')
+    parser.add_argument('-S', '--sack',    help='use selective ACKs for UDP    ', action='store_true')
+    parser.add_argument('-F', '--fused',   help='fuse reliability, ordering and raw (implies -o)', action='store_true')
+    parser.add_argument('-w', '--window',  help='set messages in flight     (1)', type=int, default=1)
+    parser.add_argument('-M', '--multiplexer', help='set multiplexer backend (epoll)', choices=['epoll', 'poll'], default='epoll')
+    parser.add_argument('-p', '--pin',     help='pin server to CPUs 0-1 and client to CPUs 2-3', action='store_true')
     group = parser.add_mutually_exclusive_group(required=True)
     group.add_argument('-t', '--tcp',  help='use TCP' , action='store_true')
     group.add_argument('-u', '--udp',  help='use UDP' , action='store_true')
     group.add_argument('-q', '--quic', help='use QUIC', action='store_true')
     args = vars(parser.parse_args())
+    if args['fused']:
+        args['ordered'] = True
     run = 0
     max_runs = args['runs']
     while run < max_runs:
@@ -125,8 +132,18 @@ def main():
                 proto = 'udp-ordered'
             else:
                 proto = 'udp'
+            if args['fused']:
+                proto = '{}-fused'.format(proto)
+            if args['sack']:
+                proto = '{}-sack'.format(proto)
         elif args['quic']:
             proto = 'quic'
+        if args['window'] > 1:
+            proto = '{}-w{}'.format(proto, args['window'])
+        if args['multiplexer'] != 'epoll':
+            proto = '{}-{}'.format(proto, args['multiplexer'])
+        if args['pin']:
+            proto = '{}-pinned'.format(proto)
         print(">> Run {} with {}% loss and {}ms delay".format(run, loss, delay))
         net = Mininet(topo = TwoHostsTopology(), link=TCLink, host=CPULimitedHost)
         net.start()
@@ -162,11 +179,26 @@ def main():
             prog = 'pingpong_udp'
             if args['ordered']:
                 caf_opts = '{} --ordered'.format(caf_opts)
+            if args['fused']:
+                caf_opts = '{} --fused'.format(caf_opts)
+            if args['sack']:
+                caf_opts = '{} --sack'.format(caf_opts)
         elif args['quic']:
             prog = 'pingpong_quic'
+        # Each multiplexer has its own binary, the option double-checks that.
+        if args['multiplexer'] != 'epoll':
+            prog = '{}-{}'.format(prog, args['multiplexer'])
+        caf_opts = '{} --multiplexer={}'.format(caf_opts, args['multiplexer'])
+        # Both hosts share the VM, keep their threads apart. The placement
+        # ends up in the .err files.
+        server_opts = caf_opts
+        client_opts = caf_opts
+        if args['pin']:
+            server_opts = '{} --pin-io=0 --pin-workers=1'.format(caf_opts)
+            client_opts = '{} --pin-io=2 --pin-workers=3'.format(caf_opts)
 
         print("Starting server")
-        servercommand = '../build/bin/{} -s {} '.format(prog, caf_opts)
+        servercommand = '../build/bin/{} -s {} '.format(prog, server_opts)
         print('> {}'.format(servercommand))
         # h1.cmdPrint(servercommand)
         # p1 = int(h1.cmd('echo $!'))
@@ -176,7 +208,8 @@ def main():
         sleep(1)
 
         print("Starting client")
-        clientcommand = '../build/bin/{} -m 2000 --host=\\"{}\\" {}'.format(prog, h1.IP(), caf_opts)
+        histogram = './pingpong/{}-client-{}-{}-{}.hist'.format(proto, loss, delay, run)
+        clientcommand = '../build/bin/{} -m 2000 --window={} --histogram-out={} --host=\\"{}\\" {}'.format(prog, args['window'], histogram, h1.IP(), client_opts)
         print('> {}'.format(clientcommand))
         # h2.cmdPrint(clientcommand)
         # p2 = int(h2.cmd('echo $!'))
@@ -39,3 +39,22 @@ do
 done
 
 sed -i $i_arg 's/ms//g' "$file"
+
+# Latency percentiles per run, taken from the histograms the clients write
+# via --histogram-out.
+for proto in udp udp-ordered tcp
+do
+  file="${proto}-latency-${delay}.csv"
+  rm -f $file
+  echo "loss, run, count, min_us, mean_us, p50_us, p90_us, p99_us, p99.9_us, max_us" >> $file
+  for i in {0..10}
+  do
+    for hist in ${proto}-client-$i-${delay}-*.hist
+    do
+      [ -f "$hist" ] || continue
+      run=${hist##*-}
+      run=${run%.hist}
+      echo "$i,$run,$(tail -n 1 $hist)" >> $file
+    done
+  done
+done
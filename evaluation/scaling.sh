@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Measures the aggregate echo throughput of the fan-in server for an
+# increasing number of I/O threads and writes scaling-$MUX.csv. Each I/O
+# thread runs its own multiplexer with a SO_REUSEPORT listening socket. The
+# clients are split over one client process per I/O thread to keep them from
+# becoming the bottleneck. CLIENTS, MESSAGES and WINDOW set the load,
+# MULTIPLEXER=poll runs fanin-poll.
+
+mux=${MULTIPLEXER:-epoll}
+bin=../build/bin/fanin
+if [ "$mux" != "epoll" ]; then
+  bin="${bin}-${mux}"
+fi
+clients=${CLIENTS:-1000}
+messages=${MESSAGES:-1000}
+window=${WINDOW:-8}
+port=12345
+
+file="scaling-${mux}.csv"
+rm -f $file
+echo "io_threads, clients, messages, window, echo_per_s, accept_rate, per_thread" >> $file
+for threads in 1 2 4 8
+do
+  $bin -s --multiplexer=$mux -i $threads -c $clients -m $messages -P $port > server.out 2> server.err &
+  server=$!
+  sleep 1
+  pids=""
+  for ((i = 0; i < threads; i++)); do
+    n=$((clients / threads))
+    if [ $i -lt $((clients % threads)) ]; then
+      n=$((n + 1))
+    fi
+    $bin --multiplexer=$mux -c $n -m $messages -w $window -P $port > client-$i.out 2> client-$i.err &
+    pids="$pids $!"
+  done
+  wait $pids
+  sleep 1
+  kill $server 2> /dev/null
+  wait $server 2> /dev/null
+  line=$(grep final server.out)
+  get() { echo "$line" | tr ' ' '\n' | grep "^$1=" | cut -d '=' -f 2; }
+  echo "${threads},${clients},${messages},${window},$(get echo_per_s),$(get accept_rate),$(get per_thread)" >> $file
+  port=$((port + 1))
+done
+rm -f server.out server.err client-*.out client-*.err
@@ -27,9 +27,14 @@ else
   git checkout topic/new-broker-experiments
 fi
 cd $ROOT_DIR/actor-framework
-git apply $ROOT_DIR/caf-poll.diff
+# Older setups patched CAF to always use poll(), undo that.
+git checkout -- libcaf_io/caf/io/network/default_multiplexer.hpp
+# The default build uses epoll on Linux, the second build uses poll().
 ./configure --build-type=release --no-opencl --no-tools --no-examples
-make -j$cores
+make -C build -j$cores
+./configure --build-type=release --no-opencl --no-tools --no-examples \
+            --build-dir=build-poll --extra-flags=-DCAF_POLL_IMPL
+make -C build-poll -j$cores
 cd $ROOT_DIR
 
 echo "Building google benchmark"
@@ -0,0 +1,64 @@
+#ifndef ACCEPT_REUSEPORT_HPP
+#define ACCEPT_REUSEPORT_HPP
+
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "caf/io/newb.hpp"
+#include "caf/io/network/default_multiplexer.hpp"
+#include "caf/logger.hpp"
+#include "caf/policy/newb_tcp.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Accepts TCP connections like `accept_tcp`, but sets `SO_REUSEPORT` on the
+/// listening socket. Several acceptors, each on its own multiplexer, can
+/// thus listen on the same port and the kernel spreads incoming connections
+/// over them. Newbs stay on the multiplexer of the acceptor that created
+/// them. Only IPv4 is supported, `host` defaults to any address.
+template <class Message>
+struct accept_tcp_reuseport : public accept_tcp<Message> {
+  expected<io::network::native_socket>
+  create_socket(uint16_t port, const char* host, bool reuse = false) override {
+    CAF_LOG_TRACE(CAF_ARG(port) << CAF_ARG(reuse));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (host != nullptr && ::inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+      CAF_LOG_ERROR("not an IPv4 address:" << CAF_ARG(host));
+      return sec::cannot_open_port;
+    }
+    auto fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      CAF_LOG_ERROR("socket failed:" << CAF_ARG(errno));
+      return sec::cannot_open_port;
+    }
+    int on = 1;
+    auto set = [&](int opt) {
+      return ::setsockopt(fd, SOL_SOCKET, opt, &on, sizeof(on)) == 0;
+    };
+    if ((reuse && !set(SO_REUSEADDR)) || !set(SO_REUSEPORT)
+        || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(fd, SOMAXCONN) != 0) {
+      CAF_LOG_ERROR("cannot listen on port:" << CAF_ARG(port)
+                    << CAF_ARG(errno));
+      ::close(fd);
+      return sec::cannot_open_port;
+    }
+    return fd;
+  }
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // ACCEPT_REUSEPORT_HPP
@@ -0,0 +1,76 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace caf {
+namespace policy {
+
+/// Free list of equally sized receive buffers. Buffers leave the pool by
+/// moving out their storage and come back via `release`, handing a buffer to
+/// a protocol thus never copies the payload. A pool can be shared between all
+/// transports running on the same multiplexer thread, but it is not
+/// thread-safe.
+class buffer_pool {
+public:
+  using buffer_type = std::vector<char>;
+
+  explicit buffer_pool(size_t buffer_size, size_t max_cached = 1024)
+    : buffer_size_(buffer_size),
+      max_cached_(max_cached),
+      allocations_(0) {
+    free_.reserve(max_cached);
+  }
+
+  buffer_pool(const buffer_pool&) = delete;
+  buffer_pool& operator=(const buffer_pool&) = delete;
+
+  /// Returns a buffer with `buffer_size()` bytes, allocating only if the
+  /// free list is empty.
+  buffer_type acquire() {
+    if (free_.empty()) {
+      allocations_ += 1;
+      return buffer_type(buffer_size_);
+    }
+    auto buf = std::move(free_.back());
+    free_.pop_back();
+    return buf;
+  }
+
+  /// Puts `buf` back into the free list. Buffers that are too small or that
+  /// exceed `max_cached` are simply dropped.
+  void release(buffer_type&& buf) {
+    if (buf.capacity() < buffer_size_ || free_.size() >= max_cached_)
+      return;
+    if (buf.size() != buffer_size_)
+      buf.resize(buffer_size_);
+    free_.push_back(std::move(buf));
+  }
+
+  size_t buffer_size() const {
+    return buffer_size_;
+  }
+
+  /// Returns the number of buffers currently in the free list.
+  size_t available() const {
+    return free_.size();
+  }
+
+  /// Returns how many buffers the pool had to allocate so far.
+  size_t allocations() const {
+    return allocations_;
+  }
+
+private:
+  size_t buffer_size_;
+  size_t max_cached_;
+  size_t allocations_;
+  std::vector<buffer_type> free_;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // BUFFER_POOL_HPP
@@ -0,0 +1,172 @@
+#ifndef BUSY_POLL_HPP
+#define BUSY_POLL_HPP
+
+#include <cerrno>
+#include <chrono>
+#include <ostream>
+#include <utility>
+
+#include <sys/socket.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "caf/io/newb.hpp"
+#include "caf/logger.hpp"
+#include "caf/policy/newb_tcp.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Counters of a `busy_poll` transport. A hit is a spin that found new data
+/// before the interval ran out, a miss gave up and returned to the
+/// multiplexer.
+struct busy_poll_stats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t spins = 0;
+
+  /// Prints the counters as `key=value` pairs on a single line.
+  void print(std::ostream& out) const {
+    auto polls = hits + misses;
+    out << "busy_poll hits=" << hits
+        << " misses=" << misses
+        << " hit_rate=" << (polls > 0 ? static_cast<double>(hits) / polls
+                                      : 0.0)
+        << " spins_per_poll="
+        << (polls > 0 ? static_cast<double>(spins) / polls : 0.0)
+        << std::endl;
+  }
+};
+
+/// Spins on non-blocking reads for up to `interval` once a read finds no
+/// data, instead of returning to the multiplexer right away. In a ping pong,
+/// the reply usually arrives while spinning, which saves the round trip
+/// through `epoll_wait` and the wakeup of the I/O thread. The transport
+/// spins at most once per quiet period: after a miss, it waits for the
+/// multiplexer to report new data before spinning again.
+///
+/// Writes cannot wait for the next write event while the I/O thread spins,
+/// so flushing writes eagerly. Optionally, `SO_BUSY_POLL` lets the kernel
+/// poll the device queue for `so_busy_poll` microseconds on blocking reads
+/// and `poll`, which needs `CAP_NET_ADMIN` for values above
+/// `net.core.busy_read`.
+///
+/// Wraps transports that track a `writing` flag, such as `tcp_transport`.
+template <class Transport>
+struct busy_poll : public Transport, public busy_poll_stats {
+  using newb_base = io::network::newb_base;
+  using rw_state = io::network::rw_state;
+  using clock_type = std::chrono::steady_clock;
+
+  template <class... Ts>
+  busy_poll(std::chrono::microseconds interval, int so_busy_poll,
+            Ts&&... xs)
+    : Transport(std::forward<Ts>(xs)...),
+      interval(interval),
+      so_busy_poll(so_busy_poll),
+      configured(false),
+      armed(true) {
+    // nop
+  }
+
+  rw_state read_some(newb_base* parent) override {
+    if (!configured)
+      configure(parent->fd());
+    auto before = this->received_bytes;
+    auto res = Transport::read_some(parent);
+    if (interval.count() == 0 || progress(res, before)) {
+      armed = armed || res == rw_state::success;
+      return res;
+    }
+    if (!armed)
+      return res;
+    auto deadline = clock_type::now() + interval;
+    do {
+      relax();
+      spins += 1;
+      res = Transport::read_some(parent);
+    } while (!progress(res, before) && clock_type::now() < deadline);
+    if (res == rw_state::failure)
+      return res;
+    if (progress(res, before)) {
+      hits += 1;
+    } else {
+      misses += 1;
+      armed = false;
+    }
+    return res;
+  }
+
+  void flush(newb_base* parent) override {
+    Transport::flush(parent);
+    if (interval.count() == 0)
+      return;
+    // Transports may report success for writes that would block, so give up
+    // after a few attempts. The write event picks up the rest.
+    for (int i = 0; i < 16 && this->writing; ++i)
+      if (this->write_some(parent) != rw_state::success)
+        break;
+  }
+
+  /// Returns whether a read found new data. Transports that report
+  /// `success` for empty reads signal new data via `received_bytes`.
+  bool progress(rw_state res, size_t before) {
+    if (res != rw_state::success)
+      return res == rw_state::failure;
+    return this->received_bytes != before || this->should_deliver();
+  }
+
+  void configure(io::network::native_socket fd) {
+    configured = true;
+    if (so_busy_poll <= 0)
+      return;
+#ifdef SO_BUSY_POLL
+    if (::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &so_busy_poll,
+                     sizeof(so_busy_poll)) != 0)
+      CAF_LOG_ERROR("cannot set SO_BUSY_POLL:" << CAF_ARG(errno));
+#else
+    static_cast<void>(fd);
+    CAF_LOG_ERROR("SO_BUSY_POLL is not available");
+#endif
+  }
+
+  static void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+  }
+
+  std::chrono::microseconds interval;
+  int so_busy_poll;
+  bool configured;
+  bool armed;
+};
+
+/// Accepts TCP connections like `accept_tcp`, but runs each new newb on a
+/// `busy_poll<tcp_transport>`.
+template <class Message>
+struct accept_tcp_busy_poll : public accept_tcp<Message> {
+  accept_tcp_busy_poll(std::chrono::microseconds interval, int so_busy_poll)
+    : interval(interval),
+      so_busy_poll(so_busy_poll) {
+    // nop
+  }
+
+  std::pair<io::network::native_socket, io::network::transport_ptr>
+  accept_event(io::network::newb_base* parent) override {
+    auto res = accept_tcp<Message>::accept_event(parent);
+    if (res.first != io::network::invalid_native_socket)
+      res.second.reset(new busy_poll<tcp_transport>(interval, so_busy_poll));
+    return res;
+  }
+
+  std::chrono::microseconds interval;
+  int so_busy_poll;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // BUSY_POLL_HPP
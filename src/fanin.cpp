@@ -0,0 +1,446 @@
+#include "caf/all.hpp"
+#include "caf/binary_deserializer.hpp"
+#include "caf/binary_serializer.hpp"
+#include "caf/detail/call_cfun.hpp"
+#include "caf/io/newb.hpp"
+#include "caf/logger.hpp"
+#include "caf/policy/newb_raw.hpp"
+#include "caf/policy/newb_reliability.hpp"
+#include "caf/policy/newb_tcp.hpp"
+#include "caf/policy/newb_udp.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "accept_reuseport.hpp"
+#include "multiplexer_backend.hpp"
+#include "pipeline_window.hpp"
+#include "write_arena.hpp"
+
+using namespace caf;
+using namespace caf::io;
+using namespace caf::io::network;
+using namespace caf::policy;
+
+namespace {
+
+using start_atom = atom_constant<atom("start")>;
+using done_atom = atom_constant<atom("done")>;
+
+using clock_type = std::chrono::steady_clock;
+
+// -- utility ------------------------------------------------------------------
+
+// Resident set size of this process in bytes.
+size_t resident_bytes() {
+  std::ifstream in{"/proc/self/statm"};
+  size_t total = 0;
+  size_t resident = 0;
+  if (!(in >> total >> resident))
+    return 0;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Raises the soft limit for open files as far as allowed.
+void raise_fd_limit(size_t needed) {
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return;
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  if (rl.rlim_cur < needed + 64)
+    std::cerr << "warning: open file limit " << rl.rlim_cur
+              << " is too low for " << needed << " connections" << std::endl;
+}
+
+double per_second(size_t n, clock_type::duration d) {
+  auto secs = std::chrono::duration<double>(d).count();
+  return secs > 0 ? n / secs : 0.0;
+}
+
+double kib(size_t bytes) {
+  return bytes / 1024.0;
+}
+
+// -- server -------------------------------------------------------------------
+
+int64_t now_ns() {
+  using namespace std::chrono;
+  auto t = clock_type::now().time_since_epoch();
+  return duration_cast<nanoseconds>(t).count();
+}
+
+// Counters of one I/O thread, padded to avoid false sharing between threads.
+struct shard_counters {
+  std::atomic<size_t> accepted;
+  std::atomic<size_t> done;
+  char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+};
+
+// Shared by the server newbs of all I/O threads. Newbs only touch the slot of
+// their own thread, except for the first and last time stamps.
+struct server_counters {
+  explicit server_counters(size_t shards)
+    : shards(new shard_counters[shards]),
+      num_shards(shards),
+      first_accept(0),
+      last_accept(0),
+      last_done(0) {
+    for (size_t i = 0; i < shards; ++i) {
+      this->shards[i].accepted = 0;
+      this->shards[i].done = 0;
+    }
+  }
+
+  size_t accepted() const {
+    size_t result = 0;
+    for (size_t i = 0; i < num_shards; ++i)
+      result += shards[i].accepted;
+    return result;
+  }
+
+  size_t done() const {
+    size_t result = 0;
+    for (size_t i = 0; i < num_shards; ++i)
+      result += shards[i].done;
+    return result;
+  }
+
+  void on_accept(size_t shard) {
+    auto now = now_ns();
+    int64_t unset = 0;
+    first_accept.compare_exchange_strong(unset, now);
+    last_accept = now;
+    shards[shard].accepted += 1;
+  }
+
+  void on_done(size_t shard) {
+    last_done = now_ns();
+    shards[shard].done += 1;
+  }
+
+  std::unique_ptr<shard_counters[]> shards;
+  size_t num_shards;
+  std::atomic<int64_t> first_accept;
+  std::atomic<int64_t> last_accept;
+  std::atomic<int64_t> last_done;
+};
+
+using counters_ptr = std::shared_ptr<server_counters>;
+
+struct server_state {
+  counters_ptr counters;
+  size_t shard = 0;
+  size_t messages = 0;
+  size_t echoed = 0;
+  bench::counter_filter filter;
+};
+
+behavior raw_server(stateful_newb<new_raw_msg, server_state>* self,
+                    counters_ptr counters, size_t shard, size_t messages) {
+  self->state.counters = counters;
+  self->state.shard = shard;
+  self->state.messages = messages;
+  presize_buffers(*self->trans);
+  counters->on_accept(shard);
+  return {
+    [=](atom_value atm, uint32_t id) {
+      self->proto->timeout(atm, id);
+    },
+    [=](new_raw_msg& msg) {
+      auto& s = self->state;
+      uint32_t counter;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(counter);
+      if (!s.filter.insert(counter))
+        return;
+      {
+        auto whdl = self->wr_buf(nullptr);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(counter);
+      }
+      s.echoed += 1;
+      if (s.echoed == s.messages)
+        s.counters->on_done(s.shard);
+    },
+    [=](io_error_msg&) {
+      self->stop();
+      self->quit();
+    }
+  };
+}
+
+// Each additional I/O thread runs its own actor system, and thus its own
+// multiplexer, with a single scheduler thread.
+class shard_config : public actor_system_config {
+public:
+  shard_config() {
+    load<io::middleman>();
+    set("scheduler.max-threads", 1);
+  }
+};
+
+// -- client -------------------------------------------------------------------
+
+struct client_state {
+  actor collector;
+  bench::pipeline_window window;
+};
+
+behavior raw_client(stateful_newb<new_raw_msg, client_state>* self) {
+  presize_buffers(*self->trans);
+  auto send_window = [=] {
+    auto& w = self->state.window;
+    while (w.can_send()) {
+      auto whdl = self->wr_buf(nullptr);
+      binary_serializer bs(&self->backend(), *whdl.buf);
+      bs(w.send());
+    }
+  };
+  return {
+    [=](atom_value atm, uint32_t id) {
+      self->proto->timeout(atm, id);
+    },
+    [=](start_atom, size_t messages, size_t window, actor collector) {
+      self->state.collector = collector;
+      self->state.window.reset(window, messages);
+      self->configure_read(io::receive_policy::exactly(sizeof(uint32_t)));
+      send_window();
+    },
+    [=](new_raw_msg& msg) {
+      auto& s = self->state;
+      uint32_t counter;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(counter);
+      if (!s.window.receive(counter))
+        return;
+      if (s.window.done()) {
+        self->send(s.collector, done_atom::value,
+                   static_cast<uint64_t>(s.window.completed()));
+        self->stop();
+        self->quit();
+      } else {
+        send_window();
+      }
+    },
+    [=](io_error_msg& msg) {
+      std::cerr << "client got io error: " << to_string(msg.op) << std::endl;
+      self->send(self->state.collector, done_atom::value,
+                 static_cast<uint64_t>(self->state.window.completed()));
+      self->stop();
+      self->quit();
+    }
+  };
+}
+
+// -- main ---------------------------------------------------------------------
+
+class config : public actor_system_config {
+public:
+  uint16_t port = 12345;
+  std::string host = "127.0.0.1";
+  bool is_server = false;
+  bool use_udp = false;
+  size_t clients = 100;
+  size_t messages = 100;
+  size_t window = 1;
+  size_t timeout = 60;
+  size_t io_threads = 1;
+  std::string multiplexer;
+
+  config() {
+    opt_group{custom_options_, "global"}
+    .add(port, "port,P", "set port")
+    .add(host, "host,H", "set host")
+    .add(is_server, "server,s", "set server")
+    .add(use_udp, "udp,u", "use UDP instead of TCP")
+    .add(clients, "clients,c", "set number of concurrent clients")
+    .add(messages, "messages,m", "set number of messages per client")
+    .add(window, "window,w", "set number of messages in flight per client")
+    .add(timeout, "timeout,T", "give up after this many seconds")
+    .add(io_threads, "io-threads,i",
+         "set number of I/O threads with SO_REUSEPORT (server)")
+    .add(multiplexer, "multiplexer", "check multiplexer (epoll, poll)");
+  }
+};
+
+// Prints the server state, the echo rate covers the time from the first
+// accept until the last client was done.
+void print_server(const char* prefix, const config& cfg,
+                  const server_counters& c, size_t baseline) {
+  using namespace std::chrono;
+  auto accepted = c.accepted();
+  auto done = c.done();
+  auto rss = resident_bytes();
+  auto grown = rss > baseline ? rss - baseline : 0;
+  auto accept_time = nanoseconds(c.last_accept - c.first_accept);
+  auto echo_time = nanoseconds(c.last_done - c.first_accept);
+  std::cout << prefix << " connections=" << accepted
+            << " done=" << done
+            << " accept_rate=" << per_second(accepted, accept_time)
+            << " rss_kb=" << kib(rss)
+            << " per_conn_kb=" << (accepted > 0 ? kib(grown) / accepted : 0.0)
+            << " io_threads=" << c.num_shards
+            << " echo_per_s=" << per_second(done * cfg.messages, echo_time)
+            << " per_thread=";
+  for (size_t i = 0; i < c.num_shards; ++i)
+    std::cout << (i > 0 ? "/" : "") << c.shards[i].accepted;
+  std::cout << std::endl;
+}
+
+template <class Protocol, class Accept>
+void run_server(actor_system& sys, const config& cfg) {
+  using namespace std::chrono;
+  raise_fd_limit(cfg.clients);
+  auto baseline = resident_bytes();
+  auto threads = std::max(cfg.io_threads, size_t{1});
+  auto counters = std::make_shared<server_counters>(threads);
+  std::vector<std::unique_ptr<shard_config>> configs;
+  std::vector<std::unique_ptr<actor_system>> systems;
+  std::vector<std::function<void()>> servers;
+  for (size_t i = 0; i < threads; ++i) {
+    auto shard_sys = &sys;
+    if (i > 0) {
+      configs.emplace_back(new shard_config);
+      systems.emplace_back(new actor_system{*configs.back()});
+      shard_sys = systems.back().get();
+    }
+    accept_ptr<policy::new_raw_msg> pol{new Accept};
+    auto eserver = make_server<Protocol>(*shard_sys, raw_server,
+                                         std::move(pol), cfg.port, nullptr,
+                                         true, counters, i, cfg.messages);
+    if (!eserver) {
+      std::cerr << "failed to start server on port " << cfg.port
+                << " (I/O thread " << i << ")" << std::endl;
+      break;
+    }
+    using server_type = typename std::decay<decltype(*eserver)>::type;
+    auto server = std::make_shared<server_type>(std::move(*eserver));
+    servers.emplace_back([server] { (*server)->stop(); });
+  }
+  if (servers.size() == threads) {
+    auto next_print = clock_type::now() + seconds(1);
+    auto deadline = clock_type::now() + seconds(cfg.timeout);
+    while (counters->done() < cfg.clients) {
+      std::this_thread::sleep_for(milliseconds(10));
+      auto now = clock_type::now();
+      if (now >= deadline) {
+        std::cerr << "timeout with " << (cfg.clients - counters->done())
+                  << " clients left" << std::endl;
+        break;
+      }
+      if (now >= next_print) {
+        print_server("server", cfg, *counters, baseline);
+        next_print += seconds(1);
+      }
+    }
+    print_server("final", cfg, *counters, baseline);
+    std::cerr << "done" << std::endl;
+  }
+  for (auto& stop : servers)
+    stop();
+}
+
+template <class Protocol, class Transport>
+void run_client(actor_system& sys, const config& cfg) {
+  using namespace std::chrono;
+  raise_fd_limit(cfg.clients);
+  scoped_actor self{sys};
+  auto baseline = resident_bytes();
+  std::vector<actor> clients;
+  clients.reserve(cfg.clients);
+  auto connect_start = clock_type::now();
+  for (size_t i = 0; i < cfg.clients; ++i) {
+    transport_ptr pol{new Transport};
+    auto eclient = spawn_client<Protocol>(sys, raw_client, std::move(pol),
+                                          cfg.host.c_str(), cfg.port);
+    if (!eclient) {
+      std::cerr << "failed to start client " << i << " for " << cfg.host
+                << ":" << cfg.port << std::endl;
+      break;
+    }
+    clients.emplace_back(std::move(*eclient));
+  }
+  auto connect_time = clock_type::now() - connect_start;
+  auto rss = resident_bytes();
+  auto start = clock_type::now();
+  for (auto& client : clients)
+    self->send(client, start_atom::value, cfg.messages, cfg.window,
+               actor_cast<actor>(self));
+  size_t finished = 0;
+  uint64_t total = 0;
+  auto timed_out = false;
+  while (finished < clients.size() && !timed_out) {
+    self->receive(
+      [&](done_atom, uint64_t completed) {
+        finished += 1;
+        total += completed;
+      },
+      after(seconds(cfg.timeout)) >> [&] {
+        std::cerr << "timeout with " << (clients.size() - finished)
+                  << " clients left" << std::endl;
+        timed_out = true;
+      }
+    );
+  }
+  auto elapsed = clock_type::now() - start;
+  auto grown = rss > baseline ? rss - baseline : 0;
+  std::cout << "clients=" << cfg.clients
+            << " connected=" << clients.size()
+            << " finished=" << finished
+            << " messages=" << total
+            << " elapsed_ms=" << duration_cast<milliseconds>(elapsed).count()
+            << " msgs_per_s=" << per_second(total, elapsed)
+            << " connect_ms="
+            << duration_cast<milliseconds>(connect_time).count()
+            << " connects_per_s=" << per_second(clients.size(), connect_time)
+            << " rss_kb=" << kib(rss)
+            << " per_conn_kb="
+            << (clients.empty() ? 0.0 : kib(grown) / clients.size())
+            << std::endl;
+}
+
+void caf_main(actor_system& sys, const config& cfg) {
+  if (!bench::check_multiplexer(cfg.multiplexer, "fanin"))
+    return;
+  if (cfg.use_udp) {
+    using proto_t = udp_protocol<reliability<policy::raw>>;
+    if (cfg.is_server) {
+      // Each UDP newb gets its own socket, there is nothing to share.
+      if (cfg.io_threads > 1) {
+        std::cerr << "--io-threads is only supported for TCP" << std::endl;
+        std::abort();
+      }
+      run_server<proto_t, accept_udp<policy::new_raw_msg>>(sys, cfg);
+    } else {
+      run_client<proto_t, udp_transport>(sys, cfg);
+    }
+    // UDP newbs do not notice when their peer is gone.
+    std::abort();
+  }
+  using proto_t = tcp_protocol<policy::raw>;
+  if (cfg.is_server) {
+    if (cfg.io_threads > 1)
+      run_server<proto_t, accept_tcp_reuseport<policy::new_raw_msg>>(sys, cfg);
+    else
+      run_server<proto_t, accept_tcp<policy::new_raw_msg>>(sys, cfg);
+  } else {
+    run_client<proto_t, tcp_transport>(sys, cfg);
+  }
+}
+
+} // namespace anonymous
+
+CAF_MAIN(io::middleman);
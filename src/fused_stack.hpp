@@ -0,0 +1,496 @@
+#ifndef FUSED_STACK_HPP
+#define FUSED_STACK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "caf/io/newb.hpp"
+#include "caf/policy/newb_basp.hpp"
+#include "caf/policy/newb_ordering.hpp"
+#include "caf/policy/newb_raw.hpp"
+
+#include "header_codec.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Header of layers that do not add one.
+struct no_header {};
+
+template <>
+struct header_codec<no_header> {
+  static constexpr size_t size = 0;
+
+  static void encode(char*, const no_header&) {
+    // nop
+  }
+
+  static void decode(const char*, no_header&) {
+    // nop
+  }
+};
+
+/// Sum of the encoded sizes of the first `N` headers in `Headers`.
+template <size_t N, class Headers>
+struct header_offset
+    : std::integral_constant<
+        size_t,
+        header_offset<N - 1, Headers>::value
+          + header_codec<typename std::tuple_element<N - 1,
+                                                     Headers>::type>::size> {
+};
+
+template <class Headers>
+struct header_offset<0, Headers> : std::integral_constant<size_t, 0> {};
+
+// -- top layers ---------------------------------------------------------------
+
+/// Top of a fused stack that hands the payload up as `new_raw_msg`, like
+/// `raw`.
+struct fused_raw {
+  using message_type = new_raw_msg;
+  using result_type = optional<message_type>;
+  using header_type = no_header;
+
+  explicit fused_raw(io::network::newb<message_type>* parent)
+    : parent(parent) {
+    // nop
+  }
+
+  error read(const no_header&, char* bytes, size_t count) {
+    msg.payload = bytes;
+    msg.payload_len = count;
+    parent->handle(msg);
+    return none;
+  }
+
+  void write_header(io::network::byte_buffer&, io::network::header_writer*) {
+    // nop
+  }
+
+  void prepare_for_sending(io::network::byte_buffer&, size_t, size_t,
+                           size_t) {
+    // nop
+  }
+
+  io::network::newb<message_type>* parent;
+  message_type msg;
+};
+
+/// Top of a fused stack that hands the payload up as `new_basp_msg`, like
+/// `datagram_basp`. The application writes the header via the header
+/// writer, the stack fills in the payload length.
+struct fused_basp {
+  using message_type = new_basp_msg;
+  using result_type = optional<message_type>;
+  using header_type = basp_header;
+
+  explicit fused_basp(io::network::newb<message_type>* parent)
+    : parent(parent) {
+    // nop
+  }
+
+  error read(const basp_header& hdr, char* bytes, size_t count) {
+    if (hdr.payload_len > count)
+      return sec::unexpected_message;
+    msg.header = hdr;
+    msg.payload = bytes;
+    msg.payload_len = hdr.payload_len;
+    parent->handle(msg);
+    return none;
+  }
+
+  void write_header(io::network::byte_buffer& buf,
+                    io::network::header_writer* hw) {
+    CAF_ASSERT(hw != nullptr);
+    (*hw)(buf);
+  }
+
+  void prepare_for_sending(io::network::byte_buffer& buf, size_t hstart,
+                           size_t offset, size_t plen) {
+    store_be(buf.data() + hstart + offset, static_cast<uint32_t>(plen));
+  }
+
+  io::network::newb<message_type>* parent;
+  message_type msg;
+};
+
+// -- stages -------------------------------------------------------------------
+
+// Besides its `header_type`, each stage provides:
+//
+// - `accept(hdr, bytes, count)`: whether the message goes up right away
+// - `release(up)`: hands messages that waited in the stage to `up`
+// - `control(hdr)`: handles a datagram that carries only the header of the
+//   stage, returns `false` if the stage has no such datagrams
+// - `handles(atm)` and `timeout(id, up)`: timeouts the stage set
+// - `next_header()`: the header of the next message to send
+// - `sent(buf, hstart)`: sees each datagram, starting at `hstart` in `buf`,
+//   once all headers are written
+
+/// Stage of a fused stack that delivers messages in order, with the same
+/// semantics as `ordering`: early messages wait until the gap closes, their
+/// timeout expires or more than `middleman.max-pending-messages` are
+/// waiting. Late messages are dropped.
+template <class Message>
+struct fused_ordering {
+  using header_type = ordering_header;
+  using timeout_atom = atom_constant<atom("ordering")>;
+
+  struct sequence_less {
+    bool operator()(sequence_type x, sequence_type y) const {
+      return static_cast<int16_t>(x - y) < 0;
+    }
+  };
+
+  explicit fused_ordering(io::network::newb<Message>* parent)
+    : parent(parent),
+      seq_read(0),
+      seq_write(0),
+      max_pending_messages(get_or(parent->system().config(),
+                                  "middleman.max-pending-messages",
+                                  size_t{10})),
+      pending_to(std::chrono::milliseconds(100)) {
+    // nop
+  }
+
+  /// Returns whether the message goes up right away. Keeps a copy of early
+  /// messages for `release`.
+  bool accept(const ordering_header& hdr, const char* bytes, size_t count) {
+    if (hdr.seq_num == seq_read) {
+      seq_read += 1;
+      return true;
+    }
+    if (static_cast<int16_t>(hdr.seq_num - seq_read) > 0) {
+      pending[hdr.seq_num].assign(bytes, bytes + count);
+      parent->set_timeout(pending_to, timeout_atom::value,
+                          static_cast<uint32_t>(hdr.seq_num));
+      if (pending.size() > max_pending_messages)
+        seq_read = pending.begin()->first;
+    }
+    return false;
+  }
+
+  /// Hands all waiting messages that are now in order to `up`.
+  template <class Up>
+  error release(Up up) {
+    while (!pending.empty() && pending.begin()->first == seq_read) {
+      auto buf = std::move(pending.begin()->second);
+      pending.erase(pending.begin());
+      seq_read += 1;
+      if (auto err = up(buf.data(), buf.size()))
+        return err;
+    }
+    return none;
+  }
+
+  bool control(const ordering_header&) {
+    return false;
+  }
+
+  bool handles(atom_value atm) const {
+    return atm == timeout_atom::value;
+  }
+
+  /// Gives up on the messages before `id` once its timeout expired.
+  template <class Up>
+  error timeout(uint32_t id, Up up) {
+    auto seq = static_cast<sequence_type>(id);
+    if (pending.count(seq) == 0)
+      return none;
+    seq_read = seq;
+    return release(up);
+  }
+
+  ordering_header next_header() {
+    return ordering_header{seq_write++};
+  }
+
+  void sent(const io::network::byte_buffer&, size_t) {
+    // nop
+  }
+
+  io::network::newb<Message>* parent;
+  sequence_type seq_read;
+  sequence_type seq_write;
+  size_t max_pending_messages;
+  std::chrono::milliseconds pending_to;
+  std::map<sequence_type, std::vector<char>, sequence_less> pending;
+};
+
+/// Header of `fused_reliability`, laid out like the header of `reliability`.
+struct fused_reliability_header {
+  uint16_t id;
+  bool is_ack;
+};
+
+template <>
+struct header_codec<fused_reliability_header> {
+  static constexpr size_t size = sizeof(uint16_t) + sizeof(uint8_t);
+
+  static void encode(char* out, const fused_reliability_header& hdr) {
+    store_be(out, hdr.id);
+    store_be(out + sizeof(uint16_t), static_cast<uint8_t>(hdr.is_ack));
+  }
+
+  static void decode(const char* in, fused_reliability_header& hdr) {
+    hdr.id = load_be<uint16_t>(in);
+    hdr.is_ack = load_be<uint8_t>(in + sizeof(uint16_t)) != 0;
+  }
+};
+
+/// Stage of a fused stack with the same semantics as `reliability`: every
+/// message goes up and is acknowledged right away, the sender keeps a copy
+/// of each datagram and sends it again until the acknowledgement arrives.
+/// Acknowledgements carry only this header and go straight to the
+/// transport, so the stage must be the outermost one and the stack must not
+/// be `Next` of another layer.
+template <class Message>
+struct fused_reliability {
+  using header_type = fused_reliability_header;
+  using timeout_atom = atom_constant<atom("reliable")>;
+
+  explicit fused_reliability(io::network::newb<Message>* parent)
+    : parent(parent),
+      id_write(0),
+      retransmit_to(std::chrono::milliseconds(100)) {
+    // nop
+  }
+
+  bool accept(const fused_reliability_header& hdr, const char*, size_t) {
+    if (control(hdr))
+      return false;
+    auto& buf = parent->trans->wr_buf();
+    append_header(buf, fused_reliability_header{hdr.id, true});
+    parent->trans->flush(parent);
+    return true;
+  }
+
+  template <class Up>
+  error release(Up) {
+    return none;
+  }
+
+  bool control(const fused_reliability_header& hdr) {
+    if (!hdr.is_ack)
+      return false;
+    unacked.erase(hdr.id);
+    return true;
+  }
+
+  bool handles(atom_value atm) const {
+    return atm == timeout_atom::value;
+  }
+
+  /// Sends datagram `id` again unless it has been acknowledged meanwhile.
+  template <class Up>
+  error timeout(uint32_t id, Up) {
+    auto i = unacked.find(static_cast<uint16_t>(id));
+    if (i == unacked.end())
+      return none;
+    auto& buf = parent->trans->wr_buf();
+    buf.insert(buf.end(), i->second.begin(), i->second.end());
+    parent->trans->flush(parent);
+    parent->set_timeout(retransmit_to, timeout_atom::value, id);
+    return none;
+  }
+
+  fused_reliability_header next_header() {
+    return fused_reliability_header{id_write++, false};
+  }
+
+  /// Keeps a copy of the datagram until its acknowledgement arrives.
+  void sent(const io::network::byte_buffer& buf, size_t hstart) {
+    auto id = static_cast<uint16_t>(id_write - 1);
+    unacked[id].assign(buf.begin() + hstart, buf.end());
+    parent->set_timeout(retransmit_to, timeout_atom::value, id);
+  }
+
+  io::network::newb<Message>* parent;
+  uint16_t id_write;
+  std::chrono::milliseconds retransmit_to;
+  std::unordered_map<uint16_t, io::network::byte_buffer> unacked;
+};
+
+// -- stack --------------------------------------------------------------------
+
+/// Protocol stack that parses the headers of all its layers in one pass.
+/// `Stages` run from the outermost to the innermost layer, `Top` turns the
+/// payload into a message. For example, `fused<fused_raw, fused_ordering>`
+/// replaces `ordering<raw>` and `fused<fused_raw, fused_reliability,
+/// fused_ordering>` replaces `reliability<ordering<raw>>`. Offsets and the
+/// total header length are known at compile time, so a read does a single
+/// bounds check and decodes all headers with `header_codec` before the
+/// stages decide whether the message goes up. Shorter datagrams can only be
+/// control messages of the outermost stage, e.g., acknowledgements. Writing
+/// reserves the headers of all stages at once.
+///
+/// The stack has the same interface as the nested layers and can be used
+/// with `udp_protocol` or as `Next` of another layer, e.g., of
+/// `sack_reliability`.
+template <class Top, template <class> class... Stages>
+struct fused {
+  using message_type = typename Top::message_type;
+  using result_type = typename Top::result_type;
+  using layers_type = std::tuple<Stages<message_type>..., Top>;
+  using headers_type = std::tuple<typename Stages<message_type>::header_type...,
+                                  typename Top::header_type>;
+
+  /// Index of `Top` in `layers`.
+  static constexpr size_t depth = sizeof...(Stages);
+
+  /// Headers of all stages, without the header of `Top`.
+  static constexpr size_t stages_len = header_offset<depth, headers_type>::value;
+
+  /// Headers of all layers.
+  static constexpr size_t header_len
+    = header_offset<depth + 1, headers_type>::value;
+
+  template <size_t I>
+  using index = std::integral_constant<size_t, I>;
+
+  template <size_t I>
+  using header_at = typename std::tuple_element<I, headers_type>::type;
+
+  /// Continues reading at layer `I` with a message that waited in a stage.
+  template <size_t I>
+  struct resume {
+    fused* self;
+
+    error operator()(char* bytes, size_t count) const {
+      return self->template read_from<I>(bytes, count);
+    }
+  };
+
+  explicit fused(io::network::newb<message_type>* parent)
+    : layers(Stages<message_type>(parent)..., Top(parent)) {
+    // nop
+  }
+
+  // -- receiving --------------------------------------------------------------
+
+  error read(char* bytes, size_t count) {
+    return read_from<0>(bytes, count);
+  }
+
+  /// Reads a message that starts with the header of layer `I`.
+  template <size_t I>
+  error read_from(char* bytes, size_t count) {
+    if (count < header_len - header_offset<I, headers_type>::value)
+      return control(bytes, count, index<I>{});
+    headers_type hdrs;
+    decode(bytes, hdrs, index<I>{});
+    return visit(bytes, count, hdrs, index<I>{});
+  }
+
+  /// Lets stage `I` handle a datagram that carries only its header.
+  template <size_t I>
+  error control(const char* bytes, size_t count, index<I>) {
+    if (count < header_codec<header_at<I>>::size)
+      return sec::unexpected_message;
+    header_at<I> hdr;
+    header_codec<header_at<I>>::decode(bytes, hdr);
+    if (!std::get<I>(layers).control(hdr))
+      return sec::unexpected_message;
+    return none;
+  }
+
+  error control(const char*, size_t, index<depth>) {
+    return sec::unexpected_message;
+  }
+
+  template <size_t I>
+  void decode(const char* bytes, headers_type& hdrs, index<I>) {
+    header_codec<header_at<I>>::decode(bytes, std::get<I>(hdrs));
+    decode(bytes + header_codec<header_at<I>>::size, hdrs, index<I + 1>{});
+  }
+
+  void decode(const char*, headers_type&, index<depth + 1>) {
+    // nop
+  }
+
+  template <size_t I>
+  error visit(char* bytes, size_t count, headers_type& hdrs, index<I>) {
+    auto& stage = std::get<I>(layers);
+    auto len = header_codec<header_at<I>>::size;
+    if (stage.accept(std::get<I>(hdrs), bytes + len, count - len))
+      if (auto err = visit(bytes + len, count - len, hdrs, index<I + 1>{}))
+        return err;
+    // Either message may have closed a gap.
+    return stage.release(resume<I + 1>{this});
+  }
+
+  error visit(char* bytes, size_t count, headers_type& hdrs, index<depth>) {
+    auto len = header_codec<header_at<depth>>::size;
+    return std::get<depth>(layers).read(std::get<depth>(hdrs), bytes + len,
+                                        count - len);
+  }
+
+  // -- timeouts ---------------------------------------------------------------
+
+  error timeout(atom_value atm, uint32_t id) {
+    return timeout(atm, id, index<0>{});
+  }
+
+  template <size_t I>
+  error timeout(atom_value atm, uint32_t id, index<I>) {
+    auto& stage = std::get<I>(layers);
+    if (stage.handles(atm))
+      return stage.timeout(id, resume<I + 1>{this});
+    return timeout(atm, id, index<I + 1>{});
+  }
+
+  error timeout(atom_value, uint32_t, index<depth>) {
+    return none;
+  }
+
+  // -- sending ----------------------------------------------------------------
+
+  void write_header(io::network::byte_buffer& buf,
+                    io::network::header_writer* hw) {
+    auto offset = buf.size();
+    buf.resize(offset + stages_len);
+    encode(buf.data() + offset, index<0>{});
+    std::get<depth>(layers).write_header(buf, hw);
+  }
+
+  template <size_t I>
+  void encode(char* out, index<I>) {
+    header_codec<header_at<I>>::encode(out, std::get<I>(layers).next_header());
+    encode(out + header_codec<header_at<I>>::size, index<I + 1>{});
+  }
+
+  void encode(char*, index<depth>) {
+    // nop
+  }
+
+  void prepare_for_sending(io::network::byte_buffer& buf, size_t hstart,
+                           size_t offset, size_t plen) {
+    std::get<depth>(layers).prepare_for_sending(buf, hstart,
+                                                offset + stages_len, plen);
+    sent(buf, hstart, index<0>{});
+  }
+
+  template <size_t I>
+  void sent(const io::network::byte_buffer& buf, size_t hstart, index<I>) {
+    std::get<I>(layers).sent(buf, hstart);
+    sent(buf, hstart, index<I + 1>{});
+  }
+
+  void sent(const io::network::byte_buffer&, size_t, index<depth>) {
+    // nop
+  }
+
+  layers_type layers;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // FUSED_STACK_HPP
@@ -0,0 +1,96 @@
+#ifndef HEADER_CODEC_HPP
+#define HEADER_CODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "caf/io/newb.hpp"
+#include "caf/policy/newb_basp.hpp"
+#include "caf/policy/newb_ordering.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Stores `x` in big-endian byte order, the order `binary_serializer` uses
+/// for integers. Compilers turn the loop into a byte swap and a single store.
+template <class T>
+void store_be(char* out, T x) {
+  for (size_t i = sizeof(T); i > 0; --i) {
+    out[i - 1] = static_cast<char>(x & 0xFF);
+    x = static_cast<T>(x >> 8);
+  }
+}
+
+/// Loads a big-endian integer written by `store_be`.
+template <class T>
+T load_be(const char* in) {
+  T x = 0;
+  for (size_t i = 0; i < sizeof(T); ++i)
+    x = static_cast<T>((x << 8) | static_cast<uint8_t>(in[i]));
+  return x;
+}
+
+/// Encodes and decodes fixed-size headers directly from and to raw memory.
+/// Specializations produce the same bytes as `binary_serializer`, so both
+/// ends of a connection can mix them, but skip the virtual dispatch of the
+/// serializer and the closure around it. Each specialization provides:
+///
+/// - `size`: encoded size in bytes, known at compile time
+/// - `encode(char* out, const Header&)`: writes `size` bytes to `out`
+/// - `decode(const char* in, Header&)`: reads `size` bytes from `in`
+template <class Header>
+struct header_codec;
+
+/// Shared by `stream_basp` and `datagram_basp`.
+template <>
+struct header_codec<basp_header> {
+  static constexpr size_t size = basp_header_len;
+  static constexpr size_t from_offset = sizeof(uint32_t);
+  static constexpr size_t to_offset = from_offset + sizeof(actor_id);
+
+  static void encode(char* out, const basp_header& hdr) {
+    store_be(out, hdr.payload_len);
+    store_be(out + from_offset, hdr.from);
+    store_be(out + to_offset, hdr.to);
+  }
+
+  static void decode(const char* in, basp_header& hdr) {
+    hdr.payload_len = load_be<uint32_t>(in);
+    hdr.from = load_be<actor_id>(in + from_offset);
+    hdr.to = load_be<actor_id>(in + to_offset);
+  }
+};
+
+template <>
+struct header_codec<ordering_header> {
+  static constexpr size_t size = ordering_header_len;
+
+  static void encode(char* out, const ordering_header& hdr) {
+    store_be(out, hdr.seq_num);
+  }
+
+  static void decode(const char* in, ordering_header& hdr) {
+    hdr.seq_num = load_be<sequence_type>(in);
+  }
+};
+
+/// Reserves room for a `Header` at the end of `buf` and returns its offset.
+/// The header can be encoded later on, e.g., once the payload size is known.
+template <class Header>
+size_t reserve_header(io::network::byte_buffer& buf) {
+  auto offset = buf.size();
+  buf.resize(offset + header_codec<Header>::size);
+  return offset;
+}
+
+/// Appends the encoded `hdr` to `buf`.
+template <class Header>
+void append_header(io::network::byte_buffer& buf, const Header& hdr) {
+  auto offset = reserve_header<Header>(buf);
+  header_codec<Header>::encode(buf.data() + offset, hdr);
+}
+
+} // namespace policy
+} // namespace caf
+
+#endif // HEADER_CODEC_HPP
@@ -2,53 +2,123 @@
 #include <caf/binary_deserializer.hpp>
 #include <caf/binary_serializer.hpp>
 #include <caf/detail/call_cfun.hpp>
+#include <caf/io/middleman.hpp>
 #include <caf/io/newb.hpp>
 #include <caf/logger.hpp>
 #include <caf/policy/newb_basp.hpp>
 #include <caf/policy/newb_ordering.hpp>
 #include <caf/policy/newb_raw.hpp>
+#include <caf/policy/newb_reliability.hpp>
 #include <caf/policy/newb_tcp.hpp>
 #include <caf/policy/newb_udp.hpp>
 
 #include <benchmark/benchmark.h>
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "buffer_pool.hpp"
+#include "fused_stack.hpp"
+#include "header_codec.hpp"
+#include "latency_histogram.hpp"
+#include "loss_model.hpp"
+#include "multiplexer_backend.hpp"
+#include "pipeline_window.hpp"
+#include "reorder_buffer.hpp"
+#include "sack_reliability.hpp"
+#include "tcp_vectored_transport.hpp"
+#include "timer_wheel.hpp"
+#include "udp_mmsg_transport.hpp"
+#include "uring_transport.hpp"
+#include "write_arena.hpp"
+
 using namespace caf;
 using namespace caf::io;
 using namespace caf::io::network;
 using namespace caf::policy;
 
+// Counts heap allocations of the current thread while `count_allocations` is
+// set. Only benchmarks that report allocations per message turn it on, all
+// others pay for a single branch.
+thread_local bool count_allocations = false;
+thread_local size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+  if (count_allocations)
+    heap_allocations += 1;
+  if (auto ptr = std::malloc(size))
+    return ptr;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
 namespace {
 
 using ordering_atom = atom_constant<atom("ordering")>;
+using dispatch_atom = atom_constant<atom("dispatch")>;
 
 constexpr auto from = 6;
 constexpr auto to = 13;
 
+// Time stamp counter if available, nanoseconds otherwise.
+inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  using namespace std::chrono;
+  auto t = steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(duration_cast<nanoseconds>(t).count());
+#endif
+}
+
 // Receiving is currently datagram only.
 struct dummy_transport : public transport {
   dummy_transport(size_t payload_len)
     : maximum(std::numeric_limits<uint16_t>::max()),
       writing(false),
       written(0),
-      offline_sum(0),
       write_seq(false),
       write_size(false),
+      write_rel(false),
       next(0),
       payload_len(payload_len),
       upayload_len(static_cast<uint32_t>(payload_len)) {
     max_consecutive_reads = 1;
+    arena.reserve(offline_buffer, send_buffer);
   }
 
   inline rw_state read_some(newb_base* parent) override {
     received_bytes = payload_len;
     stream_serializer<charbuf> out{&parent->backend(),
                                    receive_buffer.data(),
-                                   sizeof(next) + sizeof(upayload_len)};
+                                   reliability_header_len + sizeof(next)
+                                     + sizeof(upayload_len)};
+    if (write_rel) {
+      // Drop the acknowledgements for earlier messages, nobody listens.
+      while (writing)
+        write_some(parent);
+      out(reliability_header{static_cast<id_type>(next), false});
+      received_bytes += reliability_header_len;
+    }
     if (write_seq) {
       out(next);
-      next += 1;
       received_bytes += caf::policy::ordering_header_len;
     }
+    next += 1;
     if (write_size) {
       out(upayload_len);
       received_bytes += caf::policy::basp_header_len;
@@ -70,36 +140,21 @@ struct dummy_transport : public transport {
   }
 
   inline rw_state write_some(newb_base* parent) override {
-    written += send_sizes.front();
-    send_sizes.pop_front();
-    auto remaining = send_buffer.size() - written;
-    if (remaining == 0)
+    written += arena.size();
+    arena.consume();
+    if (arena.empty())
       prepare_next_write(parent);
     return rw_state::success;
   }
 
   void prepare_next_write(newb_base*) override {
     written = 0;
-    send_buffer.clear();
-    send_sizes.clear();
-    if (offline_buffer.empty()) {
+    if (!arena.swap(offline_buffer, send_buffer))
       writing = false;
-    } else {
-      offline_sizes.push_back(offline_buffer.size() - offline_sum);
-       // Switch buffers.
-      send_buffer.swap(offline_buffer);
-      send_sizes.swap(offline_sizes);
-      // Reset sum.
-      offline_sum = 0;
-    }
   }
 
   byte_buffer& wr_buf() override {
-    if (!offline_buffer.empty()) {
-      auto chunk_size = offline_buffer.size() - offline_sum;
-      offline_sizes.push_back(chunk_size);
-      offline_sum += chunk_size;
-    }
+    arena.mark(offline_buffer);
     return offline_buffer;
   }
 
@@ -122,32 +177,128 @@ struct dummy_transport : public transport {
   // State for writing.
   bool writing;
   size_t written;
-  size_t offline_sum;
-  std::deque<size_t> send_sizes;
-  std::deque<size_t> offline_sizes;
+  write_arena arena;
 
   // Some moocks for receiving packets.
   bool write_seq;
   bool write_size;
+  bool write_rel;
   sequence_type next;
   size_t payload_len;
   uint32_t upayload_len;
 };
 
+// Mimics `udp_mmsg_transport`: flushing only marks the transport as writing
+// and the next write event hands all collected chunks over at once.
+struct dummy_batch_transport : public dummy_transport {
+  dummy_batch_transport(size_t payload_len, size_t max_batch)
+    : dummy_transport(payload_len),
+      max_batch(max_batch) {
+    // nop
+  }
+
+  inline rw_state write_some(newb_base* parent) override {
+    if (arena.empty())
+      prepare_next_write(parent);
+    auto n = std::min(arena.chunks(), max_batch);
+    for (size_t i = 0; i < n; ++i)
+      written += arena.size(i);
+    arena.consume(n);
+    if (arena.empty())
+      prepare_next_write(parent);
+    return rw_state::success;
+  }
+
+  void flush(newb_base*) override {
+    if (!offline_buffer.empty() && !writing)
+      writing = true;
+  }
+
+  size_t max_batch;
+};
+
+// Hands out receive buffers from a pool instead of resizing a single buffer,
+// the buffer goes back to the pool once the newb is done with the message.
+struct dummy_pooled_transport : public dummy_transport {
+  dummy_pooled_transport(size_t payload_len)
+    : dummy_transport(payload_len),
+      pool(maximum) {
+    // nop
+  }
+
+  inline rw_state read_some(newb_base* parent) override {
+    recycle_receive_buffer();
+    receive_buffer = pool.acquire();
+    return dummy_transport::read_some(parent);
+  }
+
+  void prepare_next_read(newb_base*) override {
+    received_bytes = 0;
+    recycle_receive_buffer();
+  }
+
+  void recycle_receive_buffer() {
+    if (!receive_buffer.empty()) {
+      pool.release(std::move(receive_buffer));
+      receive_buffer.clear();
+    }
+  }
+
+  buffer_pool pool;
+};
+
+// Baseline for `dummy_pooled_transport`: hands the newb a freshly allocated
+// receive buffer per datagram and frees it once the newb is done with the
+// message, i.e., passes buffer ownership up without a pool.
+struct dummy_unpooled_transport : public dummy_transport {
+  dummy_unpooled_transport(size_t payload_len)
+    : dummy_transport(payload_len) {
+    // nop
+  }
+
+  inline rw_state read_some(newb_base* parent) override {
+    receive_buffer = byte_buffer(maximum);
+    return dummy_transport::read_some(parent);
+  }
+
+  void prepare_next_read(newb_base*) override {
+    received_bytes = 0;
+    byte_buffer{}.swap(receive_buffer);
+  }
+};
+
 struct dummy_state {
   bool received;
+  size_t count;
 };
 
 template <class Message>
 behavior dummy_newb(stateful_newb<Message, dummy_state>* self) {
   self->set_default_handler(print_and_drop);
   self->state.received = false;
+  self->state.count = 0;
   self->set_timeout_handler([&](timeout_msg&) {
     // Drop timeouts.
   });
   return {
     [=](const Message&) {
       self->state.received = true;
+      self->state.count += 1;
+    }
+  };
+}
+
+// Counts messages from read events and from the mailbox alike.
+behavior dispatch_newb(stateful_newb<new_raw_msg, dummy_state>* self) {
+  self->set_default_handler(print_and_drop);
+  self->state.received = false;
+  self->state.count = 0;
+  return {
+    [=](const new_raw_msg&) {
+      self->state.count += 1;
+    },
+    [=](dispatch_atom, const std::vector<char>&) {
+      self->state.count += 1;
     }
   };
 }
@@ -165,6 +316,14 @@ public:
   }
 };
 
+// Fused counterparts of the nested UDP stacks, see `fused_stack.hpp`. The
+// TCP stacks only have a single layer, there is nothing to fuse.
+using fused_raw_stack = fused<fused_raw>;
+using fused_ordering_raw = fused<fused_raw, fused_ordering>;
+using fused_basp_stack = fused<fused_basp>;
+using fused_ordering_basp = fused<fused_basp, fused_ordering>;
+using fused_reliable_raw = fused<fused_raw, fused_reliability, fused_ordering>;
+
 // -- sending ------------------------------------------------------------------
 
 template <class Message, class Protocol>
@@ -212,14 +371,636 @@ BENCHMARK_TEMPLATE(BM_send, new_basp_msg, udp_protocol<datagram_basp>)
 BENCHMARK_TEMPLATE(BM_send, new_basp_msg, udp_protocol<ordering<datagram_basp>>)
   ->RangeMultiplier(2)->Range(1<<from,1<<to);
 
-// -- receiving ----------------------------------------------------------------
+BENCHMARK_TEMPLATE(BM_send, new_raw_msg, udp_protocol<fused_raw_stack>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send, new_raw_msg, udp_protocol<fused_ordering_raw>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send, new_basp_msg, udp_protocol<fused_basp_stack>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send, new_basp_msg, udp_protocol<fused_ordering_basp>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
 
+// Same as `BM_send`, but the header writer encodes the BASP header with
+// `header_codec` and is created once instead of per message, and no
+// serializer is involved. The difference to `BM_send` is the saving per
+// message on the send path.
 template <class Message, class Protocol>
-static void BM_receive_impl(benchmark::State& state, bool wseq, bool wsize) {
+static void BM_send_codec(benchmark::State& state) {
   config cfg;
   actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  transport_ptr trans{new dummy_transport(packet_size)};
   caf::io::network::native_socket sock(1337);
-  auto tptr = new dummy_transport(state.range(0));
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    append_header(buf, basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  for (auto _ : state) {
+    {
+      auto whdl = ref.wr_buf(&hw);
+      auto start = whdl.buf->size();
+      whdl.buf->resize(start + packet_size);
+      std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
+    }
+    ref.write_event();
+  }
+  ref.stop();
+}
+
+BENCHMARK_TEMPLATE(BM_send_codec, new_basp_msg, tcp_protocol<stream_basp>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send_codec, new_basp_msg, udp_protocol<datagram_basp>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send_codec, new_basp_msg,
+                   udp_protocol<ordering<datagram_basp>>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send_codec, new_basp_msg, udp_protocol<fused_basp_stack>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+BENCHMARK_TEMPLATE(BM_send_codec, new_basp_msg,
+                   udp_protocol<fused_ordering_basp>)
+  ->RangeMultiplier(2)->Range(1<<from,1<<to);
+
+// Queues `range(1)` chunks before draining them with one write event per
+// chunk, i.e., exercises the chunk bookkeeping with that many chunks
+// outstanding.
+template <class Message, class Protocol>
+static void BM_send_outstanding(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t outstanding = static_cast<size_t>(state.range(1));
+  auto tptr = new dummy_transport(packet_size);
+  transport_ptr trans{tptr};
+  caf::io::network::native_socket sock(1337);
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  uint64_t total_cycles = 0;
+  for (auto _ : state) {
+    auto start = cycles();
+    for (size_t i = 0; i < outstanding; ++i) {
+      auto whdl = ref.wr_buf(nullptr);
+      auto pos = whdl.buf->size();
+      whdl.buf->resize(pos + packet_size);
+      std::fill(whdl.buf->begin() + pos, whdl.buf->end(), 'a');
+    }
+    while (tptr->writing)
+      ref.write_event();
+    total_cycles += cycles() - start;
+  }
+  auto chunks = state.iterations() * outstanding;
+  state.SetItemsProcessed(static_cast<int64_t>(chunks));
+  state.counters["cycles_per_chunk"]
+    = static_cast<double>(total_cycles) / chunks;
+  ref.stop();
+}
+
+static void outstanding_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << from, 1 << 10})
+    for (auto outstanding : {1, 8, 64})
+      b->Args({size, outstanding});
+}
+
+BENCHMARK_TEMPLATE(BM_send_outstanding, new_raw_msg, udp_protocol<raw>)
+  ->Apply(outstanding_args);
+BENCHMARK_TEMPLATE(BM_send_outstanding, new_raw_msg,
+                   udp_protocol<ordering<raw>>)
+  ->Apply(outstanding_args);
+
+// Writes `range(1)` messages before a single write event hands them to the
+// transport as one batch.
+template <class Message, class Protocol>
+static void BM_send_batched(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  transport_ptr trans{new dummy_batch_transport(packet_size, batch_size)};
+  caf::io::network::native_socket sock(1337);
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    binary_serializer bs(sys, buf);
+    bs(basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch_size; ++i) {
+      auto whdl = ref.wr_buf(&hw);
+      auto start = whdl.buf->size();
+      whdl.buf->resize(start + packet_size);
+      std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
+    }
+    ref.write_event();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                               * batch_size));
+  ref.stop();
+}
+
+static void batch_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << from, 1 << 10, 1 << to})
+    for (auto batch = 1; batch <= 64; batch *= 2)
+      b->Args({size, batch});
+}
+
+BENCHMARK_TEMPLATE(BM_send_batched, new_raw_msg, udp_protocol<raw>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_batched, new_raw_msg, udp_protocol<ordering<raw>>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_batched, new_basp_msg, udp_protocol<datagram_basp>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_batched, new_basp_msg,
+                   udp_protocol<ordering<datagram_basp>>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_batched, new_raw_msg,
+                   udp_protocol<fused_ordering_raw>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_batched, new_basp_msg,
+                   udp_protocol<fused_ordering_basp>)
+  ->Apply(batch_args);
+
+// Same as above, but on a loopback socket with `sendmmsg` doing the work.
+template <class Message, class Protocol>
+static void BM_send_mmsg(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  // Bind a socket to receive our messages and drain it from time to time.
+  auto sink = ::socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (sink < 0 || ::bind(sink, reinterpret_cast<sockaddr*>(&addr), addr_len) < 0
+      || ::getsockname(sink, reinterpret_cast<sockaddr*>(&addr), &addr_len) < 0) {
+    state.SkipWithError("failed to create sink socket");
+    if (sink >= 0)
+      ::close(sink);
+    return;
+  }
+  auto tptr = new udp_mmsg_transport(batch_size);
+  transport_ptr trans{tptr};
+  auto sock = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  if (!sock) {
+    state.SkipWithError("failed to connect to sink socket");
+    ::close(sink);
+    return;
+  }
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), *sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    binary_serializer bs(sys, buf);
+    bs(basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  std::vector<char> drain(std::numeric_limits<uint16_t>::max());
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch_size; ++i) {
+      auto whdl = ref.wr_buf(&hw);
+      auto start = whdl.buf->size();
+      whdl.buf->resize(start + packet_size);
+      std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
+    }
+    ref.write_event();
+    state.PauseTiming();
+    while (::recv(sink, drain.data(), drain.size(), MSG_DONTWAIT) > 0)
+      ; // nop
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                               * batch_size));
+  ref.stop();
+  ::close(sink);
+}
+
+BENCHMARK_TEMPLATE(BM_send_mmsg, new_raw_msg, udp_protocol<raw>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_mmsg, new_basp_msg, udp_protocol<datagram_basp>)
+  ->Apply(batch_args);
+
+// Binds a socket of the given type to an ephemeral port on the loopback
+// interface, `listen`s on stream sockets.
+static int bind_loopback(int type, sockaddr_in& addr) {
+  auto fd = ::socket(AF_INET, type, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) < 0
+      || ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) < 0
+      || (type == SOCK_STREAM && ::listen(fd, 1) < 0)) {
+    if (fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// -- vectored writes ---------------------------------------------------------
+
+// Writes `batch_size` messages with `payload` through `ref`, either copied
+// into the write buffer or as external data the transport sends from where
+// it is, and keeps the transport writing until everything went out. The
+// socket is drained via `drain` whenever the kernel stops taking data.
+template <class Message, class Transport, class Drain>
+static void write_vectored(newb<Message>& ref, Transport& trans,
+                           header_writer& hw,
+                           const std::shared_ptr<const byte_buffer>& payload,
+                           bool external, size_t batch_size, Drain drain,
+                           benchmark::State& state) {
+  for (size_t i = 0; i < batch_size; ++i) {
+    if (external) {
+      // The header goes out once the handle is gone, the payload follows.
+      ref.wr_buf(&hw);
+      trans.write_external(&ref, payload);
+    } else {
+      auto whdl = ref.wr_buf(&hw);
+      whdl.buf->insert(whdl.buf->end(), payload->begin(), payload->end());
+    }
+  }
+  ref.write_event();
+  while (trans.writing) {
+    state.PauseTiming();
+    drain();
+    state.ResumeTiming();
+    ref.write_event();
+  }
+}
+
+static void vectored_counters(benchmark::State& state, size_t batch_size) {
+  auto messages = static_cast<int64_t>(state.iterations() * batch_size);
+  state.SetItemsProcessed(messages);
+  state.SetBytesProcessed(messages * state.range(0));
+}
+
+// Sends `range(1)` messages of `range(0)` bytes per iteration over a TCP
+// connection on loopback. With `range(2)` set, the payload is handed to the
+// transport as external data and goes out via `sendmsg` next to the header
+// without being copied into the send buffer. With `range(3)` set, the
+// transport sends with `MSG_ZEROCOPY` and an iteration only ends once the
+// kernel confirmed all sends. The benchmark rechecks a parked transport right
+// away instead of waiting for the delay.
+template <class Message, class Protocol>
+static void BM_send_vectored_tcp(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  bool external = state.range(2) != 0;
+  bool zerocopy = state.range(3) != 0;
+  sockaddr_in addr;
+  auto acceptor = bind_loopback(SOCK_STREAM, addr);
+  if (acceptor < 0) {
+    state.SkipWithError("failed to create listening socket");
+    return;
+  }
+  auto tptr = new tcp_vectored_transport(zerocopy);
+  transport_ptr trans{tptr};
+  auto sock = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  auto peer = ::accept(acceptor, nullptr, nullptr);
+  ::close(acceptor);
+  if (!sock || peer < 0) {
+    state.SkipWithError("failed to connect to peer socket");
+    if (peer >= 0)
+      ::close(peer);
+    return;
+  }
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), *sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    append_header(buf, basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  auto payload = std::make_shared<const byte_buffer>(packet_size, 'a');
+  std::vector<char> buf(1 << 16);
+  auto drain = [&] {
+    while (::recv(peer, buf.data(), buf.size(), MSG_DONTWAIT) > 0)
+      ; // nop
+  };
+  uint32_t recheck_id = 0;
+  tptr->schedule_recheck = [&](std::chrono::microseconds, uint32_t id) {
+    recheck_id = id;
+  };
+  for (auto _ : state) {
+    write_vectored(ref, *tptr, hw, payload, external, batch_size, drain,
+                   state);
+    while (tptr->parked) {
+      state.PauseTiming();
+      drain();
+      state.ResumeTiming();
+      tptr->recheck(&ref, recheck_id);
+    }
+    state.PauseTiming();
+    drain();
+    state.ResumeTiming();
+  }
+  vectored_counters(state, batch_size);
+  if (zerocopy) {
+    if (!tptr->zerocopy)
+      state.SkipWithError("SO_ZEROCOPY is not supported");
+    // Loopback connections always end up copying.
+    auto& zc = tptr->stats;
+    state.counters["copied_share"]
+      = zc.completions > 0 ? static_cast<double>(zc.copied) / zc.completions
+                           : 0.0;
+  }
+  ref.stop();
+  ::close(peer);
+}
+
+// Same on a UDP socket with `sendmmsg`, each datagram consists of the
+// headers from the send buffer and the external payload. Stops at 32 KiB,
+// a UDP datagram cannot carry 64 KiB.
+template <class Message, class Protocol>
+static void BM_send_vectored_udp(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  bool external = state.range(2) != 0;
+  sockaddr_in addr;
+  auto sink = bind_loopback(SOCK_DGRAM, addr);
+  if (sink < 0) {
+    state.SkipWithError("failed to create sink socket");
+    return;
+  }
+  auto tptr = new udp_mmsg_transport(batch_size);
+  transport_ptr trans{tptr};
+  auto sock = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  if (!sock) {
+    state.SkipWithError("failed to connect to sink socket");
+    ::close(sink);
+    return;
+  }
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), *sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    append_header(buf, basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  auto payload = std::make_shared<const byte_buffer>(packet_size, 'a');
+  std::vector<char> buf(std::numeric_limits<uint16_t>::max());
+  auto drain = [&] {
+    while (::recv(sink, buf.data(), buf.size(), MSG_DONTWAIT) > 0)
+      ; // nop
+  };
+  for (auto _ : state) {
+    write_vectored(ref, *tptr, hw, payload, external, batch_size, drain,
+                   state);
+    state.PauseTiming();
+    drain();
+    state.ResumeTiming();
+  }
+  vectored_counters(state, batch_size);
+  ref.stop();
+  ::close(sink);
+}
+
+static void vectored_tcp_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << 10, 1 << 12, 1 << 14, 1 << 15, 1 << 16})
+    for (auto batch : {1, 16})
+      for (auto external : {0, 1})
+        b->Args({size, batch, external, 0});
+}
+
+static void vectored_udp_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << 10, 1 << 12, 1 << 14, 1 << 15})
+    for (auto batch : {1, 16})
+      for (auto external : {0, 1})
+        b->Args({size, batch, external});
+}
+
+// Zero-copy only pays off for large writes.
+static void zerocopy_tcp_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << 13, 1 << 15, 1 << 17, 1 << 19, 1 << 20})
+    for (auto batch : {1, 8})
+      for (auto external : {0, 1})
+        for (auto zerocopy : {0, 1})
+          b->Args({size, batch, external, zerocopy});
+}
+
+BENCHMARK_TEMPLATE(BM_send_vectored_tcp, new_raw_msg, tcp_protocol<raw>)
+  ->Apply(vectored_tcp_args);
+BENCHMARK_TEMPLATE(BM_send_vectored_tcp, new_raw_msg, tcp_protocol<raw>)
+  ->Apply(zerocopy_tcp_args);
+BENCHMARK_TEMPLATE(BM_send_vectored_udp, new_raw_msg, udp_protocol<raw>)
+  ->Apply(vectored_udp_args);
+BENCHMARK_TEMPLATE(BM_send_vectored_udp, new_raw_msg,
+                   udp_protocol<ordering<raw>>)
+  ->Apply(vectored_udp_args);
+
+#ifdef NEWB_HAVE_LIBURING
+
+// Returns the address of a datagram socket, binds it to loopback first if
+// it did not send anything yet.
+static bool local_address(int fd, sockaddr_in& addr) {
+  socklen_t addr_len = sizeof(addr);
+  if (::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) < 0)
+    return false;
+  if (addr.sin_port != 0)
+    return true;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return ::bind(fd, reinterpret_cast<sockaddr*>(&addr), addr_len) == 0
+         && ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr),
+                          &addr_len) == 0;
+}
+
+// Same as `BM_send_mmsg`, but chunks go out as linked `sendmsg` requests on
+// an io_uring. Writes during a round trip through the ring are batched into
+// the next submission. Read events harvest the send completions.
+template <class Message, class Protocol>
+static void BM_send_uring(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  sockaddr_in addr;
+  auto sink = bind_loopback(SOCK_DGRAM, addr);
+  if (sink < 0) {
+    state.SkipWithError("failed to create sink socket");
+    return;
+  }
+  auto tptr = new udp_uring_transport;
+  transport_ptr trans{tptr};
+  auto efd = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  if (!efd) {
+    state.SkipWithError("failed to set up io_uring");
+    ::close(sink);
+    return;
+  }
+  auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
+                                        std::move(trans), *efd);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<newb<Message>&>(*ptr);
+  auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+    binary_serializer bs(sys, buf);
+    bs(basp_header{0, actor_id{}, actor_id{}});
+    return none;
+  });
+  std::vector<char> drain(std::numeric_limits<uint16_t>::max());
+  for (auto _ : state) {
+    for (size_t i = 0; i < batch_size; ++i) {
+      auto whdl = ref.wr_buf(&hw);
+      auto start = whdl.buf->size();
+      whdl.buf->resize(start + packet_size);
+      std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
+    }
+    while (tptr->writing)
+      ref.read_event();
+    state.PauseTiming();
+    while (::recv(sink, drain.data(), drain.size(), MSG_DONTWAIT) > 0)
+      ; // nop
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                               * batch_size));
+  state.counters["sqes_per_submit"]
+    = tptr->submits > 0 ? static_cast<double>(tptr->sqes) / tptr->submits
+                        : 0.0;
+  ref.stop();
+  ::close(sink);
+}
+
+BENCHMARK_TEMPLATE(BM_send_uring, new_raw_msg, udp_protocol<raw>)
+  ->Apply(batch_args);
+BENCHMARK_TEMPLATE(BM_send_uring, new_basp_msg, udp_protocol<datagram_basp>)
+  ->Apply(batch_args);
+
+// A peer socket sends `range(1)` datagrams per iteration on loopback, the
+// newb receives them via the queued `recvmsg` requests of its ring.
+static void BM_receive_uring_udp(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  sockaddr_in addr;
+  auto peer = bind_loopback(SOCK_DGRAM, addr);
+  if (peer < 0) {
+    state.SkipWithError("failed to create peer socket");
+    return;
+  }
+  auto tptr = new udp_uring_transport;
+  transport_ptr trans{tptr};
+  auto efd = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  sockaddr_in local;
+  socklen_t local_len = sizeof(local);
+  if (!efd || !local_address(tptr->sock, local)) {
+    state.SkipWithError("failed to set up io_uring");
+    ::close(peer);
+    return;
+  }
+  auto n = spawn_newb<udp_protocol<raw>, hidden>(sys, dummy_newb<new_raw_msg>,
+                                                 std::move(trans), *efd);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<new_raw_msg, dummy_state>&>(*ptr);
+  std::vector<char> payload(packet_size, 'a');
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (size_t i = 0; i < batch_size; ++i)
+      ::sendto(peer, payload.data(), payload.size(), 0,
+               reinterpret_cast<sockaddr*>(&local), local_len);
+    state.ResumeTiming();
+    ref.state.count = 0;
+    while (ref.state.count < batch_size)
+      ref.read_event();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                               * batch_size));
+  ref.stop();
+  ::close(peer);
+}
+
+// Same for a TCP connection, the multishot receive keeps delivering into
+// provided buffers and the transport cuts the stream into messages.
+static void BM_receive_uring_tcp(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  size_t packet_size = static_cast<size_t>(state.range(0));
+  size_t batch_size = static_cast<size_t>(state.range(1));
+  sockaddr_in addr;
+  auto acceptor = bind_loopback(SOCK_STREAM, addr);
+  if (acceptor < 0) {
+    state.SkipWithError("failed to create listening socket");
+    return;
+  }
+  auto tptr = new tcp_uring_transport;
+  transport_ptr trans{tptr};
+  auto efd = tptr->connect("127.0.0.1", ntohs(addr.sin_port));
+  auto peer = ::accept(acceptor, nullptr, nullptr);
+  ::close(acceptor);
+  if (!efd || peer < 0) {
+    state.SkipWithError("failed to set up io_uring");
+    if (peer >= 0)
+      ::close(peer);
+    return;
+  }
+  auto n = spawn_newb<tcp_protocol<raw>, hidden>(sys, dummy_newb<new_raw_msg>,
+                                                 std::move(trans), *efd);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<new_raw_msg, dummy_state>&>(*ptr);
+  ref.configure_read(io::receive_policy::exactly(packet_size));
+  std::vector<char> payload(packet_size * batch_size, 'a');
+  for (auto _ : state) {
+    state.PauseTiming();
+    ::send(peer, payload.data(), payload.size(), 0);
+    state.ResumeTiming();
+    ref.state.count = 0;
+    while (ref.state.count < batch_size)
+      ref.read_event();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                               * batch_size));
+  ref.stop();
+  ::close(peer);
+}
+
+// Keeps a batch within the default socket receive buffer, datagrams that do
+// not fit would be dropped before the ring picks them up.
+static void uring_receive_args(benchmark::internal::Benchmark* b) {
+  for (auto size : {1 << from, 1 << 10})
+    for (auto batch = 1; batch <= 64; batch *= 2)
+      b->Args({size, batch});
+}
+
+BENCHMARK(BM_receive_uring_udp)->Apply(uring_receive_args);
+BENCHMARK(BM_receive_uring_tcp)->Apply(uring_receive_args);
+
+#endif // NEWB_HAVE_LIBURING
+
+// -- receiving ----------------------------------------------------------------
+
+// Each iteration receives `batch` messages, the transport hands up to `batch`
+// datagrams to the protocol per read event, similar to `recvmmsg`. With
+// `count_allocs`, also reports the heap allocations per message. With `wrel`,
+// messages start with the header of `reliability` and the acknowledgements
+// go nowhere.
+template <class Message, class Protocol, class Transport = dummy_transport>
+static void BM_receive_impl(benchmark::State& state, bool wseq, bool wsize,
+                            size_t batch = 1, bool count_allocs = false,
+                            bool wrel = false) {
+  config cfg;
+  actor_system sys{cfg};
+  caf::io::network::native_socket sock(1337);
+  auto tptr = new Transport(state.range(0));
+  tptr->max_consecutive_reads = batch;
   transport_ptr trans{tptr};
   auto n = spawn_newb<Protocol, hidden>(sys, dummy_newb<Message>,
                                         std::move(trans), sock);
@@ -227,6 +1008,7 @@ static void BM_receive_impl(benchmark::State& state, bool wseq, bool wsize) {
   auto& ref = dynamic_cast<stateful_newb<Message, dummy_state>&>(*ptr);
   tptr->write_seq = wseq;
   tptr->write_size = wsize;
+  tptr->write_rel = wrel;
   // prepare receive buffer
   size_t packet_size = state.range(0);
   auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
@@ -241,11 +1023,19 @@ static void BM_receive_impl(benchmark::State& state, bool wseq, bool wsize) {
     std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
   }
   ref.trans->receive_buffer = ref.trans->send_buffer;
+  count_allocations = count_allocs;
+  auto allocs_before = heap_allocations;
   for (auto _ : state) {
-    ref.state.received = false;
-    while (!ref.state.received)
+    ref.state.count = 0;
+    while (ref.state.count < batch)
       ref.read_event();
   }
+  count_allocations = false;
+  auto allocs = heap_allocations - allocs_before;
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * batch));
+  if (count_allocs)
+    state.counters["allocs_per_msg"]
+      = static_cast<double>(allocs) / (state.iterations() * batch);
   ref.stop();
 }
 
@@ -273,14 +1063,183 @@ static void BM_receive_tcp_basp(benchmark::State& state) {
   BM_receive_impl<new_basp_msg, tcp_protocol<stream_basp>>(state, false, true);
 }
 
+static void BM_receive_udp_raw_batched(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<raw>>(state, false, false,
+                                                  state.range(1));
+}
+
+static void BM_receive_udp_ordering_raw_batched(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<ordering<raw>>>(state, true, false,
+                                                            state.range(1));
+}
+
+static void BM_receive_udp_ordering_basp_batched(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<ordering<datagram_basp>>>(
+    state, true, true, state.range(1));
+}
+
+static void BM_receive_udp_raw_unpooled(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<raw>, dummy_unpooled_transport>(
+    state, false, false, 1, true);
+}
+
+static void BM_receive_udp_basp_unpooled(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<datagram_basp>,
+                  dummy_unpooled_transport>(state, false, true, 1, true);
+}
+
+static void BM_receive_udp_ordering_basp_unpooled(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<ordering<datagram_basp>>,
+                  dummy_unpooled_transport>(state, true, true, 1, true);
+}
+
+static void BM_receive_udp_raw_pooled(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<raw>, dummy_pooled_transport>(
+    state, false, false, 1, true);
+}
+
+static void BM_receive_udp_basp_pooled(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<datagram_basp>,
+                  dummy_pooled_transport>(state, false, true, 1, true);
+}
+
+static void BM_receive_udp_ordering_basp_pooled(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<ordering<datagram_basp>>,
+                  dummy_pooled_transport>(state, true, true, 1, true);
+}
+
+static void BM_receive_udp_raw_fused(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<fused_raw_stack>>(state, false,
+                                                              false);
+}
+
+static void BM_receive_udp_ordering_raw_fused(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<fused_ordering_raw>>(state, true,
+                                                                 false);
+}
+
+static void BM_receive_udp_basp_fused(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<fused_basp_stack>>(state, false,
+                                                                true);
+}
+
+static void BM_receive_udp_ordering_basp_fused(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<fused_ordering_basp>>(state, true,
+                                                                   true);
+}
+
+static void BM_receive_udp_reliable_raw(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<reliability<ordering<raw>>>>(
+    state, true, false, 1, false, true);
+}
+
+static void BM_receive_udp_reliable_raw_fused(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<fused_reliable_raw>>(
+    state, true, false, 1, false, true);
+}
+
+static void BM_receive_udp_ordering_raw_batched_fused(benchmark::State& state) {
+  BM_receive_impl<new_raw_msg, udp_protocol<fused_ordering_raw>>(
+    state, true, false, state.range(1));
+}
+
+static void
+BM_receive_udp_ordering_basp_batched_fused(benchmark::State& state) {
+  BM_receive_impl<new_basp_msg, udp_protocol<fused_ordering_basp>>(
+    state, true, true, state.range(1));
+}
+
 BENCHMARK(BM_receive_udp_raw)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 BENCHMARK(BM_receive_udp_ordering_raw)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 BENCHMARK(BM_receive_udp_basp)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 BENCHMARK(BM_receive_udp_ordering_basp)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 
+BENCHMARK(BM_receive_udp_raw_unpooled)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_basp_unpooled)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_ordering_basp_unpooled)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+
+BENCHMARK(BM_receive_udp_raw_pooled)->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_basp_pooled)->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_ordering_basp_pooled)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+
+BENCHMARK(BM_receive_udp_raw_batched)->Apply(batch_args);
+BENCHMARK(BM_receive_udp_ordering_raw_batched)->Apply(batch_args);
+BENCHMARK(BM_receive_udp_ordering_basp_batched)->Apply(batch_args);
+
+BENCHMARK(BM_receive_udp_raw_fused)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_ordering_raw_fused)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_basp_fused)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_ordering_basp_fused)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_reliable_raw)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_reliable_raw_fused)
+  ->RangeMultiplier(2)->Range(1<<from, 1<<to);
+BENCHMARK(BM_receive_udp_ordering_raw_batched_fused)->Apply(batch_args);
+BENCHMARK(BM_receive_udp_ordering_basp_batched_fused)->Apply(batch_args);
+
 BENCHMARK(BM_receive_tcp_raw)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 BENCHMARK(BM_receive_tcp_basp)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 
+// -- dispatching --------------------------------------------------------------
+
+// Delivers 100 messages per iteration to a newb. If `range(0)` is 0, the
+// benchmark calls the handler inline, as the multiplexer does for messages
+// of the transport. Otherwise, it sends the messages to the newb, which
+// copies the payload into the mailbox and waits for the multiplexer to
+// resume the newb, as for messages of other actors. Reports the cycles and
+// heap allocations per message.
+static void BM_dispatch(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  caf::io::network::native_socket sock(1337);
+  transport_ptr trans{new dummy_transport(64)};
+  actor n = spawn_newb<udp_protocol<raw>, hidden>(sys, dispatch_newb,
+                                                  std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<new_raw_msg, dummy_state>&>(*ptr);
+  auto& mpx = sys.middleman().backend();
+  std::vector<char> payload(64, 'a');
+  auto via_mailbox = state.range(0) != 0;
+  uint64_t total_cycles = 0;
+  count_allocations = true;
+  auto allocs_before = heap_allocations;
+  for (auto _ : state) {
+    for (size_t i = 0; i < 100; ++i) {
+      auto before = ref.state.count;
+      auto start = cycles();
+      if (via_mailbox) {
+        anon_send(n, dispatch_atom::value, payload);
+      } else {
+        new_raw_msg msg;
+        msg.payload = payload.data();
+        msg.payload_len = payload.size();
+        ref.handle(msg);
+      }
+      while (ref.state.count == before)
+        mpx.try_run_once();
+      total_cycles += cycles() - start;
+    }
+  }
+  count_allocations = false;
+  auto allocs = heap_allocations - allocs_before;
+  auto msgs = static_cast<double>(state.iterations() * 100);
+  state.SetLabel(via_mailbox ? "mailbox" : "inline");
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 100));
+  state.counters["cycles_per_msg"] = total_cycles / msgs;
+  state.counters["allocs_per_msg"] = allocs / msgs;
+  ref.stop();
+}
+
+BENCHMARK(BM_dispatch)->Arg(0)->Arg(1);
+
 // -- ordering -----------------------------------------------------------------
 
 enum instruction : int {
@@ -289,22 +1248,47 @@ enum instruction : int {
   recover,
 };
 
+// Reliability layer on top of the stack in the fuzz benchmarks.
+enum class reliability_layer {
+  none,
+  plain,
+  sack,
+};
+
 // For the ordering test
 struct dummy_ordering_transport : public transport {
   dummy_ordering_transport()
     : maximum(std::numeric_limits<uint16_t>::max()),
       writing(false),
       written(0),
-      offline_sum(0),
       index(0),
       next_seq(0) {
     max_consecutive_reads = 1;
+    arena.reserve(offline_buffer, send_buffer);
   }
 
   inline rw_state read_some(newb_base* parent) override {
+    if (model) {
+      read_from_model(parent);
+      // Drop the acknowledgements of reliability layers, nobody listens.
+      while (writing)
+        write_some(parent);
+      return rw_state::success;
+    }
     stream_serializer<charbuf> out{&parent->backend(),
                                    receive_buffer.data(),
                                    sizeof(next_seq)};
+    if (!schedule.empty()) {
+      // Sequence numbers continue with the next round of the schedule.
+      out(static_cast<sequence_type>(next_seq + schedule[index]));
+      index += 1;
+      if (index >= schedule.size()) {
+        index = 0;
+        next_seq += static_cast<sequence_type>(schedule.size());
+      }
+      received_bytes = payload_len + caf::policy::ordering_header_len;
+      return rw_state::success;
+    }
     switch (instructions[index]) {
       case skip:
         //std::cerr << " skip (" << next_seq << ")" << std::endl;
@@ -343,36 +1327,21 @@ struct dummy_ordering_transport : public transport {
   }
 
   inline rw_state write_some(newb_base* parent) override {
-    written += send_sizes.front();
-    send_sizes.pop_front();
-    auto remaining = send_buffer.size() - written;
-    if (remaining == 0)
+    written += arena.size();
+    arena.consume();
+    if (arena.empty())
       prepare_next_write(parent);
     return rw_state::success;
   }
 
   void prepare_next_write(newb_base*) override {
     written = 0;
-    send_buffer.clear();
-    send_sizes.clear();
-    if (offline_buffer.empty()) {
+    if (!arena.swap(offline_buffer, send_buffer))
       writing = false;
-    } else {
-      offline_sizes.push_back(offline_buffer.size() - offline_sum);
-       // Switch buffers.
-      send_buffer.swap(offline_buffer);
-      send_sizes.swap(offline_sizes);
-      // Reset sum.
-      offline_sum = 0;
-    }
   }
 
   byte_buffer& wr_buf() override {
-    if (!offline_buffer.empty()) {
-      auto chunk_size = offline_buffer.size() - offline_sum;
-      offline_sizes.push_back(chunk_size);
-      offline_sum += chunk_size;
-    }
+    arena.mark(offline_buffer);
     return offline_buffer;
   }
 
@@ -389,15 +1358,63 @@ struct dummy_ordering_transport : public transport {
     return invalid_native_socket;
   }
 
+  /// Receives datagrams in the order `params` produces instead of following
+  /// `instructions`. Each datagram starts with the header of `layer`, the
+  /// `ordering_header` and a `basp_header` if `basp` is set. The payload
+  /// starts with the index of the datagram.
+  void use_loss_model(const bench::loss_params& params,
+                      reliability_layer layer, bool basp) {
+    model.reset(new bench::loss_model(params));
+    reliable = layer;
+    with_basp = basp;
+    receive_buffer.resize(maximum);
+    emitted_at.resize(size_t{1} << 16);
+    stamped = 0;
+  }
+
+  void read_from_model(newb_base* parent) {
+    auto idx = model->next();
+    // The sender emitted the datagrams up to `sent` while we waited.
+    auto now = std::chrono::steady_clock::now();
+    for (; stamped < model->sent(); ++stamped)
+      emitted_at[stamped % emitted_at.size()] = now;
+    auto out = receive_buffer.data();
+    if (reliable == reliability_layer::sack) {
+      header_codec<sack_header>::encode(out, sack_header{
+                                               idx, 0, 0,
+                                               sack_header::data_flag});
+      out += sack_header_len;
+    } else if (reliable == reliability_layer::plain) {
+      stream_serializer<charbuf> hdr{&parent->backend(), out,
+                                     reliability_header_len};
+      hdr(reliability_header{static_cast<id_type>(idx), false});
+      out += reliability_header_len;
+    }
+    header_codec<ordering_header>::encode(
+      out, ordering_header{static_cast<sequence_type>(idx)});
+    out += ordering_header_len;
+    if (with_basp) {
+      auto len = static_cast<uint32_t>(payload_len);
+      header_codec<basp_header>::encode(out, basp_header{len, 0, 0});
+      out += basp_header_len;
+    }
+    memcpy(out, &idx, sizeof(idx));
+    received_bytes = static_cast<size_t>(out - receive_buffer.data())
+                     + payload_len;
+  }
+
+  /// Returns when the sender emitted datagram `idx`.
+  std::chrono::steady_clock::time_point emitted(uint32_t idx) const {
+    return emitted_at[idx % emitted_at.size()];
+  }
+
   // State for reading.
   size_t maximum;
 
   // State for writing.
   bool writing;
   size_t written;
-  size_t offline_sum;
-  std::deque<size_t> send_sizes;
-  std::deque<size_t> offline_sizes;
+  write_arena arena;
 
   // Some moocks for receiving packets.
   size_t index;
@@ -405,6 +1422,17 @@ struct dummy_ordering_transport : public transport {
   sequence_type next_seq;
   std::vector<instruction> instructions;
   std::deque<sequence_type> skipped;
+
+  // Replaces `instructions` if not empty, holds the order of one round of
+  // sequence numbers relative to `next_seq`.
+  std::vector<sequence_type> schedule;
+
+  // Replaces both if set, see `use_loss_model`.
+  std::unique_ptr<bench::loss_model> model;
+  reliability_layer reliable = reliability_layer::none;
+  bool with_basp = false;
+  std::vector<std::chrono::steady_clock::time_point> emitted_at;
+  uint64_t stamped = 0;
 };
 
 // Deliver a sequence of message all inorder.
@@ -612,7 +1640,492 @@ static void BM_receive_udp_raw_sequence_late(benchmark::State& state) {
 
 BENCHMARK(BM_receive_udp_raw_sequence_late)->RangeMultiplier(2)->Range(1<<from, 1<<to);
 
+// Returns the order in which `len` messages arrive if every `stride`-th
+// message falls `depth` messages behind.
+static std::vector<sequence_type> gap_schedule(size_t len, size_t stride,
+                                               size_t depth) {
+  std::vector<sequence_type> result;
+  result.reserve(len);
+  // Delayed messages with the position after which they arrive.
+  std::deque<std::pair<size_t, sequence_type>> delayed;
+  for (size_t i = 0; i < len; ++i) {
+    auto seq = static_cast<sequence_type>(i);
+    if (i % stride == stride / 2 && i + depth < len)
+      delayed.emplace_back(i + depth, seq);
+    else
+      result.push_back(seq);
+    while (!delayed.empty() && delayed.front().first <= i) {
+      result.push_back(delayed.front().second);
+      delayed.pop_front();
+    }
+  }
+  for (auto& x : delayed)
+    result.push_back(x.second);
+  return result;
+}
+
+// `reorder` and `sack_reliability` keep a single timeout in flight and
+// remember that they did. Cancelling it behind their back would keep them
+// from ever arming another one, so benchmarks only cancel the timeouts that
+// other stacks pile up during a run.
+template <class Protocol>
+struct tracks_timeout : std::false_type {};
+
+template <class Next>
+struct tracks_timeout<udp_protocol<reorder<Next>>> : std::true_type {};
+
+template <class Next>
+struct tracks_timeout<udp_protocol<sack_reliability<Next>>>
+  : std::true_type {};
+
+// Receives a stream of messages where `range(0)` in 1000 arrive `range(1)`
+// messages late. Both stacks may hold back enough messages to wait for every
+// gap, i.e., they deliver all messages and never skip.
+template <class Protocol>
+static void BM_receive_udp_gaps(benchmark::State& state) {
+  using message_t = new_raw_msg;
+  size_t gaps_per_mille = static_cast<size_t>(state.range(0));
+  size_t depth = static_cast<size_t>(state.range(1));
+  config cfg;
+  cfg.set("middleman.max-pending-messages", 2048);
+  cfg.set("middleman.reorder-capacity", 2048);
+  actor_system sys{cfg};
+  caf::io::network::native_socket sock(1337);
+  auto tptr = new dummy_ordering_transport;
+  transport_ptr trans{tptr};
+  actor n = spawn_newb<Protocol, hidden>(sys, dummy_newb<message_t>,
+                                         std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<message_t, dummy_state>&>(*ptr);
+  size_t packet_size = 1 << from;
+  tptr->payload_len = packet_size;
+  {
+    auto whdl = ref.wr_buf(nullptr);
+    auto start = whdl.buf->size();
+    whdl.buf->resize(start + packet_size);
+    std::fill(whdl.buf->begin() + start, whdl.buf->end(), 'a');
+  }
+  ref.trans->receive_buffer = ref.trans->send_buffer;
+  tptr->schedule = gap_schedule(10000, 1000 / gaps_per_mille, depth);
+  size_t reads = 0;
+  for (auto _ : state) {
+    ref.read_event();
+    // `ordering` arms a timeout for each early message.
+    if (++reads % tptr->schedule.size() == 0
+        && !tracks_timeout<Protocol>::value) {
+      state.PauseTiming();
+      sys.clock().cancel_all();
+      state.ResumeTiming();
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["delivered_share"]
+    = static_cast<double>(ref.state.count) / state.iterations();
+  sys.clock().cancel_all();
+  ref.stop();
+}
+
+static void gap_args(benchmark::internal::Benchmark* b) {
+  for (auto gaps_per_mille : {1, 10, 100})
+    for (auto depth : {4, 32, 256, 1024})
+      b->Args({gaps_per_mille, depth});
+}
+
+BENCHMARK_TEMPLATE(BM_receive_udp_gaps, udp_protocol<ordering<raw>>)
+  ->Apply(gap_args);
+BENCHMARK_TEMPLATE(BM_receive_udp_gaps, udp_protocol<reorder<raw>>)
+  ->Apply(gap_args);
+
+// -- fuzzing ------------------------------------------------------------------
+
+struct fuzz_state {
+  dummy_ordering_transport* trans = nullptr;
+  bench::latency_histogram latency;
+  size_t delivered = 0;
+  // Only used if all messages arrive eventually.
+  bool count_duplicates = false;
+  bench::counter_filter seen;
+  size_t duplicates = 0;
+};
+
+// Records how long each message took from the sender to the application and
+// how many messages the application saw twice.
+template <class Message>
+behavior fuzz_newb(stateful_newb<Message, fuzz_state>* self) {
+  self->set_default_handler(print_and_drop);
+  self->set_timeout_handler([&](timeout_msg&) {
+    // Drop timeouts.
+  });
+  return {
+    [=](const Message& msg) {
+      auto& s = self->state;
+      uint32_t idx;
+      memcpy(&idx, msg.payload, sizeof(idx));
+      if (s.count_duplicates && !s.seen.insert(idx)) {
+        s.duplicates += 1;
+        return;
+      }
+      s.delivered += 1;
+      s.latency.record(std::chrono::steady_clock::now()
+                       - s.trans->emitted(idx));
+    }
+  };
+}
+
+static const char* fuzz_pattern_names[] = {
+  "clean", "random_loss", "bursty_loss", "reordering", "mixed",
+};
+
+// Network conditions for the fuzz benchmarks, all with the same seed.
+static bench::loss_params fuzz_pattern(int64_t pattern) {
+  bench::loss_params params;
+  params.seed = 42;
+  switch (pattern) {
+    case 1:
+      params.loss = 0.01;
+      break;
+    case 2:
+      // Bursts of four datagrams on average, about 1% loss overall.
+      params.model = bench::loss_params::gilbert_elliott;
+      params.good_to_bad = 0.005;
+      params.bad_to_good = 0.25;
+      params.loss = 0.5;
+      break;
+    case 3:
+      params.reorder = 0.05;
+      params.reorder_mean = 3;
+      break;
+    case 4:
+      params.loss = 0.01;
+      params.reorder = 0.02;
+      params.duplicate = 0.01;
+      break;
+    default:
+      break;
+  }
+  return params;
+}
+
+// Receives datagrams in the order the network pattern `range(0)` delivers
+// them. With a reliability layer on top of the stack, the sender retransmits
+// lost datagrams after eight more, within the window of `sack_reliability`,
+// and the ordering layers may hold back every message the window lets
+// through. `sack_reliability` suppresses duplicates unless `range(1)` is 0.
+// Timeouts do not fire, so the ordering layers only skip gaps once too many
+// messages wait. Reports the share of sent messages that reached the
+// application, their latency and, for `sack_reliability<raw>`, how many
+// duplicates the application saw. Stacks with an ordering layer may skip
+// gaps and drop late duplicates before they reach the application, which
+// would leave the duplicate filter waiting for messages that never come.
+template <class Message, class Protocol, reliability_layer Reliability>
+static void BM_receive_fuzz(benchmark::State& state) {
+  constexpr bool reliable = Reliability != reliability_layer::none;
+  constexpr bool count_duplicates
+    = std::is_same<Protocol, udp_protocol<sack_reliability<raw>>>::value;
+  auto params = fuzz_pattern(state.range(0));
+  config cfg;
+  if (reliable) {
+    params.retransmit_after = 8;
+    params.window = sack_reliability<raw>::window;
+    cfg.set("middleman.max-pending-messages",
+            static_cast<int>(params.retransmit_after + params.window + 1));
+  }
+  if (Reliability == reliability_layer::sack)
+    cfg.set("middleman.sack-suppress-duplicates", state.range(1) != 0);
+  actor_system sys{cfg};
+  caf::io::network::native_socket sock(1337);
+  auto tptr = new dummy_ordering_transport;
+  transport_ptr trans{tptr};
+  actor n = spawn_newb<Protocol, hidden>(sys, fuzz_newb<Message>,
+                                         std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<Message, fuzz_state>&>(*ptr);
+  tptr->payload_len = 1 << from;
+  tptr->use_loss_model(params, Reliability,
+                       std::is_same<Message, new_basp_msg>::value);
+  ref.state.trans = tptr;
+  ref.state.count_duplicates = count_duplicates;
+  size_t reads = 0;
+  for (auto _ : state) {
+    ref.read_event();
+    if (++reads % 4096 == 0 && !tracks_timeout<Protocol>::value) {
+      state.PauseTiming();
+      sys.clock().cancel_all();
+      state.ResumeTiming();
+    }
+  }
+  auto& s = ref.state;
+  auto& model = *tptr->model;
+  state.SetLabel(fuzz_pattern_names[state.range(0)]);
+  state.SetItemsProcessed(static_cast<int64_t>(s.delivered));
+  state.counters["delivered_share"]
+    = static_cast<double>(s.delivered) / model.sent();
+  state.counters["p50_us"] = s.latency.percentile(50) / 1000.0;
+  state.counters["p99_us"] = s.latency.percentile(99) / 1000.0;
+  state.counters["lost"] = static_cast<double>(model.lost());
+  state.counters["duplicated"] = static_cast<double>(model.duplicated());
+  if (count_duplicates)
+    state.counters["app_duplicates"] = static_cast<double>(s.duplicates);
+  sys.clock().cancel_all();
+  ref.stop();
+}
+
+static void fuzz_args(benchmark::internal::Benchmark* b) {
+  for (int pattern = 0; pattern < 5; ++pattern)
+    b->Arg(pattern);
+}
+
+static void fuzz_reliable_args(benchmark::internal::Benchmark* b) {
+  for (int pattern = 0; pattern < 5; ++pattern)
+    for (int suppress = 0; suppress < 2; ++suppress)
+      b->Args({pattern, suppress});
+}
+
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_raw_msg, udp_protocol<ordering<raw>>,
+                   reliability_layer::none)
+  ->Apply(fuzz_args);
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_basp_msg,
+                   udp_protocol<ordering<datagram_basp>>,
+                   reliability_layer::none)
+  ->Apply(fuzz_args);
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_raw_msg, udp_protocol<reorder<raw>>,
+                   reliability_layer::none)
+  ->Apply(fuzz_args);
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_raw_msg,
+                   udp_protocol<reliability<ordering<raw>>>,
+                   reliability_layer::plain)
+  ->Apply(fuzz_args);
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_raw_msg,
+                   udp_protocol<sack_reliability<raw>>,
+                   reliability_layer::sack)
+  ->Apply(fuzz_reliable_args);
+BENCHMARK_TEMPLATE(BM_receive_fuzz, new_raw_msg,
+                   udp_protocol<sack_reliability<ordering<raw>>>,
+                   reliability_layer::sack)
+  ->Apply(fuzz_reliable_args);
+
+
+// -- headers ------------------------------------------------------------------
+
+// Header values that use all bytes, so no encoder gets away with zeros.
+void sample(basp_header& hdr) {
+  hdr = basp_header{0x01020304, 0x1122334455667788, 0x8877665544332211};
+}
+
+void sample(ordering_header& hdr) {
+  hdr.seq_num = 0x0102;
+}
+
+void sample(sack_header& hdr) {
+  hdr = sack_header{0x01020304, 0x05060708, 0xF0F0F0F0,
+                    sack_header::data_flag};
+}
+
+// Encodes headers with CAF's serializers, the way the layers do.
+template <class Header>
+struct serializer_codec {
+  actor_system& sys;
+
+  void append(byte_buffer& buf, Header& hdr) {
+    binary_serializer bs(sys, buf);
+    bs(hdr);
+  }
+
+  void decode(const byte_buffer& buf, Header& hdr) {
+    binary_deserializer bd(sys, buf.data(), buf.size());
+    bd(hdr);
+  }
+};
+
+// Encodes headers with `header_codec`.
+template <class Header>
+struct fixed_codec {
+  actor_system& sys;
+
+  void append(byte_buffer& buf, Header& hdr) {
+    append_header(buf, hdr);
+  }
+
+  void decode(const byte_buffer& buf, Header& hdr) {
+    header_codec<Header>::decode(buf.data(), hdr);
+  }
+};
+
+// Both codecs must produce the same bytes, otherwise comparing them is moot.
+template <class Header>
+void check_codecs(actor_system& sys) {
+  Header hdr;
+  sample(hdr);
+  byte_buffer serialized;
+  serializer_codec<Header>{sys}.append(serialized, hdr);
+  byte_buffer encoded;
+  fixed_codec<Header>{sys}.append(encoded, hdr);
+  if (serialized != encoded || encoded.size() != header_codec<Header>::size) {
+    std::cerr << "header_codec differs from binary_serializer" << std::endl;
+    std::abort();
+  }
+}
+
+// Appends a header to an empty buffer. `stream_basp` and `datagram_basp`
+// share `basp_header`, `ordering<Next>` writes an `ordering_header`.
+template <template <class> class Codec, class Header>
+static void BM_header_encode(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  check_codecs<Header>(sys);
+  Codec<Header> codec{sys};
+  Header hdr;
+  sample(hdr);
+  byte_buffer buf;
+  buf.reserve(64);
+  for (auto _ : state) {
+    buf.clear();
+    codec.append(buf, hdr);
+    benchmark::DoNotOptimize(buf.data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+// Reads a header from a received buffer.
+template <template <class> class Codec, class Header>
+static void BM_header_decode(benchmark::State& state) {
+  config cfg;
+  actor_system sys{cfg};
+  check_codecs<Header>(sys);
+  Codec<Header> codec{sys};
+  Header hdr;
+  sample(hdr);
+  byte_buffer buf;
+  codec.append(buf, hdr);
+  Header result;
+  for (auto _ : state) {
+    codec.decode(buf, result);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+BENCHMARK_TEMPLATE(BM_header_encode, serializer_codec, basp_header);
+BENCHMARK_TEMPLATE(BM_header_encode, fixed_codec, basp_header);
+BENCHMARK_TEMPLATE(BM_header_encode, serializer_codec, ordering_header);
+BENCHMARK_TEMPLATE(BM_header_encode, fixed_codec, ordering_header);
+BENCHMARK_TEMPLATE(BM_header_encode, serializer_codec, sack_header);
+BENCHMARK_TEMPLATE(BM_header_encode, fixed_codec, sack_header);
+
+BENCHMARK_TEMPLATE(BM_header_decode, serializer_codec, basp_header);
+BENCHMARK_TEMPLATE(BM_header_decode, fixed_codec, basp_header);
+BENCHMARK_TEMPLATE(BM_header_decode, serializer_codec, ordering_header);
+BENCHMARK_TEMPLATE(BM_header_decode, fixed_codec, ordering_header);
+BENCHMARK_TEMPLATE(BM_header_decode, serializer_codec, sack_header);
+BENCHMARK_TEMPLATE(BM_header_decode, fixed_codec, sack_header);
+
+// -- timers -------------------------------------------------------------------
+
+// Arms `n` timeouts as delayed messages, the way `ordering<Next>` does, and
+// drops them again with `cancel_all`.
+static void BM_timeout_mailbox(benchmark::State& state) {
+  using message_t = new_raw_msg;
+  using proto_t = udp_protocol<raw>;
+  config cfg;
+  actor_system sys{cfg};
+  auto tptr = new dummy_transport(0);
+  caf::io::network::native_socket sock(1337);
+  transport_ptr trans{tptr};
+  actor n = spawn_newb<proto_t, hidden>(sys, dummy_newb<message_t>,
+                                        std::move(trans), sock);
+  auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
+  auto& ref = dynamic_cast<stateful_newb<message_t, dummy_state>&>(*ptr);
+  auto timers = static_cast<uint32_t>(state.range(0));
+  uint64_t total_cycles = 0;
+  for (auto _ : state) {
+    auto start = cycles();
+    for (uint32_t i = 0; i < timers; ++i)
+      ref.set_timeout(std::chrono::milliseconds(100), ordering_atom::value, i);
+    sys.clock().cancel_all();
+    total_cycles += cycles() - start;
+  }
+  auto ops = static_cast<double>(state.iterations()) * timers;
+  state.counters["arms"] = ops;
+  state.counters["cancels"] = ops;
+  state.counters["cycles_per_op"] = total_cycles / (2 * ops);
+  state.SetItemsProcessed(static_cast<int64_t>(ops));
+  ref.stop();
+}
+
+// Arms and cancels `n` timers on a wheel.
+static void BM_timeout_wheel(benchmark::State& state) {
+  timer_wheel wheel;
+  std::vector<timer_wheel::handle> handles(state.range(0));
+  uint64_t total_cycles = 0;
+  for (auto _ : state) {
+    auto start = cycles();
+    auto deadline = timer_wheel::clock_type::now()
+                    + std::chrono::milliseconds(100);
+    for (size_t i = 0; i < handles.size(); ++i)
+      handles[i] = wheel.arm(deadline, i);
+    for (auto hdl : handles)
+      wheel.cancel(hdl);
+    total_cycles += cycles() - start;
+  }
+  auto ops = static_cast<double>(wheel.arms() + wheel.cancels());
+  state.counters["arms"] = wheel.arms();
+  state.counters["cancels"] = wheel.cancels();
+  state.counters["cycles_per_op"] = total_cycles / ops;
+  state.SetItemsProcessed(static_cast<int64_t>(wheel.arms()));
+}
+
+// Restarts a single retransmission timer `n` times, i.e., what
+// `sack_reliability` does for every acknowledgement.
+static void BM_timeout_wheel_restart(benchmark::State& state) {
+  timer_wheel wheel;
+  timer_wheel::handle hdl = 0;
+  auto restarts = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    auto now = timer_wheel::clock_type::now();
+    for (size_t i = 0; i < restarts; ++i) {
+      wheel.cancel(hdl);
+      hdl = wheel.arm(now + std::chrono::milliseconds(40), 0);
+    }
+  }
+  state.counters["arms"] = wheel.arms();
+  state.counters["cancels"] = wheel.cancels();
+  state.SetItemsProcessed(static_cast<int64_t>(wheel.arms()));
+}
+
+// Arms `n` timers spread over one second and expires them in one batch.
+static void BM_timeout_wheel_expire(benchmark::State& state) {
+  auto timers = static_cast<size_t>(state.range(0));
+  size_t expired = 0;
+  for (auto _ : state) {
+    auto start = timer_wheel::clock_type::now();
+    timer_wheel wheel{std::chrono::milliseconds(1), start};
+    for (size_t i = 0; i < timers; ++i)
+      wheel.arm(start + std::chrono::milliseconds(i % 1000), i);
+    wheel.advance(start + std::chrono::seconds(1),
+                  [&](uint64_t) { expired += 1; });
+  }
+  if (expired != timers * static_cast<size_t>(state.iterations())) {
+    std::cerr << "timers did not expire" << std::endl;
+    std::abort();
+  }
+  state.counters["expirations"] = expired;
+  state.SetItemsProcessed(static_cast<int64_t>(expired));
+}
+
+BENCHMARK(BM_timeout_mailbox)->RangeMultiplier(8)->Range(1, 1<<12);
+BENCHMARK(BM_timeout_wheel)->RangeMultiplier(8)->Range(1, 1<<12);
+BENCHMARK(BM_timeout_wheel_restart)->RangeMultiplier(8)->Range(1, 1<<12);
+BENCHMARK(BM_timeout_wheel_expire)->RangeMultiplier(8)->Range(1, 1<<12);
 
 } // namespace anonymous
 
-BENCHMARK_MAIN();
+// Same as BENCHMARK_MAIN, but records the multiplexer in the context of the
+// report to tell the results of layers and layers-poll apart.
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::AddCustomContext("multiplexer", bench::multiplexer_backend());
+  benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,229 @@
+#ifndef LOSS_MODEL_HPP
+#define LOSS_MODEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace bench {
+
+/// Parameters of a synthetic network path for `loss_model`.
+struct loss_params {
+  enum model_type {
+    /// Every datagram is lost with probability `loss`.
+    bernoulli,
+    /// Two-state Markov chain: the path switches from good to bad with
+    /// probability `good_to_bad` and back with `bad_to_good` per datagram.
+    /// Datagrams are lost with `good_loss` in the good state and `loss` in
+    /// the bad state, which produces bursts of losses.
+    gilbert_elliott
+  };
+
+  model_type model = bernoulli;
+  double loss = 0.0;
+  double good_loss = 0.0;
+  double good_to_bad = 0.0;
+  double bad_to_good = 1.0;
+
+  /// Probability that a datagram is overtaken by later ones. The number of
+  /// datagrams that overtake it is geometric with mean `reorder_mean`,
+  /// capped at `reorder_max`.
+  double reorder = 0.0;
+  double reorder_mean = 2.0;
+  uint32_t reorder_max = 16;
+
+  /// Probability that a datagram arrives twice.
+  double duplicate = 0.0;
+
+  /// The sender transmits lost datagrams again after this many datagrams,
+  /// like after a retransmission timeout. Zero disables retransmissions.
+  uint32_t retransmit_after = 0;
+
+  /// With retransmissions, the sender emits a new datagram only if fewer
+  /// than `window` datagrams since the oldest one that did not arrive yet
+  /// are out, like a sender limited by the receive window. Zero disables
+  /// the limit.
+  uint32_t window = 0;
+
+  uint64_t seed = 1;
+};
+
+/// Turns the datagrams a sender emits into the sequence a receiver sees. The
+/// sender emits one new datagram per slot, numbered from 0, unless its
+/// window is full. Each transmission may be lost, delayed by a few slots or
+/// duplicated as configured in `loss_params`. The same seed always produces
+/// the same sequence.
+class loss_model {
+public:
+  explicit loss_model(const loss_params& params)
+    : params_(params),
+      rng_(params.seed),
+      uniform_(0.0, 1.0),
+      distance_(1.0 / std::max(params.reorder_mean, 1.0)),
+      bad_(false),
+      slot_(0),
+      order_(0),
+      next_index_(0),
+      oldest_(0),
+      lost_(0),
+      reordered_(0),
+      duplicated_(0),
+      retransmitted_(0) {
+    // nop
+  }
+
+  /// Returns the index of the next datagram that arrives at the receiver.
+  /// Never returns if all datagrams get lost.
+  uint32_t next() {
+    while (arrivals_.empty() || arrivals_.top().slot > slot_) {
+      slot_ += 1;
+      transmit(slot_);
+    }
+    auto result = arrivals_.top().index;
+    arrivals_.pop();
+    if (limited())
+      arrived(result);
+    return result;
+  }
+
+  /// Returns how many distinct datagrams the sender emitted so far.
+  uint64_t sent() const {
+    return next_index_;
+  }
+
+  uint64_t lost() const {
+    return lost_;
+  }
+
+  uint64_t reordered() const {
+    return reordered_;
+  }
+
+  uint64_t duplicated() const {
+    return duplicated_;
+  }
+
+  uint64_t retransmitted() const {
+    return retransmitted_;
+  }
+
+  /// Prints the counters as `key=value` pairs on a single line.
+  void print(std::ostream& out) const {
+    out << "loss_model sent=" << sent()
+        << " lost=" << lost_
+        << " reordered=" << reordered_
+        << " duplicated=" << duplicated_
+        << " retransmitted=" << retransmitted_ << std::endl;
+  }
+
+private:
+  struct arrival {
+    uint64_t slot;
+    uint64_t order;
+    uint32_t index;
+  };
+
+  // Orders arrivals by slot and, within a slot, by transmission.
+  struct later {
+    bool operator()(const arrival& x, const arrival& y) const {
+      return x.slot != y.slot ? x.slot > y.slot : x.order > y.order;
+    }
+  };
+
+  bool chance(double p) {
+    return p > 0.0 && uniform_(rng_) < p;
+  }
+
+  bool drop() {
+    if (params_.model == loss_params::bernoulli)
+      return chance(params_.loss);
+    bad_ = bad_ ? !chance(params_.bad_to_good) : chance(params_.good_to_bad);
+    return chance(bad_ ? params_.loss : params_.good_loss);
+  }
+
+  bool limited() const {
+    return params_.window > 0 && params_.retransmit_after > 0;
+  }
+
+  /// Sends the retransmissions due in `slot` and a new datagram if the
+  /// window allows.
+  void transmit(uint64_t slot) {
+    while (!resends_.empty() && resends_.top().slot <= slot) {
+      auto resend = resends_.top().index;
+      resends_.pop();
+      retransmitted_ += 1;
+      deliver(resend, slot);
+    }
+    if (limited()) {
+      if (outstanding_.size() >= params_.window)
+        return;
+      outstanding_.push_back(false);
+    }
+    deliver(static_cast<uint32_t>(next_index_++), slot);
+  }
+
+  /// Slides the window past all datagrams that arrived.
+  void arrived(uint32_t index) {
+    auto pos = static_cast<uint64_t>(index) - oldest_;
+    if (index < oldest_ || pos >= outstanding_.size())
+      return;
+    outstanding_[pos] = true;
+    while (!outstanding_.empty() && outstanding_.front()) {
+      outstanding_.pop_front();
+      oldest_ += 1;
+    }
+  }
+
+  void deliver(uint32_t index, uint64_t slot) {
+    if (drop()) {
+      lost_ += 1;
+      if (params_.retransmit_after > 0)
+        resends_.push(arrival{slot + params_.retransmit_after, order_++,
+                              index});
+      return;
+    }
+    auto at = slot;
+    if (chance(params_.reorder)) {
+      reordered_ += 1;
+      auto dist = static_cast<uint32_t>(distance_(rng_)) + 1;
+      at += dist < params_.reorder_max ? dist : params_.reorder_max;
+    }
+    arrivals_.push(arrival{at, order_++, index});
+    if (chance(params_.duplicate)) {
+      duplicated_ += 1;
+      arrivals_.push(arrival{at + 1, order_++, index});
+    }
+  }
+
+  loss_params params_;
+  std::mt19937_64 rng_;
+  std::uniform_real_distribution<double> uniform_;
+  std::geometric_distribution<uint32_t> distance_;
+  bool bad_;
+  uint64_t slot_;
+  uint64_t order_;
+  uint64_t next_index_;
+
+  // Arrival flags of the datagrams from `oldest_` on, if the window limits
+  // the sender.
+  uint64_t oldest_;
+  std::deque<bool> outstanding_;
+
+  std::priority_queue<arrival, std::vector<arrival>, later> arrivals_;
+  std::priority_queue<arrival, std::vector<arrival>, later> resends_;
+
+  // Statistics.
+  uint64_t lost_;
+  uint64_t reordered_;
+  uint64_t duplicated_;
+  uint64_t retransmitted_;
+};
+
+} // namespace bench
+
+#endif // LOSS_MODEL_HPP
@@ -0,0 +1,50 @@
+#ifndef MULTIPLEXER_BACKEND_HPP
+#define MULTIPLEXER_BACKEND_HPP
+
+#include <iostream>
+#include <string>
+
+#include "caf/io/network/default_multiplexer.hpp"
+
+namespace bench {
+
+/// Returns the name of the multiplexer CAF was compiled with. CAF picks its
+/// backend at compile time, `CAF_POLL_IMPL` selects `poll()` on Linux. The
+/// build creates a `-poll` variant of each binary for this purpose.
+inline const char* multiplexer_backend() {
+#if defined(CAF_EPOLL_MULTIPLEXER)
+  return "epoll";
+#elif defined(CAF_POLL_MULTIPLEXER)
+  return "poll";
+#else
+  return "unknown";
+#endif
+}
+
+/// Checks the `--multiplexer` option against the compiled backend and prints
+/// the backend in use. An empty `requested` accepts any backend.
+inline bool check_multiplexer(const std::string& requested,
+                              const char* binary) {
+  std::string backend = multiplexer_backend();
+  if (requested.empty() || requested == backend) {
+    std::cerr << "multiplexer=" << backend << std::endl;
+    return true;
+  }
+  if (requested == "io_uring") {
+    std::cerr << "io_uring is not available as CAF multiplexer" << std::endl;
+  } else if (requested == "poll") {
+    std::cerr << binary << " uses " << backend << ", run " << binary
+              << "-poll instead" << std::endl;
+  } else if (requested == "epoll") {
+    std::cerr << binary << " uses " << backend
+              << ", run the binary without the -poll suffix" << std::endl;
+  } else {
+    std::cerr << "unknown multiplexer: " << requested
+              << " (expected epoll or poll)" << std::endl;
+  }
+  return false;
+}
+
+} // namespace bench
+
+#endif // MULTIPLEXER_BACKEND_HPP
@@ -7,244 +7,255 @@
 #include "caf/policy/newb_basp.hpp"
 #include "caf/policy/newb_tcp.hpp"
 
-using namespace caf;
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "stream_stats.hpp"
+#include "write_arena.hpp"
 
-/*
-using caf::io::network::default_multiplexer;
-using caf::io::network::invalid_native_socket;
-using caf::io::network::make_client_newb;
-using caf::io::network::make_server_newb;
-using caf::io::network::native_socket;
-using caf::policy::accept_tcp;
-using caf::policy::tcp_protocol;
-using caf::policy::tcp_transport;
-*/
+using namespace caf;
+using namespace caf::io;
+using namespace caf::io::network;
+using namespace caf::policy;
 
 namespace {
 
-/*
-using interval_atom = atom_constant<atom("interval")>;
-using ordering_atom = atom_constant<atom("ordering")>;
+using start_atom = atom_constant<atom("start")>;
 using send_atom = atom_constant<atom("send")>;
+using report_atom = atom_constant<atom("report")>;
+using tick_atom = atom_constant<atom("tick")>;
 using quit_atom = atom_constant<atom("quit")>;
-using responder_atom = atom_constant<atom("responder")>;
-
-constexpr size_t chunk_size = 1024; //128; //8192; //1024;
-
-struct basp_newb : public io::network::newb<policy::new_basp_msg> {
-  using message_type = policy::new_basp_msg;
-
-  basp_newb(caf::actor_config& cfg, default_multiplexer& dm,
-            native_socket sockfd)
-      : newb<message_type>(cfg, dm, sockfd),
-        running(true),
-        interval_counter(0),
-        received_messages(0),
-        interval(5000) {
-    // nop
-    CAF_LOG_TRACE("");
-  }
 
-  behavior make_behavior() override {
-    set_default_handler(print_and_drop);
-    return {
-      [=](message_type& msg) {
-        CAF_LOG_TRACE("");
-        if (msg.payload_len == 1) {
-          // nop
-        } else {
-          received_messages += 1;
-          if (received_messages % 1000 == 0)
-            std::cout << "received " << received_messages << " messages" << std::endl;
-          // nop
-        }
-      },
-      [=](send_atom, char c) {
-        if (running) {
-          delayed_send(this, interval, send_atom::value, char((c + 1) % 256));
-          auto hw = caf::make_callback([&](io::network::byte_buffer& buf) -> error {
-            binary_serializer bs(&backend(), buf);
-            bs(policy::basp_header{0, id(), actor_id{}});
-            return none;
-          });
-          auto whdl = wr_buf(&hw);
-          CAF_ASSERT(whdl.buf != nullptr);
-          CAF_ASSERT(whdl.protocol != nullptr);
-          binary_serializer bs(&backend(), *whdl.buf);
-          auto start = whdl.buf->size();
-          whdl.buf->resize(start + chunk_size);
-          std::fill(whdl.buf->begin() + start, whdl.buf->end(), c);
-        }
-      },
-      [=](responder_atom, actor r) {
-        std::cout << "got responder assigned" << std::endl;
-        responder = r;
-        send(r, this);
-      },
-      [=](interval_atom) {
-        // TODO: Reimplement this with other count method.
-        //if (running) {
-          //delayed_send(this, std::chrono::seconds(1), interval_atom::value);
-          //interval_counter += 1;
-          //data.emplace_back(interval,
-                            //transport->count,
-                            //transport->offline_buffer.size());
-          //if (interval_counter % 10 == 0) {
-            //auto cnt = interval.count();
-            //auto dec = cnt > 1000 ? 1000 : (cnt > 100 ? 100 : 10);
-            //interval -= std::chrono::microseconds(dec);
-          //}
-          //transport->count = 0;
-          //if (interval.count() <= 0)
-            //running = false;
-        //} else {
-          //std::map<size_t, std::vector<size_t>> aggregate;
-          //for (auto& t : data) {
-            //auto expected = (1000000 / get<0>(t).count());
-            //aggregate[expected].push_back(get<1>(t));
-            //std::cerr << expected << ", " << get<1>(t) << ", " << get<2>(t) << std::endl;
-          //}
-          //for (auto& p : aggregate) {
-            //std::cerr << p.first;
-            //for (auto v : p.second)
-              //std::cerr << ", " << v;
-            //std::cerr << std::endl;
-          //}
-          //send(this, quit_atom::value);
-        //}
-      },
-      [=](quit_atom) {
-        std::cout << "got quit message" << std::endl;
-        // Remove from multiplexer loop.
-        stop();
-        // Quit actor.
-        quit();
-        send(responder, quit_atom::value);
-      }
-    };
-  }
+using clock_type = std::chrono::steady_clock;
 
-  bool running;
-  actor responder;
-  uint32_t interval_counter;
-  uint32_t received_messages;
-  std::chrono::microseconds interval;
-  // values: measurement point, current interval, messages sent in interval, offline buffer size
-  std::vector<std::tuple<std::chrono::microseconds, size_t, size_t>> data;
-};
+using proto_t = tcp_protocol<stream_basp>;
 
-template <class ProtocolPolicy>
-struct tcp_acceptor
-    : public io::network::newb_acceptor<typename ProtocolPolicy::message_type> {
-  using super = io::network::newb_acceptor<typename ProtocolPolicy::message_type>;
+constexpr size_t max_chunk_size = 1 << 20;
 
-  tcp_acceptor(default_multiplexer& dm, native_socket sockfd)
-      : super(dm, sockfd) {
-    // nop
-  }
+// -- server -------------------------------------------------------------------
 
-  expected<actor> create_newb(native_socket sockfd,
-                              io::network::transport_policy_ptr pol) override {
-    CAF_LOG_TRACE(CAF_ARG(sockfd));
-    std::cout << "creating newb" << std::endl;
-    auto n = io::network::make_newb<basp_newb>(this->backend().system(), sockfd);
-    auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
-    if (ptr == nullptr)
-      return sec::runtime_error;
-    auto& ref = dynamic_cast<basp_newb&>(*ptr);
-    ref.transport = std::move(pol);
-    ref.protocol.reset(new ProtocolPolicy(&ref));
-    ref.responder = responder;
-    ref.configure_read(io::receive_policy::exactly(policy::basp_header_len));
-    anon_send(responder, n);
-    return n;
-  }
+// The server counts BASP messages and their payload and reports the totals
+// every 10 ms.
+struct server_state {
+  bool started = false;
+  uint64_t received = 0;
+  uint64_t received_bytes = 0;
+  uint64_t ticks = 0;
+  uint64_t second_received = 0;
+  uint64_t second_bytes = 0;
+};
 
+behavior basp_server(stateful_newb<new_basp_msg, server_state>* self) {
+  presize_buffers(*self->trans);
+  self->configure_read(io::receive_policy::exactly(basp_header_len));
+  return {
+    [=](new_basp_msg& msg) {
+      auto& s = self->state;
+      if (!s.started) {
+        s.started = true;
+        self->delayed_send(self, std::chrono::milliseconds(10),
+                           tick_atom::value);
+      }
+      s.received += 1;
+      s.received_bytes += msg.payload_len;
+      s.second_received += 1;
+      s.second_bytes += msg.payload_len;
+    },
+    [=](tick_atom) {
+      auto& s = self->state;
+      self->delayed_send(self, std::chrono::milliseconds(10),
+                         tick_atom::value);
+      {
+        auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+          binary_serializer bs(&self->backend(), buf);
+          bs(basp_header{0, self->id(), actor_id{}});
+          return none;
+        });
+        auto whdl = self->wr_buf(&hw);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.received, s.received_bytes);
+      }
+      if (++s.ticks % 100 == 0) {
+        std::cout << "server received_per_s=" << s.second_received
+                  << " goodput_mbps=" << s.second_bytes * 8 / 1e6
+                  << " received=" << s.received << std::endl;
+        s.second_received = 0;
+        s.second_bytes = 0;
+      }
+    },
+    [=](io_error_msg&) {
+      std::cout << "server done received=" << self->state.received
+                << std::endl;
+      self->stop();
+      self->quit();
+    }
+  };
+}
+
+// -- client -------------------------------------------------------------------
+
+// Writes BASP messages with `chunk_size` bytes of payload as long as less
+// than `max_backlog` bytes wait in the transport. Each `start_atom` begins a
+// new run, `send_atom`s of earlier runs are ignored.
+struct client_state {
   actor responder;
+  bench::stream_stats stats;
+  size_t chunk_size = 0;
+  size_t max_backlog = 0;
+  uint32_t run = 0;
+  clock_type::time_point end;
+  bool running = false;
+  // Totals of the last report.
+  uint64_t received = 0;
+  uint64_t received_bytes = 0;
 };
-*/
+
+behavior basp_client(stateful_newb<new_basp_msg, client_state>* self) {
+  presize_buffers(*self->trans);
+  self->configure_read(io::receive_policy::exactly(basp_header_len));
+  return {
+    [=](start_atom, size_t chunk_size, size_t seconds, size_t max_backlog,
+        actor responder) {
+      auto& s = self->state;
+      s.responder = responder;
+      s.chunk_size = chunk_size;
+      s.max_backlog = max_backlog;
+      auto now = clock_type::now();
+      s.stats.start(now);
+      s.end = now + std::chrono::seconds(seconds);
+      s.running = true;
+      s.run += 1;
+      self->send(self, send_atom::value, s.run);
+      self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+    },
+    [=](send_atom, uint32_t run) {
+      auto& s = self->state;
+      if (!s.running || run != s.run)
+        return;
+      auto& backlog = self->trans->offline_buffer;
+      auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+        binary_serializer bs(&self->backend(), buf);
+        bs(basp_header{0, self->id(), actor_id{}});
+        return none;
+      });
+      while (backlog.size() < s.max_backlog) {
+        auto whdl = self->wr_buf(&hw);
+        whdl.buf->resize(whdl.buf->size() + s.chunk_size, 'a');
+        s.stats.on_sent(s.chunk_size);
+      }
+      s.stats.sample_backlog(backlog.size());
+      self->delayed_send(self, std::chrono::microseconds(50),
+                         send_atom::value, run);
+    },
+    [=](new_basp_msg& msg) {
+      auto& s = self->state;
+      uint64_t received;
+      uint64_t received_bytes;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(received, received_bytes);
+      if (received < s.received)
+        return;
+      s.stats.on_delivered(received - s.received,
+                           received_bytes - s.received_bytes);
+      s.received = received;
+      s.received_bytes = received_bytes;
+    },
+    [=](report_atom) {
+      auto& s = self->state;
+      auto now = clock_type::now();
+      s.stats.print(std::cout, now);
+      std::cout << std::endl;
+      if (now < s.end) {
+        self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+        return;
+      }
+      s.running = false;
+      s.stats.summary(std::cout, s.chunk_size);
+      self->send(s.responder, quit_atom::value);
+    },
+    [=](quit_atom) {
+      self->stop();
+      self->quit();
+    },
+    [=](io_error_msg& msg) {
+      std::cerr << "client got io error: " << to_string(msg.op) << std::endl;
+      self->send(self->state.responder, quit_atom::value);
+    }
+  };
+}
+
+// -- main ---------------------------------------------------------------------
 
 class config : public actor_system_config {
 public:
   uint16_t port = 12345;
   std::string host = "127.0.0.1";
   bool is_server = false;
+  size_t chunk_size = 8192;
+  bool sweep = false;
+  bool large_sweep = false;
+  size_t duration = 10;
+  size_t max_backlog = 256;
 
   config() {
     opt_group{custom_options_, "global"}
     .add(port, "port,P", "set port")
     .add(host, "host,H", "set host")
-    .add(is_server, "server,s", "set server");
+    .add(is_server, "server,s", "set server")
+    .add(chunk_size, "chunk-size,c", "set payload bytes per message (client)")
+    .add(sweep, "sweep", "run with 128 B to 64 KiB per message (client)")
+    .add(large_sweep, "large-sweep", "run with 8 KiB to 1 MiB per message")
+    .add(duration, "duration,d", "set seconds to stream (client)")
+    .add(max_backlog, "max-backlog,b", "set KiB the transport may hold");
   }
 };
 
-void caf_main(actor_system& sys, const config& cfg) {
-  /*
-  using acceptor_t = tcp_acceptor<tcp_protocol<policy::stream_basp>>;
-  const char* host = cfg.host.c_str();
-  const uint16_t port = cfg.port;
+void run_server(actor_system& sys, const config& cfg) {
   scoped_actor self{sys};
+  accept_ptr<new_basp_msg> pol{new accept_tcp<new_basp_msg>};
+  auto eserver = make_server<proto_t>(sys, basp_server, std::move(pol),
+                                      cfg.port, nullptr, true);
+  if (!eserver) {
+    std::cerr << "failed to start server on port " << cfg.port << std::endl;
+    return;
+  }
+  auto server = std::move(*eserver);
+  self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
+  server->stop();
+}
 
-  auto running = [=](event_based_actor* self, std::string,
-                     actor m, actor) -> behavior {
-    return {
-      [=](quit_atom) {
-        self->send(m, quit_atom::value);
-      }
-    };
-  };
-  auto init = [=](event_based_actor* self, std::string name,
-                  actor m) -> behavior {
-    self->set_default_handler(skip);
-    return {
-      [=](actor b) {
-        std::cout << "[" << name << "] got broker, let's do this" << std::endl;
-        self->become(running(self, name, m, b));
-        self->set_default_handler(print_and_drop);
-      }
-    };
-  };
-
-  auto dummy_broker = [](io::broker*) -> behavior {
-    return {
-      [](io::new_connection_msg&) {
-        std::cout << "got new connection" << std::endl;
-      }
-    };
-  };
-
-  auto name = cfg.is_server ? "server" : "client";
-  auto helper = sys.spawn(init, name, self);
-
-  actor nb;
-  auto await_done = [&]() {
-    self->receive(
-      [&](quit_atom) {
-        std::cout << "done" << std::endl;
-      }
-    );
-  };
-  if (cfg.is_server) {
-    std::cout << "creating new server" << std::endl;
-    auto server_ptr = make_server_newb<acceptor_t, accept_tcp>(sys, port, nullptr,
-                                                               true);
-    //server_ptr->responder = helper;
-    //std::cout << "creating new client" << std::endl;
-    //auto client = make_client_newb<basp_newb, tcp_transport,
-                                   //tcp_protocol<raw_tcp>>(sys, host, port);
-    // If I don't do this, our newb acceptor will never get events ...
-    auto b = sys.middleman().spawn_server(dummy_broker, port + 1);
-    await_done();
-  } else {
-    std::cout << "creating new client" << std::endl;
-    auto client = make_client_newb<basp_newb, tcp_transport,
-                                   tcp_protocol<policy::stream_basp>>(sys, host, port);
-    self->send(client, responder_atom::value, helper);
-    self->send(client, send_atom::value, char(0));
-    self->send(client, interval_atom::value);
-    await_done();
+void run_client(actor_system& sys, const config& cfg) {
+  scoped_actor self{sys};
+  transport_ptr pol{new tcp_transport};
+  auto eclient = spawn_client<proto_t>(sys, basp_client, std::move(pol),
+                                       cfg.host.c_str(), cfg.port);
+  if (!eclient) {
+    std::cerr << "failed to start client for " << cfg.host << ":" << cfg.port
+              << std::endl;
+    return;
+  }
+  auto client = std::move(*eclient);
+  std::vector<size_t> chunk_sizes{cfg.chunk_size};
+  if (cfg.sweep)
+    chunk_sizes = bench::sweep_sizes();
+  else if (cfg.large_sweep)
+    chunk_sizes = bench::sweep_sizes(8192, max_chunk_size);
+  for (auto size : chunk_sizes) {
+    auto chunk_size = std::min(std::max(size, size_t{1}), max_chunk_size);
+    self->send(client, start_atom::value, chunk_size, cfg.duration,
+               cfg.max_backlog * 1024, actor_cast<actor>(self));
+    self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
   }
-  */
+  self->send(client, quit_atom::value);
+}
+
+void caf_main(actor_system& sys, const config& cfg) {
+  if (cfg.is_server)
+    run_server(sys, cfg);
+  else
+    run_client(sys, cfg);
 }
 
 } // namespace anonymous
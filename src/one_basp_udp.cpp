@@ -8,282 +8,328 @@
 #include "caf/policy/newb_ordering.hpp"
 #include "caf/policy/newb_udp.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "paced_udp_transport.hpp"
+#include "pacer.hpp"
+#include "stream_stats.hpp"
+#include "write_arena.hpp"
+
 using namespace caf;
+using namespace caf::io;
+using namespace caf::io::network;
 using namespace caf::policy;
 
-/*
-using caf::io::network::default_multiplexer;
-using caf::io::network::invalid_native_socket;
-using caf::io::network::make_client_newb;
-using caf::io::network::make_server_newb;
-using caf::io::network::native_socket;
-*/
-
 namespace {
 
-/*
-using interval_atom = atom_constant<atom("interval")>;
-using ordering_atom = atom_constant<atom("ordering")>;
+using start_atom = atom_constant<atom("start")>;
 using send_atom = atom_constant<atom("send")>;
+using report_atom = atom_constant<atom("report")>;
+using tick_atom = atom_constant<atom("tick")>;
 using quit_atom = atom_constant<atom("quit")>;
-using responder_atom = atom_constant<atom("responder")>;
-using start_atom = atom_constant<atom("start")>;
-using handshake_atom = atom_constant<atom("handshake")>;
+using resume_atom = atom_constant<atom("resume")>;
 
-constexpr size_t chunk_size = 8192; //8192; //128; //1024;
+using clock_type = std::chrono::steady_clock;
 
+using proto_t = udp_protocol<ordering<datagram_basp>>;
 
-struct raw_newb : public io::network::newb<new_basp_msg> {
-  using message_type = new_basp_msg;
+// Largest UDP payload over IPv4 without our headers.
+constexpr size_t max_datagram = 65507 - basp_header_len - ordering_header_len;
 
-  raw_newb(caf::actor_config& cfg, default_multiplexer& dm,
-            native_socket sockfd)
-      : newb<message_type>(cfg, dm, sockfd),
-        running(true),
-        is_client(true),
-        interval_counter(0),
-        received_messages(0),
-        interval(5000) {
-    // nop
-    CAF_LOG_TRACE("");
-  }
+// Each data datagram starts with a sequence number and the send time.
+constexpr size_t data_header_len = sizeof(uint32_t) + sizeof(int64_t);
 
-  behavior make_behavior() override {
-    set_default_handler(print_and_drop);
-    return {
-      [=](message_type& msg) {
-        CAF_LOG_TRACE("");
-        if (is_client) {
-          send(responder, handshake_atom::value);
-        } else if (msg.payload_len == 1) {
-          auto byte = *msg.payload;
-          if (byte == 'h')
-            std::cout << "I'll consider this the handshake" << std::endl;
-          else if (byte == 'q')
-            send(this, quit_atom::value);
-          send(this, handshake_atom::value);
-        } else {
-          if (msg.payload_len != chunk_size)
-            std::cout << "Hmmm, payload is " << msg.payload_len << " and not "
-                      << chunk_size << std::endl;
-          received_messages += 1;
-          if (received_messages % 1000 == 0)
-            std::cout << "received " << received_messages << " messages" << std::endl;
-          //std::cout << "received message" << std::endl;
-          // nop
-        }
-      },
-      [=](handshake_atom) {
-        auto hw = caf::make_callback([&](io::network::byte_buffer& buf) -> error {
-          binary_serializer bs(&backend(), buf);
-          bs(basp_header{0, id(), actor_id{}});
-          return none;
-        });
-        auto whdl = wr_buf(&hw);
-        CAF_ASSERT(whdl.buf != nullptr);
-        CAF_ASSERT(whdl.protocol != nullptr);
-        binary_serializer bs(&backend(), *whdl.buf);
-        whdl.buf->push_back('h');
-      },
-      [=](send_atom, char c) {
-        if (running) {
-          delayed_send(this, interval, send_atom::value, char((c + 1) % 256));
-          auto hw = caf::make_callback([&](io::network::byte_buffer& buf) -> error {
-            binary_serializer bs(&backend(), buf);
-            bs(basp_header{0, id(), actor_id{}});
-            return none;
-          });
-          auto whdl = wr_buf(&hw);
-          CAF_ASSERT(whdl.buf != nullptr);
-          CAF_ASSERT(whdl.protocol != nullptr);
-          binary_serializer bs(&backend(), *whdl.buf);
-
-          auto start = whdl.buf->size();
-          whdl.buf->resize(start + chunk_size);
-          std::fill(whdl.buf->begin() + start, whdl.buf->end(), c);
-        }
-      },
-      [=](responder_atom, actor r) {
-        std::cout << "got responder assigned" << std::endl;
-        responder = r;
-        send(r, this);
-      },
-      [=](interval_atom) {
-        // TODO: Reimplement this with other count method.
-        //if (running) {
-          //delayed_send(this, std::chrono::seconds(1), interval_atom::value);
-          //data.emplace_back(interval,
-                            //transport->count,
-                            //transport->offline_buffer.size());
-          //interval_counter += 1;
-          //if (interval_counter % 10 == 0) {
-            //auto cnt = interval.count();
-            //auto dec = cnt > 1000 ? 1000 : (cnt > 100 ? 100 : 10);
-            //interval -= std::chrono::microseconds(dec);
-          //}
-          //transport->count = 0;
-          //if (interval.count() <= 0)
-            //running = false;
-        //} else {
-          //std::map<size_t, std::vector<size_t>> aggregate;
-          //for (auto& t : data) {
-            //auto expected = (1000000 / get<0>(t).count());
-            //aggregate[expected].push_back(get<1>(t));
-          //}
-          //for (auto& p : aggregate) {
-            //std::cerr << p.first;
-            //for (auto v : p.second)
-              //std::cerr << ", " << v;
-            //std::cerr << std::endl;
-          //}
-          //send(this, quit_atom::value);
-        //}
-      },
-      [=](quit_atom) {
-        std::cout << "got quit message" << std::endl;
-        // Remove from multiplexer loop.
-        stop();
-        // Quit actor.
-        quit();
-        send(responder, quit_atom::value);
-      }
-    };
-  }
+// How often the client tops up the transport.
+constexpr auto send_interval = std::chrono::milliseconds(1);
 
-  bool running;
-  bool is_client;
-  actor responder;
-  uint32_t interval_counter;
-  uint32_t received_messages;
-  std::chrono::microseconds interval;
-  // values: measurement point, current interval, messages sent in interval, offline buffer size
-  std::vector<std::tuple<std::chrono::microseconds, size_t, size_t>> data;
-};
+int64_t now_ns() {
+  using namespace std::chrono;
+  auto t = clock_type::now().time_since_epoch();
+  return duration_cast<nanoseconds>(t).count();
+}
 
-template <class ProtocolPolicy>
-struct udp_acceptor
-    : public io::network::newb_acceptor<typename ProtocolPolicy::message_type> {
-  using super = io::network::newb_acceptor<typename ProtocolPolicy::message_type>;
+// -- server -------------------------------------------------------------------
 
-  udp_acceptor(default_multiplexer& dm, native_socket sockfd)
-      : super(dm, sockfd) {
-    // nop
-  }
+// The server reports what it received every 10 ms. The report echoes the
+// send time of the latest datagram and how long the server held it, which
+// gives the client a round trip.
+struct server_state {
+  bool started = false;
+  uint64_t received = 0;
+  uint64_t received_bytes = 0;
+  uint32_t highest = 0;
+  int64_t echo_ns = 0;
+  int64_t arrived_ns = 0;
+  uint64_t ticks = 0;
+  uint64_t second_received = 0;
+  uint64_t second_bytes = 0;
+};
 
-  ~udp_acceptor() {
-    std::cout << "terminating udp acceptor" << std::endl;
-  }
+behavior basp_server(stateful_newb<new_basp_msg, server_state>* self) {
+  presize_buffers(*self->trans);
+  return {
+    [=](atom_value atm, uint32_t id) {
+      self->proto->timeout(atm, id);
+    },
+    [=](new_basp_msg& msg) {
+      auto& s = self->state;
+      uint32_t seq;
+      int64_t sent_ns;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(seq, sent_ns);
+      if (!s.started) {
+        s.started = true;
+        s.highest = seq;
+        self->delayed_send(self, std::chrono::milliseconds(10),
+                           tick_atom::value);
+      }
+      s.received += 1;
+      s.received_bytes += msg.payload_len;
+      s.second_received += 1;
+      s.second_bytes += msg.payload_len;
+      if (static_cast<int32_t>(seq - s.highest) > 0)
+        s.highest = seq;
+      s.echo_ns = sent_ns;
+      s.arrived_ns = now_ns();
+    },
+    [=](tick_atom) {
+      auto& s = self->state;
+      self->delayed_send(self, std::chrono::milliseconds(10),
+                         tick_atom::value);
+      {
+        auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+          binary_serializer bs(&self->backend(), buf);
+          bs(basp_header{0, self->id(), actor_id{}});
+          return none;
+        });
+        auto whdl = self->wr_buf(&hw);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.received, s.received_bytes, s.highest, s.echo_ns,
+           now_ns() - s.arrived_ns);
+      }
+      if (++s.ticks % 100 == 0) {
+        std::cout << "server received_per_s=" << s.second_received
+                  << " goodput_mbps=" << s.second_bytes * 8 / 1e6
+                  << " received=" << s.received
+                  << " expected=" << s.highest + 1 << std::endl;
+        s.second_received = 0;
+        s.second_bytes = 0;
+      }
+    },
+    [=](io_error_msg& msg) {
+      std::cerr << "server got io error: " << to_string(msg.op) << std::endl;
+    }
+  };
+}
 
-  expected<actor> create_newb(native_socket sockfd,
-                              io::network::transport_policy_ptr pol) override {
-    CAF_LOG_TRACE(CAF_ARG(sockfd));
-    std::cout << "creating newb" << std::endl;
-    auto n = io::network::make_newb<raw_newb>(this->backend().system(), sockfd);
-    auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
-    if (ptr == nullptr)
-      return sec::runtime_error;
-    auto& ref = dynamic_cast<raw_newb&>(*ptr);
-    ref.transport = std::move(pol);
-    ref.protocol.reset(new ProtocolPolicy(&ref));
-    ref.responder = responder;
-    // Read first message from this socket
-    ref.is_client = false;
-    ref.transport->prepare_next_read(this);
-    ref.transport->read_some(this, *ref.protocol.get());
-    // TODO: Just a workaround.
-    anon_send(responder, n);
-    return n;
-  }
+// -- client -------------------------------------------------------------------
 
+// Streams datagrams with `chunk_size` bytes of payload as fast as the pacer
+// of the transport allows and feeds the reports of the server into it. The
+// client keeps only about `send_interval` worth of datagrams at the current
+// rate waiting in the transport, so their send times stay close to when they
+// leave. Each `start_atom` begins a new run, `send_atom`s of earlier runs are
+// ignored.
+struct client_state {
   actor responder;
+  paced_udp_transport* trans = nullptr;
+  bench::stream_stats stats;
+  size_t chunk_size = 0;
+  size_t max_backlog = 0;
+  uint32_t next_seq = 0;
+  uint32_t run = 0;
+  clock_type::time_point end;
+  bool running = false;
+  // Totals of the last report.
+  uint64_t expected = 0;
+  uint64_t received = 0;
+  uint64_t received_bytes = 0;
 };
-*/
+
+behavior basp_client(stateful_newb<new_basp_msg, client_state>* self) {
+  presize_buffers(*self->trans);
+  // `run_client` always passes a `paced_udp_transport`.
+  auto trans = static_cast<paced_udp_transport*>(self->trans.get());
+  self->state.trans = trans;
+  trans->schedule_resume = [=](std::chrono::microseconds delay, uint32_t id) {
+    self->delayed_send(self, delay, resume_atom::value, id);
+  };
+  return {
+    [=](start_atom, size_t chunk_size, size_t seconds, double rate,
+        bool delay_based, size_t max_backlog, actor responder) {
+      auto& s = self->state;
+      bench::rate_controller::config cfg;
+      cfg.initial_rate = rate;
+      cfg.signal = delay_based ? bench::congestion_signal::delay
+                               : bench::congestion_signal::loss;
+      s.responder = responder;
+      s.chunk_size = chunk_size;
+      s.max_backlog = max_backlog;
+      s.trans->start_pacing(cfg, chunk_size + basp_header_len
+                                   + ordering_header_len);
+      auto now = clock_type::now();
+      s.stats.start(now);
+      s.end = now + std::chrono::seconds(seconds);
+      s.running = true;
+      s.run += 1;
+      self->send(self, send_atom::value, s.run);
+      self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+    },
+    [=](send_atom, uint32_t run) {
+      auto& s = self->state;
+      if (!s.running || run != s.run)
+        return;
+      // The protocol fills in the payload length.
+      auto hw = caf::make_callback([&](byte_buffer& buf) -> error {
+        binary_serializer bs(&self->backend(), buf);
+        bs(basp_header{0, self->id(), actor_id{}});
+        return none;
+      });
+      std::chrono::duration<double> interval = send_interval;
+      auto target = std::max(s.trans->pace->rate() * interval.count(),
+                             static_cast<double>(s.chunk_size));
+      target = std::min(target, static_cast<double>(s.max_backlog));
+      while (s.trans->backlog() < target) {
+        auto whdl = self->wr_buf(&hw);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.next_seq++, now_ns());
+        whdl.buf->resize(whdl.buf->size() + s.chunk_size - data_header_len);
+        s.stats.on_sent(s.chunk_size);
+      }
+      s.stats.sample_backlog(s.trans->backlog());
+      self->delayed_send(self, send_interval, send_atom::value, run);
+    },
+    [=](new_basp_msg& msg) {
+      auto& s = self->state;
+      uint64_t received;
+      uint64_t received_bytes;
+      uint32_t highest;
+      int64_t echo_ns;
+      int64_t held_ns;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(received, received_bytes, highest, echo_ns, held_ns);
+      if (received < s.received)
+        return;
+      auto expected = static_cast<uint64_t>(highest) + 1;
+      auto rtt = std::chrono::nanoseconds(now_ns() - echo_ns - held_ns);
+      s.trans->pace->on_report(
+        clock_type::now(), expected > s.expected ? expected - s.expected : 0,
+        received - s.received,
+        std::chrono::duration_cast<clock_type::duration>(rtt));
+      s.stats.on_delivered(received - s.received,
+                           received_bytes - s.received_bytes);
+      s.expected = expected;
+      s.received = received;
+      s.received_bytes = received_bytes;
+    },
+    [=](report_atom) {
+      auto& s = self->state;
+      auto now = clock_type::now();
+      s.stats.print(std::cout, now);
+      s.trans->pace->print(std::cout);
+      std::cout << std::endl;
+      if (now < s.end) {
+        self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+        return;
+      }
+      s.running = false;
+      s.stats.summary(std::cout, s.chunk_size);
+      self->send(s.responder, quit_atom::value);
+    },
+    [=](resume_atom, uint32_t id) {
+      self->state.trans->resume(self, id);
+    },
+    [=](io_error_msg& msg) {
+      std::cerr << "client got io error: " << to_string(msg.op) << std::endl;
+      self->send(self->state.responder, quit_atom::value);
+    },
+    // Timeouts of the layers match any atom, CAF picks the first matching
+    // handler. This has to stay behind all `(X_atom, uint32_t)` handlers.
+    [=](atom_value atm, uint32_t id) {
+      self->proto->timeout(atm, id);
+    }
+  };
+}
+
+// -- main ---------------------------------------------------------------------
 
 class config : public actor_system_config {
 public:
   uint16_t port = 12345;
   std::string host = "127.0.0.1";
   bool is_server = false;
+  size_t chunk_size = 8192;
+  bool sweep = false;
+  size_t duration = 10;
+  double rate = 8;
+  bool loss_based = false;
+  size_t max_backlog = 256;
 
   config() {
     opt_group{custom_options_, "global"}
     .add(port, "port,P", "set port")
     .add(host, "host,H", "set host")
-    .add(is_server, "server,s", "set server");
+    .add(is_server, "server,s", "set server")
+    .add(chunk_size, "chunk-size,c", "set bytes per datagram (client)")
+    .add(sweep, "sweep", "run with 128 B to 64 KiB per datagram (client)")
+    .add(duration, "duration,d", "set seconds to stream (client)")
+    .add(rate, "rate,r", "set initial rate in Mbit/s (client)")
+    .add(loss_based, "loss-based,l", "ignore delay, react to loss only")
+    .add(max_backlog, "max-backlog,b", "set KiB the transport may hold");
   }
 };
 
-void caf_main(actor_system& sys, const config& cfg) {
-  /*
-  using policy_t = udp_protocol<ordering<datagram_basp>>;
-  using acceptor_t = udp_acceptor<policy_t>;
-  const char* host = cfg.host.c_str();
-  const uint16_t port = cfg.port;
+void run_server(actor_system& sys, const config& cfg) {
   scoped_actor self{sys};
+  accept_ptr<new_basp_msg> pol{new accept_udp<new_basp_msg>};
+  auto eserver = make_server<proto_t>(sys, basp_server, std::move(pol),
+                                      cfg.port, nullptr, true);
+  if (!eserver) {
+    std::cerr << "failed to start server on port " << cfg.port << std::endl;
+    return;
+  }
+  auto server = std::move(*eserver);
+  self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
+  server->stop();
+}
 
-  auto running = [=](event_based_actor* self, std::string name,
-                     actor m, actor) -> behavior {
-    return {
-      [=](handshake_atom) {
-        std::cout << "[" << name << "] got server" << std::endl;
-        self->send(m, quit_atom::value);
-      },
-      [=](quit_atom) {
-        self->send(m, quit_atom::value);
-      }
-    };
-  };
-  auto init = [=](event_based_actor* self, std::string name,
-                  actor m) -> behavior {
-    self->set_default_handler(skip);
-    return {
-      [=](actor b) {
-        std::cout << "[" << name << "] got broker, let's do this" << std::endl;
-        self->become(running(self, name, m, b));
-        self->set_default_handler(print_and_drop);
-      }
-    };
-  };
-
-  auto dummy_broker = [](io::broker*) -> behavior {
-    return {
-      [](io::new_connection_msg&) {
-        std::cout << "got new connection" << std::endl;
-      }
-    };
-  };
-
-  auto name = cfg.is_server ? "server" : "client";
-  auto helper = sys.spawn(init, name, self);
-
-  actor nb;
-  auto await_done = [&](std::string msg) {
-    self->receive(
-      [&](quit_atom) {
-        std::cout << msg << std::endl;
-      }
-    );
-  };
-  if (cfg.is_server) {
-    std::cout << "creating new server" << std::endl;
-    auto server_ptr = make_server_newb<acceptor_t, accept_udp>(sys, port, nullptr,
-                                                               true);
-    // If I don't do this, our newb acceptor will never get events ...
-    auto b = sys.middleman().spawn_server(dummy_broker, port + 1);
-    await_done("done");
-  } else {
-    std::cout << "creating new client" << std::endl;
-    auto client = make_client_newb<raw_newb, udp_transport, policy_t>(sys, host,
-                                                                      port);
-    self->send(client, responder_atom::value, helper);
-    self->send(client, handshake_atom::value);
-    await_done("let's start");
-    self->send(client, send_atom::value, char(0));
-    self->send(client, interval_atom::value);
-    await_done("done");
-    std::abort();
+void run_client(actor_system& sys, const config& cfg) {
+  scoped_actor self{sys};
+  transport_ptr pol{new paced_udp_transport};
+  auto eclient = spawn_client<proto_t>(sys, basp_client, std::move(pol),
+                                       cfg.host.c_str(), cfg.port);
+  if (!eclient) {
+    std::cerr << "failed to start client for " << cfg.host << ":" << cfg.port
+              << std::endl;
+    return;
+  }
+  auto client = std::move(*eclient);
+  std::vector<size_t> chunk_sizes{cfg.chunk_size};
+  if (cfg.sweep)
+    chunk_sizes = bench::sweep_sizes();
+  for (auto size : chunk_sizes) {
+    auto chunk_size = std::min(std::max(size, data_header_len), max_datagram);
+    if (chunk_size != size)
+      std::cerr << "using chunks of " << chunk_size << " bytes" << std::endl;
+    self->send(client, start_atom::value, chunk_size, cfg.duration,
+               cfg.rate * 1e6 / 8, !cfg.loss_based, cfg.max_backlog * 1024,
+               actor_cast<actor>(self));
+    self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
   }
-*/
+}
+
+void caf_main(actor_system& sys, const config& cfg) {
+  if (cfg.is_server)
+    run_server(sys, cfg);
+  else
+    run_client(sys, cfg);
+  // UDP newbs do not notice when their peer is gone.
+  std::abort();
 }
 
 } // namespace anonymous
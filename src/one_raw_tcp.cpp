@@ -7,245 +7,285 @@
 #include "caf/policy/newb_raw.hpp"
 #include "caf/policy/newb_tcp.hpp"
 
-using namespace caf;
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "stream_stats.hpp"
+#include "tcp_vectored_transport.hpp"
+#include "write_arena.hpp"
 
-/*
-using caf::io::network::default_multiplexer;
-using caf::io::network::invalid_native_socket;
-using caf::io::network::make_client_newb;
-using caf::io::network::make_server_newb;
-using caf::io::network::native_socket;
-using caf::policy::accept_tcp;
-using caf::policy::tcp_protocol;
-using caf::policy::tcp_transport;
-*/
+using namespace caf;
+using namespace caf::io;
+using namespace caf::io::network;
+using namespace caf::policy;
 
 namespace {
 
-/*
-using interval_atom = atom_constant<atom("interval")>;
-using ordering_atom = atom_constant<atom("ordering")>;
+using start_atom = atom_constant<atom("start")>;
 using send_atom = atom_constant<atom("send")>;
+using report_atom = atom_constant<atom("report")>;
+using tick_atom = atom_constant<atom("tick")>;
 using quit_atom = atom_constant<atom("quit")>;
-using responder_atom = atom_constant<atom("responder")>;
-
-constexpr size_t chunk_size = 8192; //128; //8192; //1024;
-
-struct raw_newb : public io::network::newb<policy::new_raw_msg> {
-  using message_type = policy::new_raw_msg;
-
-  raw_newb(caf::actor_config& cfg, default_multiplexer& dm,
-            native_socket sockfd)
-      : newb<message_type>(cfg, dm, sockfd),
-        running(true),
-        interval_counter(0),
-        received_messages(0),
-        interval(5000) {
-    // nop
-    CAF_LOG_TRACE("");
-  }
+using recheck_atom = atom_constant<atom("recheck")>;
 
-  behavior make_behavior() override {
-    set_default_handler(print_and_drop);
-    return {
-      [=](message_type& msg) {
-        CAF_LOG_TRACE("");
-        if (msg.payload_len == 1) {
-          // nop
-        } else {
-          received_messages += 1;
-          if (received_messages % 1000 == 0)
-            std::cout << "received " << received_messages << " messages" << std::endl;
-          //std::cout << "received message" << std::endl;
-          // nop
-        }
-      },
-      [=](send_atom, char c) {
-        if (running) {
-          delayed_send(this, interval, send_atom::value, char((c + 1) % 256));
-          auto whdl = wr_buf(nullptr);
-          CAF_ASSERT(whdl.buf != nullptr);
-          CAF_ASSERT(whdl.protocol != nullptr);
-          binary_serializer bs(&backend(), *whdl.buf);
-          whdl.buf->resize(chunk_size);
-          std::fill(whdl.buf->begin(), whdl.buf->end(), c);
-        }
-      },
-      [=](responder_atom, actor r) {
-        std::cout << "got responder assigned" << std::endl;
-        responder = r;
-        send(r, this);
-      },
-      [=](interval_atom) {
-        // Reimplement this with other count method.
-        //if (running) {
-          //delayed_send(this, std::chrono::seconds(1), interval_atom::value);
-          //data.emplace_back(interval,
-                            //transport->count,
-                            //transport->offline_buffer.size());
-          //interval_counter += 1;
-          //if (interval_counter % 10 == 0) {
-            //auto cnt = interval.count();
-            //auto dec = cnt > 1000 ? 1000 : (cnt > 100 ? 100 : 10);
-            //interval -= std::chrono::microseconds(dec);
-          //}
-          //transport->count = 0;
-          //if (interval.count() <= 0)
-            //running = false;
-        //} else {
-          //std::map<size_t, std::vector<size_t>> aggregate;
-          //for (auto& t : data) {
-            //auto expected = (1000000 / get<0>(t).count());
-            //aggregate[expected].push_back(get<1>(t));
-          //}
-          //for (auto& p : aggregate) {
-            //std::cerr << p.first;
-            //for (auto v : p.second)
-              //std::cerr << ", " << v;
-            //std::cerr << std::endl;
-          //}
-          //send(this, quit_atom::value);
-        //}
-      },
-      [=](quit_atom) {
-        std::cout << "got quit message" << std::endl;
-        // Remove from multiplexer loop.
-        stop();
-        // Quit actor.
-        quit();
-        send(responder, quit_atom::value);
-      }
-    };
-  }
+using clock_type = std::chrono::steady_clock;
 
-  bool running;
-  actor responder;
-  uint32_t interval_counter;
-  uint32_t received_messages;
-  std::chrono::microseconds interval;
-  // values: measurement point, current interval, messages sent in interval, offline buffer size
-  std::vector<std::tuple<std::chrono::microseconds, size_t, size_t>> data;
+// The server reads at most this many bytes at once, chunks of the client
+// may be larger.
+constexpr size_t max_read_size = 65536;
 
-};
+constexpr size_t max_chunk_size = 1 << 20;
 
-template <class ProtocolPolicy>
-struct tcp_acceptor
-    : public io::network::newb_acceptor<typename ProtocolPolicy::message_type> {
-  using super = io::network::newb_acceptor<typename ProtocolPolicy::message_type>;
+// -- server -------------------------------------------------------------------
 
-  tcp_acceptor(default_multiplexer& dm, native_socket sockfd)
-      : super(dm, sockfd) {
-    // nop
-  }
+// Raw TCP has no message boundaries, the server counts bytes and reports the
+// total every 10 ms.
+struct server_state {
+  bool started = false;
+  uint64_t received_bytes = 0;
+  uint64_t ticks = 0;
+  uint64_t second_bytes = 0;
+};
 
-  expected<actor> create_newb(native_socket sockfd,
-                              io::network::transport_policy_ptr pol) override {
-    CAF_LOG_TRACE(CAF_ARG(sockfd));
-    std::cout << "tcp_acceptor::creating newb" << std::endl;
-    auto n = io::network::make_newb<raw_newb>(this->backend().system(), sockfd);
-    auto ptr = caf::actor_cast<caf::abstract_actor*>(n);
-    if (ptr == nullptr)
-      return sec::runtime_error;
-    auto& ref = dynamic_cast<raw_newb&>(*ptr);
-    ref.transport = std::move(pol);
-    ref.protocol.reset(new ProtocolPolicy(&ref));
-    ref.responder = responder;
-    ref.configure_read(io::receive_policy::exactly(chunk_size));
-    anon_send(responder, n);
-    return n;
-  }
+behavior raw_server(stateful_newb<new_raw_msg, server_state>* self) {
+  presize_buffers(*self->trans);
+  self->configure_read(io::receive_policy::at_most(max_read_size));
+  return {
+    [=](new_raw_msg& msg) {
+      auto& s = self->state;
+      if (!s.started) {
+        s.started = true;
+        self->delayed_send(self, std::chrono::milliseconds(10),
+                           tick_atom::value);
+      }
+      s.received_bytes += msg.payload_len;
+      s.second_bytes += msg.payload_len;
+    },
+    [=](tick_atom) {
+      auto& s = self->state;
+      self->delayed_send(self, std::chrono::milliseconds(10),
+                         tick_atom::value);
+      {
+        auto whdl = self->wr_buf(nullptr);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.received_bytes);
+      }
+      if (++s.ticks % 100 == 0) {
+        std::cout << "server goodput_mbps=" << s.second_bytes * 8 / 1e6
+                  << " received_bytes=" << s.received_bytes << std::endl;
+        s.second_bytes = 0;
+      }
+    },
+    [=](io_error_msg&) {
+      std::cout << "server done received_bytes="
+                << self->state.received_bytes << std::endl;
+      self->stop();
+      self->quit();
+    }
+  };
+}
+
+// -- client -------------------------------------------------------------------
 
+// Writes chunks of `chunk_size` bytes as long as less than `max_backlog`
+// bytes wait in the transport. On a `tcp_vectored_transport`, every chunk
+// refers to the same payload instead of copying it into the buffer. Each
+// `start_atom` begins a new run, `send_atom`s of earlier runs are ignored.
+struct client_state {
   actor responder;
+  bench::stream_stats stats;
+  tcp_vectored_transport* vectored = nullptr;
+  std::shared_ptr<const byte_buffer> payload;
+  size_t chunk_size = 0;
+  size_t max_backlog = 0;
+  uint32_t run = 0;
+  clock_type::time_point end;
+  bool running = false;
+  // Total of the last report and at the start of the run.
+  uint64_t received_bytes = 0;
+  uint64_t run_bytes = 0;
 };
-*/
+
+// Bytes the transport still has to write.
+size_t backlog(stateful_newb<new_raw_msg, client_state>* self) {
+  auto& s = self->state;
+  if (s.vectored != nullptr)
+    return s.vectored->backlog();
+  return self->trans->offline_buffer.size();
+}
+
+behavior raw_client(stateful_newb<new_raw_msg, client_state>* self) {
+  presize_buffers(*self->trans);
+  auto vectored = dynamic_cast<tcp_vectored_transport*>(self->trans.get());
+  self->state.vectored = vectored;
+  // Lets the transport wait for zero-copy confirmations off the multiplexer.
+  if (vectored != nullptr)
+    vectored->schedule_recheck = [=](std::chrono::microseconds delay,
+                                     uint32_t id) {
+      self->delayed_send(self, delay, recheck_atom::value, id);
+    };
+  self->configure_read(io::receive_policy::exactly(sizeof(uint64_t)));
+  return {
+    [=](start_atom, size_t chunk_size, size_t seconds, size_t max_backlog,
+        actor responder) {
+      auto& s = self->state;
+      s.responder = responder;
+      s.chunk_size = chunk_size;
+      s.max_backlog = max_backlog;
+      s.payload = std::make_shared<byte_buffer>(chunk_size, 'a');
+      s.run_bytes = s.received_bytes;
+      auto now = clock_type::now();
+      s.stats.start(now);
+      s.end = now + std::chrono::seconds(seconds);
+      s.running = true;
+      s.run += 1;
+      self->send(self, send_atom::value, s.run);
+      self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+    },
+    [=](send_atom, uint32_t run) {
+      auto& s = self->state;
+      if (!s.running || run != s.run)
+        return;
+      for (auto pending = backlog(self); pending < s.max_backlog;
+           pending += s.chunk_size) {
+        if (s.vectored != nullptr) {
+          s.vectored->write_external(self, s.payload);
+        } else {
+          auto whdl = self->wr_buf(nullptr);
+          whdl.buf->insert(whdl.buf->end(), s.payload->begin(),
+                           s.payload->end());
+        }
+        s.stats.on_sent(s.chunk_size);
+      }
+      s.stats.sample_backlog(backlog(self));
+      self->delayed_send(self, std::chrono::microseconds(50),
+                         send_atom::value, run);
+    },
+    [=](new_raw_msg& msg) {
+      auto& s = self->state;
+      uint64_t received_bytes;
+      binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
+      bd(received_bytes);
+      if (received_bytes < s.received_bytes)
+        return;
+      // Count chunks of this run only.
+      auto chunks = [&](uint64_t total) {
+        return total > s.run_bytes ? (total - s.run_bytes) / s.chunk_size : 0;
+      };
+      s.stats.on_delivered(chunks(received_bytes) - chunks(s.received_bytes),
+                           received_bytes - s.received_bytes);
+      s.received_bytes = received_bytes;
+    },
+    [=](report_atom) {
+      auto& s = self->state;
+      auto now = clock_type::now();
+      s.stats.print(std::cout, now);
+      std::cout << std::endl;
+      if (now < s.end) {
+        self->delayed_send(self, std::chrono::seconds(1), report_atom::value);
+        return;
+      }
+      s.running = false;
+      s.stats.summary(std::cout, s.chunk_size);
+      if (s.vectored != nullptr && s.vectored->zerocopy)
+        s.vectored->stats.print(std::cout);
+      self->send(s.responder, quit_atom::value);
+    },
+    [=](recheck_atom, uint32_t id) {
+      self->state.vectored->recheck(self, id);
+    },
+    [=](quit_atom) {
+      self->stop();
+      self->quit();
+    },
+    [=](io_error_msg& msg) {
+      std::cerr << "client got io error: " << to_string(msg.op) << std::endl;
+      self->send(self->state.responder, quit_atom::value);
+    }
+  };
+}
+
+// -- main ---------------------------------------------------------------------
 
 class config : public actor_system_config {
 public:
   uint16_t port = 12345;
   std::string host = "127.0.0.1";
   bool is_server = false;
+  size_t chunk_size = 8192;
+  bool sweep = false;
+  bool large_sweep = false;
+  size_t duration = 10;
+  size_t max_backlog = 256;
+  bool vectored = false;
+  bool zerocopy = false;
 
   config() {
     opt_group{custom_options_, "global"}
     .add(port, "port,P", "set port")
     .add(host, "host,H", "set host")
-    .add(is_server, "server,s", "set server");
+    .add(is_server, "server,s", "set server")
+    .add(chunk_size, "chunk-size,c", "set bytes per chunk (client)")
+    .add(sweep, "sweep", "run with 128 B to 64 KiB per chunk (client)")
+    .add(large_sweep, "large-sweep", "run with 8 KiB to 1 MiB per chunk")
+    .add(duration, "duration,d", "set seconds to stream (client)")
+    .add(max_backlog, "max-backlog,b", "set KiB the transport may hold")
+    .add(vectored, "vectored,V", "send chunks without copying (client)")
+    .add(zerocopy, "zerocopy,Z", "like --vectored, with MSG_ZEROCOPY");
   }
 };
 
-struct state {
-  size_t count = 0;
-};
-
-void caf_main(actor_system& sys, const config& cfg) {
-  /*
-  using acceptor_t = tcp_acceptor<tcp_protocol<policy::raw>>;
-  const char* host = cfg.host.c_str();
-  const uint16_t port = cfg.port;
+void run_server(actor_system& sys, const config& cfg) {
   scoped_actor self{sys};
+  accept_ptr<new_raw_msg> pol{new accept_tcp<new_raw_msg>};
+  auto eserver = make_server<tcp_protocol<raw>>(sys, raw_server,
+                                                std::move(pol), cfg.port,
+                                                nullptr, true);
+  if (!eserver) {
+    std::cerr << "failed to start server on port " << cfg.port << std::endl;
+    return;
+  }
+  auto server = std::move(*eserver);
+  self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
+  server->stop();
+}
 
-  auto running = [=](event_based_actor* self, std::string,
-                     actor m, actor) -> behavior {
-    return {
-      [=](quit_atom) {
-        self->send(m, quit_atom::value);
-      }
-    };
-  };
-  auto init = [=](event_based_actor* self, std::string name,
-                  actor m) -> behavior {
-    self->set_default_handler(skip);
-    return {
-      [=](actor b) {
-        std::cout << "[" << name << "] got broker, let's do this" << std::endl;
-        self->become(running(self, name, m, b));
-        self->set_default_handler(print_and_drop);
-      }
-    };
-  };
-
-  auto dummy_broker = [](io::stateful_broker<state>* self) -> behavior {
-    return {
-      [=](io::new_connection_msg& msg) {
-        std::cout << "got new connection" << std::endl;
-        self->configure_read(msg.handle, io::receive_policy::exactly(chunk_size));
-      },
-      [=](io::new_data_msg&) {
-        self->state.count += 1;
-        if (self->state.count % 1000 == 0)
-          std::cout << "received " << self->state.count << " messages" << std::endl;
-      }
-    };
-  };
-
-  auto name = cfg.is_server ? "server" : "client";
-  auto helper = sys.spawn(init, name, self);
-
-  actor nb;
-  auto await_done = [&]() {
-    self->receive(
-      [&](quit_atom) {
-        std::cout << "done" << std::endl;
-      }
-    );
-  };
-  if (cfg.is_server) {
-    std::cout << "creating new server" << std::endl;
-    auto server_ptr = make_server_newb<acceptor_t, accept_tcp>(sys, port, nullptr,
-                                                               true);
-    // If I don't do this, our newb acceptor will never get events ...
-    auto b = sys.middleman().spawn_server(dummy_broker, port + 1);
-    await_done();
-  } else {
-    std::cout << "creating new client" << std::endl;
-    auto client = make_client_newb<raw_newb, tcp_transport,
-                                   tcp_protocol<policy::raw>>(sys, host, port);
-    self->send(client, responder_atom::value, helper);
-    self->send(client, send_atom::value, char(0));
-    self->send(client, interval_atom::value);
-    await_done();
+void run_client(actor_system& sys, const config& cfg) {
+  scoped_actor self{sys};
+  transport_ptr pol{new tcp_transport};
+  if (cfg.vectored || cfg.zerocopy)
+    pol.reset(new tcp_vectored_transport(cfg.zerocopy));
+  auto eclient = spawn_client<tcp_protocol<raw>>(sys, raw_client,
+                                                 std::move(pol),
+                                                 cfg.host.c_str(), cfg.port);
+  if (!eclient) {
+    std::cerr << "failed to start client for " << cfg.host << ":" << cfg.port
+              << std::endl;
+    return;
+  }
+  auto client = std::move(*eclient);
+  std::vector<size_t> chunk_sizes{cfg.chunk_size};
+  if (cfg.sweep)
+    chunk_sizes = bench::sweep_sizes();
+  else if (cfg.large_sweep)
+    chunk_sizes = bench::sweep_sizes(8192, max_chunk_size);
+  for (auto size : chunk_sizes) {
+    auto chunk_size = std::min(std::max(size, size_t{1}), max_chunk_size);
+    self->send(client, start_atom::value, chunk_size, cfg.duration,
+               cfg.max_backlog * 1024, actor_cast<actor>(self));
+    self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
   }
-*/
+  self->send(client, quit_atom::value);
+}
+
+void caf_main(actor_system& sys, const config& cfg) {
+  if (cfg.is_server)
+    run_server(sys, cfg);
+  else
+    run_client(sys, cfg);
 }
 
 } // namespace anonymous
@@ -0,0 +1,131 @@
+#ifndef PACED_UDP_TRANSPORT_HPP
+#define PACED_UDP_TRANSPORT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "caf/io/newb.hpp"
+#include "caf/logger.hpp"
+
+#include "pacer.hpp"
+#include "udp_mmsg_transport.hpp"
+
+namespace caf {
+namespace policy {
+
+/// UDP transport that sends datagrams no faster than a `bench::pacer`
+/// allows. The newb writes as usual, the datagrams wait in the transport
+/// until the token bucket has room for them. Whenever the socket buffer is
+/// full, the transport lowers the rate of the pacer. Reports of the receiver
+/// drive the rate as well, the newb passes them to `pace->on_report`.
+///
+/// Once the bucket runs dry, the transport leaves the write events of the
+/// multiplexer and calls `schedule_resume` with the time until the next
+/// datagram may go out and an ID. Its owner calls `resume` with that ID
+/// after the delay, usually from a timeout of the newb. Actor timers are too
+/// coarse for very short waits, the delay is therefore at least
+/// `min_resume_delay` and the bucket makes up for it with a burst. Without a
+/// `schedule_resume`, the transport stays registered for write events and
+/// polls the bucket on each of them, which keeps the I/O thread busy.
+///
+/// Without a pacer, the transport behaves like `udp_mmsg_transport`.
+struct paced_udp_transport : public udp_mmsg_transport {
+  using clock_type = std::chrono::steady_clock;
+  using resume_fun = std::function<void(std::chrono::microseconds, uint32_t)>;
+
+  explicit paced_udp_transport(size_t max_batch = 64,
+                               std::shared_ptr<buffer_pool> pool = nullptr)
+    : udp_mmsg_transport(max_batch, std::move(pool)),
+      held(false),
+      resume_id(0),
+      min_resume_delay(100),
+      max_resume_delay(10000) {
+    // nop
+  }
+
+  /// Paces datagrams of `datagram_size` bytes from now on, starting at the
+  /// initial rate of `cfg`.
+  void start_pacing(const bench::rate_controller::config& cfg,
+                    size_t datagram_size) {
+    pace.reset(new bench::pacer(cfg, datagram_size));
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  rw_state write_some(newb_base* parent) override {
+    if (!pace)
+      return udp_mmsg_transport::write_some(parent);
+    CAF_LOG_TRACE(CAF_ARG(arena.chunks()));
+    if (arena.empty())
+      prepare_next_write(parent);
+    if (!writing)
+      return rw_state::success;
+    auto now = clock_type::now();
+    auto n = std::min(arena.chunks(), max_batch);
+    size_t allowed = 0;
+    while (allowed < n && pace->may_send(now))
+      allowed += 1;
+    if (allowed == 0) {
+      hold(parent);
+      return rw_state::success;
+    }
+    auto sres = send_chunks(parent, allowed);
+    if (sres < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        CAF_LOG_ERROR("sendmmsg failed:" << CAF_ARG(errno));
+        return rw_state::failure;
+      }
+      // The kernel drains the socket buffer slower than we fill it.
+      pace->put_back(allowed);
+      pace->on_backlog(now);
+      return rw_state::success;
+    }
+    pace->put_back(allowed - static_cast<size_t>(sres));
+    return rw_state::success;
+  }
+
+  // -- pacing -----------------------------------------------------------------
+
+  /// Leaves the write events until the bucket has room for a datagram. The
+  /// transport still counts as writing, so flushes do not register it again.
+  void hold(newb_base* parent) {
+    if (!schedule_resume)
+      return;
+    parent->stop_writing();
+    held = true;
+    resume_id += 1;
+    auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+      pace->wait_time());
+    schedule_resume(std::min(std::max(delay, min_resume_delay),
+                             max_resume_delay),
+                    resume_id);
+  }
+
+  /// Registers for write events again after the delay passed to
+  /// `schedule_resume`. Calls for an earlier ID than the current one are
+  /// stale.
+  void resume(newb_base* parent, uint32_t id) {
+    if (!held || id != resume_id)
+      return;
+    held = false;
+    parent->start_writing();
+  }
+
+  std::unique_ptr<bench::pacer> pace;
+
+  // Timer for leaving the write events while the bucket is empty.
+  resume_fun schedule_resume;
+  bool held;
+  uint32_t resume_id;
+  std::chrono::microseconds min_resume_delay;
+  std::chrono::microseconds max_resume_delay;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // PACED_UDP_TRANSPORT_HPP
@@ -0,0 +1,277 @@
+#ifndef PACER_HPP
+#define PACER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace bench {
+
+/// Hands out bytes at `rate` per second. Tokens accumulate while the sender
+/// is idle, up to `burst` bytes.
+class token_bucket {
+public:
+  using clock_type = std::chrono::steady_clock;
+
+  token_bucket(double rate, double burst)
+    : rate_(rate),
+      burst_(burst),
+      tokens_(burst),
+      last_(clock_type::now()) {
+    // nop
+  }
+
+  void set_rate(double rate, double burst) {
+    refill(clock_type::now());
+    rate_ = rate;
+    burst_ = burst;
+    tokens_ = std::min(tokens_, burst_);
+  }
+
+  /// Adds the tokens for the time since the last call.
+  void refill(clock_type::time_point now) {
+    auto secs = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    if (secs > 0)
+      tokens_ = std::min(tokens_ + secs * rate_, burst_);
+  }
+
+  /// Takes `bytes` tokens if available.
+  bool consume(size_t bytes) {
+    if (tokens_ < bytes)
+      return false;
+    tokens_ -= bytes;
+    return true;
+  }
+
+  /// Returns `bytes` tokens that were taken but not used.
+  void put_back(size_t bytes) {
+    tokens_ = std::min(tokens_ + bytes, burst_);
+  }
+
+  /// Returns how long it takes until `bytes` tokens are available.
+  clock_type::duration wait_time(size_t bytes) const {
+    if (tokens_ >= bytes || rate_ <= 0)
+      return clock_type::duration::zero();
+    std::chrono::duration<double> secs{(bytes - tokens_) / rate_};
+    return std::chrono::duration_cast<clock_type::duration>(secs);
+  }
+
+  double rate() const {
+    return rate_;
+  }
+
+private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  clock_type::time_point last_;
+};
+
+/// Congestion signals `rate_controller` reacts to.
+enum class congestion_signal {
+  /// The receiver reports more than `loss_threshold` of the datagrams it
+  /// expected since its last report as missing.
+  loss,
+  /// Like `loss`, or the round trip exceeds the smallest one seen so far by
+  /// more than `delay_target`, i.e., a queue builds up along the path.
+  delay
+};
+
+/// Sets the sending rate of a `pacer` from receiver reports. Starts by
+/// doubling the rate on every report without congestion (slow start). The
+/// first congestion ends slow start, from then on the rate grows additively
+/// and shrinks multiplicatively (AIMD). After a decrease, the increase per
+/// report is an eighth of the cut, so the rate regains the level that caused
+/// congestion after eight reports, then probes beyond it at the same pace.
+/// The rate shrinks at most once per round trip, since earlier reports
+/// still reflect the old rate.
+class rate_controller {
+public:
+  using clock_type = std::chrono::steady_clock;
+  using duration = clock_type::duration;
+
+  struct config {
+    congestion_signal signal = congestion_signal::delay;
+    double initial_rate = 1e6;
+    double min_rate = 64e3;
+    double max_rate = 10e9;
+    double decrease = 0.7;
+    double loss_threshold = 0.01;
+    duration delay_target = std::chrono::milliseconds(5);
+  };
+
+  explicit rate_controller(const config& cfg)
+    : cfg_(cfg),
+      rate_(cfg.initial_rate),
+      step_(0),
+      slow_start_(true),
+      min_rtt_(duration::max()),
+      rtt_(duration::zero()),
+      last_decrease_(),
+      decreases_(0) {
+    // nop
+  }
+
+  /// Processes a receiver report. Since its last report, the receiver
+  /// expected `expected` datagrams, i.e., its highest sequence number grew
+  /// by that much, and `received` of them arrived. `rtt` is the latest round
+  /// trip or zero if unknown. Returns the new rate.
+  double on_report(clock_type::time_point now, uint64_t expected,
+                   uint64_t received, duration rtt) {
+    if (rtt > duration::zero()) {
+      rtt_ = rtt;
+      min_rtt_ = std::min(min_rtt_, rtt);
+    }
+    auto lost = expected > received ? expected - received : 0;
+    auto congested = expected > 0 && lost > cfg_.loss_threshold * expected;
+    if (cfg_.signal == congestion_signal::delay && rtt > duration::zero())
+      congested = congested || rtt > min_rtt_ + cfg_.delay_target;
+    if (congested)
+      decrease(now);
+    else
+      increase();
+    return rate_;
+  }
+
+  /// Treats a full socket buffer as congestion. The kernel drains it slower
+  /// than we fill it.
+  double on_backlog(clock_type::time_point now) {
+    decrease(now);
+    return rate_;
+  }
+
+  double rate() const {
+    return rate_;
+  }
+
+  bool slow_start() const {
+    return slow_start_;
+  }
+
+  duration rtt() const {
+    return rtt_;
+  }
+
+  size_t decreases() const {
+    return decreases_;
+  }
+
+private:
+  void increase() {
+    if (slow_start_)
+      rate_ *= 2;
+    else
+      rate_ += step_;
+    rate_ = std::min(rate_, cfg_.max_rate);
+  }
+
+  void decrease(clock_type::time_point now) {
+    if (now - last_decrease_ < rtt_)
+      return;
+    last_decrease_ = now;
+    slow_start_ = false;
+    auto cut = rate_ * (1 - cfg_.decrease);
+    rate_ = std::max(rate_ - cut, cfg_.min_rate);
+    step_ = cut / 8;
+    decreases_ += 1;
+  }
+
+  config cfg_;
+  double rate_;
+  double step_;
+  bool slow_start_;
+  duration min_rtt_;
+  duration rtt_;
+  clock_type::time_point last_decrease_;
+  size_t decreases_;
+};
+
+/// Paces a stream of datagrams with a `token_bucket` whose rate follows a
+/// `rate_controller`. The bucket holds at most `burst_time` worth of tokens,
+/// but always enough for one datagram. A sender asks `may_send` before each
+/// datagram and otherwise waits for `wait_time`. If the socket buffer is
+/// full, the sender calls `on_backlog` and the pacer lowers the rate, so the
+/// socket buffer does not overrun again.
+class pacer {
+public:
+  using clock_type = std::chrono::steady_clock;
+  using duration = clock_type::duration;
+
+  pacer(const rate_controller::config& cfg, size_t datagram_size,
+        duration burst_time = std::chrono::milliseconds(1))
+    : controller_(cfg),
+      bucket_(cfg.initial_rate, burst(cfg.initial_rate, datagram_size,
+                                      burst_time)),
+      datagram_size_(datagram_size),
+      burst_time_(burst_time) {
+    // nop
+  }
+
+  /// Returns whether the next datagram may go out now and takes its tokens.
+  bool may_send(clock_type::time_point now) {
+    bucket_.refill(now);
+    return bucket_.consume(datagram_size_);
+  }
+
+  /// Returns the tokens of `datagrams` that did not go out after all.
+  void put_back(size_t datagrams) {
+    bucket_.put_back(datagrams * datagram_size_);
+  }
+
+  void on_backlog(clock_type::time_point now) {
+    controller_.on_backlog(now);
+    update();
+  }
+
+  /// Returns how long to wait before calling `may_send` again.
+  duration wait_time() const {
+    return bucket_.wait_time(datagram_size_);
+  }
+
+  void on_report(clock_type::time_point now, uint64_t expected,
+                 uint64_t received, duration rtt) {
+    controller_.on_report(now, expected, received, rtt);
+    update();
+  }
+
+  double rate() const {
+    return controller_.rate();
+  }
+
+  const rate_controller& controller() const {
+    return controller_;
+  }
+
+  /// Prints the rate, the latest round trip and the number of decreases as
+  /// `key=value` pairs, each with a leading space.
+  void print(std::ostream& out) const {
+    auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+      controller_.rtt());
+    out << " rate_mbps=" << rate() * 8 / 1e6
+        << " rtt_us=" << rtt.count()
+        << " decreases=" << controller_.decreases();
+  }
+
+private:
+  static double burst(double rate, size_t datagram_size, duration t) {
+    auto secs = std::chrono::duration<double>(t).count();
+    return std::max(rate * secs, static_cast<double>(datagram_size));
+  }
+
+  void update() {
+    auto rate = controller_.rate();
+    bucket_.set_rate(rate, burst(rate, datagram_size_, burst_time_));
+  }
+
+  rate_controller controller_;
+  token_bucket bucket_;
+  size_t datagram_size_;
+  duration burst_time_;
+};
+
+} // namespace bench
+
+#endif // PACER_HPP
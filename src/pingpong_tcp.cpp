@@ -8,6 +8,13 @@
 #include "caf/policy/newb_raw.hpp"
 #include "caf/io/broker.hpp"
 
+#include "busy_poll.hpp"
+#include "multiplexer_backend.hpp"
+#include "pipeline_window.hpp"
+#include "placement.hpp"
+#include "uring_transport.hpp"
+#include "write_arena.hpp"
+
 using namespace caf;
 using namespace caf::io;
 using namespace caf::io::network;
@@ -26,6 +33,8 @@ struct state {
   caf::io::connection_handle other;
   size_t messages = 0;
   uint32_t received_messages = 0;
+  bench::pipeline_window window;
+  std::string histogram_out;
 };
 
 
@@ -58,14 +67,18 @@ behavior tcp_server(stateful_broker<state>* self) {
 behavior tcp_client(stateful_broker<state>* self, connection_handle hdl) {
   self->state.other = hdl;
   return {
-    [=](start_atom, size_t messages, actor responder) {
+    [=](start_atom, size_t messages, size_t window,
+        const std::string& histogram_out, actor responder) {
       auto& s = self->state;
       s.responder = responder;
+      s.histogram_out = histogram_out;
       s.messages = messages;
+      s.window.reset(window, messages);
       self->configure_read(s.other, io::receive_policy::exactly(sizeof(uint32_t)));
       std::vector<char> buf;
       binary_serializer bs(self->system(), buf);
-      bs(uint32_t(1));
+      while (s.window.can_send())
+        bs(s.window.send());
       self->write(s.other, buf.size(), buf.data());
       self->flush(s.other);
     },
@@ -74,15 +87,24 @@ behavior tcp_client(stateful_broker<state>* self, connection_handle hdl) {
       uint32_t counter;
       binary_deserializer bd(self->system(), msg.buf);
       bd(counter);
+      if (counter != s.window.oldest() || !s.window.receive(counter)) {
+        std::cerr << "got counter " << counter << ", expected "
+                  << s.window.oldest() << std::endl;
+        self->send(s.responder, quit_atom::value);
+        return;
+      }
       s.received_messages += 1;
       if (s.received_messages % 100 == 0)
         std::cerr << "got " << s.received_messages << std::endl;
-      if (s.received_messages >= s.messages) {
+      if (s.window.done()) {
+        s.window.report(std::cerr);
+        bench::write_csv(s.window.latency(), s.histogram_out);
         self->send(s.responder, quit_atom::value);
-      } else {
+      } else if (s.window.can_send()) {
         std::vector<char> buf;
         binary_serializer bs(self->system(), buf);
-        bs(counter + 1);
+        while (s.window.can_send())
+          bs(s.window.send());
         self->write(msg.handle, buf.size(), buf.data());
         self->flush(msg.handle);
       }
@@ -95,8 +117,15 @@ behavior tcp_client(stateful_broker<state>* self, connection_handle hdl) {
 }
 
 
+// Prints spin hits and misses if the newb runs on a `busy_poll` transport.
+void report_busy_poll(transport& trans) {
+  if (auto stats = dynamic_cast<busy_poll_stats*>(&trans))
+    stats->print(std::cerr);
+}
+
 behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
   self->state.responder = responder;
+  presize_buffers(*self->trans);
   return {
     [=](new_raw_msg& msg) {
       uint32_t counter;
@@ -108,6 +137,7 @@ behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
     },
     [=](io_error_msg& msg) {
       std::cerr << "server got io error: " << to_string(msg.op) << std::endl;
+      report_busy_poll(*self->trans);
       self->quit();
       self->stop();
       self->send(self->state.responder, quit_atom::value);
@@ -116,33 +146,53 @@ behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
 }
 
 behavior raw_client(stateful_newb<new_raw_msg, state>* self) {
+  presize_buffers(*self->trans);
   return {
-    [=](start_atom, size_t messages, actor responder) {
+    [=](start_atom, size_t messages, size_t window,
+        const std::string& histogram_out, actor responder) {
       auto& s = self->state;
       s.responder = responder;
+      s.histogram_out = histogram_out;
       s.messages = messages;
+      s.window.reset(window, messages);
       self->configure_read(io::receive_policy::exactly(sizeof(uint32_t)));
-      auto whdl = self->wr_buf(nullptr);
-      binary_serializer bs(&self->backend(), *whdl.buf);
-      bs(uint32_t(1));
+      while (s.window.can_send()) {
+        auto whdl = self->wr_buf(nullptr);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.window.send());
+      }
     },
     [=](new_raw_msg& msg) {
       auto& s = self->state;
       uint32_t counter;
       binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
       bd(counter);
+      // TCP keeps the echoes in order, anything else is a bug.
+      if (counter != s.window.oldest() || !s.window.receive(counter)) {
+        std::cerr << "got counter " << counter << ", expected "
+                  << s.window.oldest() << std::endl;
+        self->send(s.responder, quit_atom::value);
+        self->stop();
+        self->quit();
+        return;
+      }
       s.received_messages += 1;
       if (s.received_messages % 100 == 0)
         std::cerr << "got " << s.received_messages << std::endl;
-      if (s.received_messages >= s.messages) {
+      if (s.window.done()) {
         std::cerr << "got all messages!" << std::endl;
+        s.window.report(std::cerr);
+        report_busy_poll(*self->trans);
+        bench::write_csv(s.window.latency(), s.histogram_out);
         self->send(s.responder, quit_atom::value);
         self->stop();
         self->quit();
       } else {
-        auto whdl = self->wr_buf(nullptr);
-        binary_serializer bs(&self->backend(), *whdl.buf);
-        bs(counter + 1);
+        while (s.window.can_send()) {
+          auto whdl = self->wr_buf(nullptr);
+          binary_serializer bs(&self->backend(), *whdl.buf);
+          bs(s.window.send());
+        }
       }
     },
     [=](io_error_msg& msg) {
@@ -160,6 +210,15 @@ public:
   std::string host = "127.0.0.1";
   bool is_server = false;
   size_t messages = 2000;
+  size_t window = 1;
+  std::string histogram_out;
+  std::string multiplexer;
+  std::string pin_io;
+  std::string pin_workers;
+  int numa_node = -1;
+  bool use_uring = false;
+  size_t busy_poll_us = 0;
+  int so_busy_poll_us = 0;
   bool traditional = false;
 
   config() {
@@ -168,12 +227,37 @@ public:
     .add(host, "host,H", "set host")
     .add(is_server, "server,s", "set server")
     .add(messages, "messages,m", "set number of exchanged messages")
+    .add(window, "window,w", "set number of messages in flight (client)")
+    .add(histogram_out, "histogram-out", "write latency percentiles as CSV")
+    .add(multiplexer, "multiplexer", "check multiplexer (epoll, poll)")
+    .add(pin_io, "pin-io", "pin the multiplexer thread to CPUs, e.g., 0-1,4")
+    .add(pin_workers, "pin-workers", "pin all other threads to CPUs")
+    .add(numa_node, "numa-node", "default to the CPUs of this NUMA node")
+    .add(use_uring, "uring,U", "use io_uring transports")
+    .add(busy_poll_us, "busy-poll", "spin this many us before blocking")
+    .add(so_busy_poll_us, "so-busy-poll", "set SO_BUSY_POLL to this many us")
     .add(traditional, "traditional,t", "use traditional style brokers");
   }
 };
 
 void caf_main(actor_system& sys, const config& cfg) {
+  if (!bench::check_multiplexer(cfg.multiplexer, "pingpong_tcp"))
+    return;
+  bench::placement placement;
+  if (!placement.init(cfg.pin_io, cfg.pin_workers, cfg.numa_node)
+      || !placement.apply(sys))
+    return;
+  placement.print(std::cerr);
+#ifndef NEWB_HAVE_LIBURING
+  if (cfg.use_uring) {
+    std::cerr << "built without liburing, io_uring is not available"
+              << std::endl;
+    return;
+  }
+#endif
   using namespace std::chrono;
+  auto spin = microseconds(cfg.busy_poll_us);
+  auto use_busy_poll = cfg.busy_poll_us > 0 || cfg.so_busy_poll_us > 0;
   using proto_t = tcp_protocol<raw>;
   //using acceptor_t = tcp_acceptor<proto_t>;
   const char* host = cfg.host.c_str();
@@ -191,6 +275,13 @@ void caf_main(actor_system& sys, const config& cfg) {
     if (cfg.is_server) {
       std::cerr << "creating server" << std::endl;
       accept_ptr<policy::new_raw_msg> pol{new accept_tcp<policy::new_raw_msg>};
+      if (use_busy_poll)
+        pol.reset(new accept_tcp_busy_poll<policy::new_raw_msg>(
+          spin, cfg.so_busy_poll_us));
+#ifdef NEWB_HAVE_LIBURING
+      if (cfg.use_uring)
+        pol.reset(new accept_tcp_uring<policy::new_raw_msg>);
+#endif
       auto eserver = make_server<proto_t>(sys, raw_server, std::move(pol), port,
                                          nullptr, true, self);
       if (!eserver) {
@@ -205,6 +296,12 @@ void caf_main(actor_system& sys, const config& cfg) {
     } else {
       std::cerr << "creating client" << std::endl;
       transport_ptr pol{new tcp_transport};
+      if (use_busy_poll)
+        pol.reset(new busy_poll<tcp_transport>(spin, cfg.so_busy_poll_us));
+#ifdef NEWB_HAVE_LIBURING
+      if (cfg.use_uring)
+        pol.reset(new tcp_uring_transport);
+#endif
       auto eclient = spawn_client<proto_t>(sys, raw_client, std::move(pol),
                                            host, port);
       if (!eclient) {
@@ -215,6 +312,7 @@ void caf_main(actor_system& sys, const config& cfg) {
       auto client = std::move(*eclient);
       auto start = system_clock::now();
       self->send(client, start_atom::value, size_t(cfg.messages),
+                 size_t(cfg.window), cfg.histogram_out,
                  actor_cast<actor>(self));
       await_done("done");
       auto end = system_clock::now();
@@ -233,6 +331,7 @@ void caf_main(actor_system& sys, const config& cfg) {
       auto ec = sys.middleman().spawn_client(tcp_client, host, port);
       auto start = system_clock::now();
       self->send(*ec, start_atom::value, size_t(cfg.messages),
+                 size_t(cfg.window), cfg.histogram_out,
                  actor_cast<actor>(self));
       await_done("done");
       auto end = system_clock::now();
@@ -9,6 +9,15 @@
 #include "caf/policy/newb_reliability.hpp"
 #include "caf/policy/newb_udp.hpp"
 
+#include "fused_stack.hpp"
+#include "multiplexer_backend.hpp"
+#include "pipeline_window.hpp"
+#include "placement.hpp"
+#include "sack_reliability.hpp"
+#include "udp_mmsg_transport.hpp"
+#include "uring_transport.hpp"
+#include "write_arena.hpp"
+
 using namespace caf;
 using namespace caf::io;
 using namespace caf::io::network;
@@ -27,10 +36,14 @@ struct state {
   caf::io::connection_handle other;
   size_t messages = 0;
   uint32_t received_messages = 0;
+  bench::counter_filter filter;
+  bench::pipeline_window window;
+  std::string histogram_out;
 };
 
 behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
   self->state.responder = responder;
+  presize_buffers(*self->trans);
   return {
     [=](atom_value atm, uint32_t id) {
       self->proto->timeout(atm, id);
@@ -39,9 +52,12 @@ behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
       uint32_t counter;
       binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
       bd(counter);
-      if (counter != self->state.received_messages) {
+      // Echo every counter once, they may arrive out of order if the client
+      // keeps more than one in flight. `sack_reliability` drops duplicates
+      // before they get here, `reliability` passes retransmissions up again.
+      if (!self->state.filter.insert(counter)) {
         //std::cerr << "dropping msg: " << counter
-        //          << " (was expecting: " << self->state.received_messages << ")"
+        //          << " (was expecting: " << self->state.filter.next() << ")"
         //          << std::endl;
         return;
       }
@@ -65,42 +81,52 @@ behavior raw_server(stateful_newb<new_raw_msg, state>* self, actor responder) {
 }
 
 behavior raw_client(stateful_newb<new_raw_msg, state>* self) {
+  presize_buffers(*self->trans);
   return {
     [=](atom_value atm, uint32_t id) {
       self->proto->timeout(atm, id);
     },
-    [=](start_atom, size_t messages, actor responder) {
+    [=](start_atom, size_t messages, size_t window,
+        const std::string& histogram_out, actor responder) {
       auto& s = self->state;
       s.responder = responder;
+      s.histogram_out = histogram_out;
       s.messages = messages;
-      auto whdl = self->wr_buf(nullptr);
-      binary_serializer bs(&self->backend(), *whdl.buf);
-      bs(uint32_t(0));
+      s.window.reset(window, messages);
+      while (s.window.can_send()) {
+        auto whdl = self->wr_buf(nullptr);
+        binary_serializer bs(&self->backend(), *whdl.buf);
+        bs(s.window.send());
+      }
     },
     [=](new_raw_msg& msg) {
       auto& s = self->state;
       uint32_t counter;
       binary_deserializer bd(self->system(), msg.payload, msg.payload_len);
       bd(counter);
-      if (counter != s.received_messages) {
+      // Only `reliability` lets duplicate echoes through.
+      if (!s.window.receive(counter)) {
         //std::cerr << "dropping message: " << counter
-        //          << " (was expecting: " << s.received_messages << ")"
+        //          << " (was expecting: " << s.window.oldest() << ")"
         //          << std::endl;
         return;
       }
       s.received_messages += 1;
       if (s.received_messages % 100 == 0)
         std::cerr << "got " << s.received_messages << std::endl;
-      if (s.received_messages >= s.messages) {
+      if (s.window.done()) {
         std::cerr << "got all messages!" << std::endl;
+        s.window.report(std::cerr);
+        bench::write_csv(s.window.latency(), s.histogram_out);
         self->delayed_send(self, std::chrono::milliseconds(500),
                            quit_atom::value);
         self->send(self->state.responder, quit_atom::value);
       } else {
-        auto whdl = self->wr_buf(nullptr);
-        binary_serializer bs(&self->backend(), *whdl.buf);
-        counter += 1;
-        bs(counter);
+        while (s.window.can_send()) {
+          auto whdl = self->wr_buf(nullptr);
+          binary_serializer bs(&self->backend(), *whdl.buf);
+          bs(s.window.send());
+        }
       }
     },
     [=](io_error_msg& msg) {
@@ -118,96 +144,143 @@ behavior raw_client(stateful_newb<new_raw_msg, state>* self) {
 class config : public actor_system_config {
 public:
   size_t messages = 2000;
+  size_t window = 1;
+  std::string histogram_out;
+  std::string multiplexer;
+  std::string pin_io;
+  std::string pin_workers;
+  int numa_node = -1;
   std::string host = "127.0.0.1";
   uint16_t port = 12345;
   bool is_server = false;
   bool is_ordered = false;
+  bool use_mmsg = false;
+  bool use_uring = false;
+  bool use_sack = false;
+  bool use_fused = false;
 
   config() {
     opt_group{custom_options_, "global"}
-    .add(messages,   "messages,m", "set number of exchanged messages")
-    .add(host,       "host,H",     "set host")
-    .add(port,       "port,P",     "set port")
-    .add(is_ordered, "ordered,o",  "use ordered UDP")
-    .add(is_server,  "server,s",   "set server");
+    .add(messages,      "messages,m",    "set number of exchanged messages")
+    .add(window,        "window,w",      "set messages in flight (client)")
+    .add(histogram_out, "histogram-out", "write latency percentiles as CSV")
+    .add(multiplexer,   "multiplexer",   "check multiplexer (epoll, poll)")
+    .add(pin_io,        "pin-io",        "pin the multiplexer thread to CPUs")
+    .add(pin_workers,   "pin-workers",   "pin all other threads to CPUs")
+    .add(numa_node,     "numa-node",     "default to the CPUs of this node")
+    .add(host,          "host,H",        "set host")
+    .add(port,          "port,P",        "set port")
+    .add(is_ordered,    "ordered,o",     "use ordered UDP")
+    .add(use_mmsg,      "mmsg,M",        "batch datagrams via sendmmsg (client)")
+    .add(use_uring,     "uring,U",       "use an io_uring transport (client)")
+    .add(use_sack,      "sack,S",        "use selective ACKs for reliability")
+    .add(use_fused,     "fused,F",       "fuse all layers into one")
+    .add(is_server,     "server,s",      "set server");
   }
 };
 
-void caf_main(actor_system& sys, const config& cfg) {
+template <class Protocol>
+void run_server(actor_system& sys, const config& cfg, scoped_actor& self) {
+  std::cerr << "creating server" << std::endl;
+  accept_ptr<policy::new_raw_msg> pol{new accept_udp<policy::new_raw_msg>};
+  auto eserver = make_server<Protocol>(sys, raw_server, std::move(pol),
+                                       cfg.port, nullptr, true, self);
+  if (!eserver) {
+    std::cerr << "failed to start server on port " << cfg.port << std::endl;
+    return;
+  }
+  auto server = std::move(*eserver);
+  self->receive([&](quit_atom) { std::cerr << "done" << std::endl; });
+  std::cerr << "stopping server" << std::endl;
+  server->stop();
+}
+
+template <class Protocol>
+void run_client(actor_system& sys, const config& cfg, scoped_actor& self) {
   using namespace std::chrono;
-  using proto_t = udp_protocol<reliability<policy::raw>>;
-  using ordered_proto_t = udp_protocol<reliability<ordering<policy::raw>>>;
-  const char* host = cfg.host.c_str();
-  const uint16_t port = cfg.port;
-  scoped_actor self{sys};
+  std::cerr << "creating client" << std::endl;
+  transport_ptr pol;
+  if (cfg.use_mmsg)
+    pol.reset(new udp_mmsg_transport);
+#ifdef NEWB_HAVE_LIBURING
+  else if (cfg.use_uring)
+    pol.reset(new udp_uring_transport);
+#endif
+  else
+    pol.reset(new udp_transport);
+  auto eclient = spawn_client<Protocol>(sys, raw_client, std::move(pol),
+                                        cfg.host.c_str(), cfg.port);
+  if (!eclient) {
+    std::cerr << "failed to start client for " << cfg.host << ":" << cfg.port
+              << std::endl;
+    return;
+  }
+  auto client = std::move(*eclient);
   auto await_done = [&](std::string msg) {
     self->receive([&](quit_atom) { std::cerr << msg << std::endl; });
   };
-  if (cfg.is_server) {
-    std::cerr << "creating server" << std::endl;
-    accept_ptr<policy::new_raw_msg> pol{new accept_udp<policy::new_raw_msg>};
-    if (cfg.is_ordered) {
-      auto eserver = make_server<ordered_proto_t>(sys, raw_server, std::move(pol),
-                                                  port, nullptr, true, self);
-      if (!eserver) {
-        std::cerr << "failed to start server on port " << port << std::endl;
-        return;
-      }
-      auto server = std::move(*eserver);
-      await_done("done");
-      std::cerr << "stopping server" << std::endl;
-      server->stop();
-    } else {
-      auto eserver = make_server<proto_t>(sys, raw_server, std::move(pol), port,
-                                          nullptr, true, self);
-      if (!eserver) {
-        std::cerr << "failed to start server on port " << port << std::endl;
-        return;
-      }
-      auto server = std::move(*eserver);
-      await_done("done");
-      std::cerr << "stopping server" << std::endl;
-      server->stop();
-    }
+  auto start = system_clock::now();
+  self->send(client, start_atom::value, size_t(cfg.messages),
+             size_t(cfg.window), cfg.histogram_out, actor_cast<actor>(self));
+  await_done("done");
+  auto end = system_clock::now();
+  std::cout << duration_cast<milliseconds>(end - start).count() << "ms"
+            << std::endl;
+  await_done("done");
+}
+
+template <class Protocol>
+void run(actor_system& sys, const config& cfg) {
+  scoped_actor self{sys};
+  if (cfg.is_server)
+    run_server<Protocol>(sys, cfg, self);
+  else
+    run_client<Protocol>(sys, cfg, self);
+}
+
+void caf_main(actor_system& sys, const config& cfg) {
+  if (!bench::check_multiplexer(cfg.multiplexer, "pingpong_udp"))
+    return;
+  bench::placement placement;
+  if (!placement.init(cfg.pin_io, cfg.pin_workers, cfg.numa_node)
+      || !placement.apply(sys))
+    return;
+  placement.print(std::cerr);
+#ifndef NEWB_HAVE_LIBURING
+  if (cfg.use_uring) {
+    std::cerr << "built without liburing, io_uring is not available"
+              << std::endl;
+    return;
+  }
+#endif
+  using proto_t = udp_protocol<reliability<policy::raw>>;
+  using ordered_proto_t = udp_protocol<reliability<ordering<policy::raw>>>;
+  using sack_proto_t = udp_protocol<sack_reliability<policy::raw>>;
+  using ordered_sack_proto_t
+    = udp_protocol<sack_reliability<ordering<policy::raw>>>;
+  // `sack_reliability` has no fused stage, it runs on top of the stack.
+  using fused_t = fused<fused_raw, fused_ordering>;
+  using fused_proto_t
+    = udp_protocol<fused<fused_raw, fused_reliability, fused_ordering>>;
+  using fused_sack_proto_t = udp_protocol<sack_reliability<fused_t>>;
+  if (cfg.use_fused && !cfg.is_ordered) {
+    std::cerr << "--fused requires --ordered" << std::endl;
+    return;
+  }
+  if (cfg.use_sack) {
+    if (cfg.use_fused)
+      run<fused_sack_proto_t>(sys, cfg);
+    else if (cfg.is_ordered)
+      run<ordered_sack_proto_t>(sys, cfg);
+    else
+      run<sack_proto_t>(sys, cfg);
   } else {
-    std::cerr << "creating client" << std::endl;
-    transport_ptr pol{new udp_transport};
-    if (cfg.is_ordered) {
-      auto eclient = spawn_client<ordered_proto_t>(sys, raw_client, std::move(pol),
-                                                   host, port);
-      if (!eclient) {
-        std::cerr << "failed to start client for " << host << ":" << port
-                  << std::endl;
-        return;
-      }
-      auto client = std::move(*eclient);
-      auto start = system_clock::now();
-      self->send(client, start_atom::value, size_t(cfg.messages),
-                 actor_cast<actor>(self));
-      await_done("done");
-      auto end = system_clock::now();
-      std::cout << duration_cast<milliseconds>(end - start).count() << "ms"
-                << std::endl;
-      //self->send(client, exit_reason::user_shutdown);
-    } else {
-      auto eclient = spawn_client<proto_t>(sys, raw_client, std::move(pol), host,
-                                           port);
-      if (!eclient) {
-        std::cerr << "failed to start client for " << host << ":" << port
-                  << std::endl;
-        return;
-      }
-      auto client = std::move(*eclient);
-      auto start = system_clock::now();
-      self->send(client, start_atom::value, size_t(cfg.messages),
-                 actor_cast<actor>(self));
-      await_done("done");
-      auto end = system_clock::now();
-      std::cout << duration_cast<milliseconds>(end - start).count() << "ms"
-                << std::endl;
-      await_done("done");
-      //self->send(client, exit_reason::user_shutdown);
-    }
+    if (cfg.use_fused)
+      run<fused_proto_t>(sys, cfg);
+    else if (cfg.is_ordered)
+      run<ordered_proto_t>(sys, cfg);
+    else
+      run<proto_t>(sys, cfg);
   }
   std::abort();
 }
@@ -0,0 +1,194 @@
+#ifndef PIPELINE_WINDOW_HPP
+#define PIPELINE_WINDOW_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "latency_histogram.hpp"
+#include "ring_buffer.hpp"
+
+namespace bench {
+
+/// Keeps up to `window` counters in flight for the ping-pong clients. Every
+/// counter is time stamped when sent, its echo completes it and records one
+/// round trip in a `latency_histogram`. Counters complete in order, echoes
+/// that arrive ahead of an older counter are counted as reordered. The run
+/// starts with `reset` and ends when the last counter completes.
+class pipeline_window {
+public:
+  using clock_type = std::chrono::steady_clock;
+  using duration = clock_type::duration;
+
+  pipeline_window()
+    : window_(1),
+      messages_(0),
+      first_(0),
+      next_(0),
+      base_(0),
+      completed_(0),
+      reordered_(0) {
+    // nop
+  }
+
+  /// Starts a new run with counters `first`, `first + 1`, ...
+  void reset(size_t window, size_t messages, uint32_t first = 0) {
+    window_ = std::max(window, size_t{1});
+    messages_ = messages;
+    first_ = first;
+    next_ = first;
+    base_ = first;
+    completed_ = 0;
+    reordered_ = 0;
+    latency_.clear();
+    inflight_.clear();
+    start_ = clock_type::now();
+    end_ = start_;
+  }
+
+  // -- sending ----------------------------------------------------------------
+
+  /// Returns whether the window allows sending another counter.
+  bool can_send() const {
+    return inflight_.size() < window_ && next_ - first_ < messages_;
+  }
+
+  /// Returns the next counter and records its send time.
+  uint32_t send() {
+    inflight_.push_back(entry{clock_type::now(), false});
+    return next_++;
+  }
+
+  // -- receiving --------------------------------------------------------------
+
+  /// Completes `counter`. Returns `false` for duplicates and counters that
+  /// were never sent.
+  bool receive(uint32_t counter) {
+    auto idx = static_cast<size_t>(counter - base_);
+    if (idx >= inflight_.size() || inflight_[idx].done)
+      return false;
+    if (idx != 0)
+      reordered_ += 1;
+    latency_.record(clock_type::now() - inflight_[idx].sent);
+    inflight_[idx].done = true;
+    completed_ += 1;
+    if (completed_ == messages_)
+      end_ = clock_type::now();
+    while (!inflight_.empty() && inflight_.front().done) {
+      inflight_.pop_front();
+      base_ += 1;
+    }
+    return true;
+  }
+
+  /// Returns the oldest counter still in flight.
+  uint32_t oldest() const {
+    return base_;
+  }
+
+  bool done() const {
+    return completed_ >= messages_;
+  }
+
+  // -- statistics -------------------------------------------------------------
+
+  size_t window() const {
+    return window_;
+  }
+
+  size_t completed() const {
+    return completed_;
+  }
+
+  size_t reordered() const {
+    return reordered_;
+  }
+
+  /// Returns the round-trip times of all completed counters.
+  const latency_histogram& latency() const {
+    return latency_;
+  }
+
+  /// Returns the time between `reset` and the last completion, or until now
+  /// if the run is still going.
+  duration elapsed() const {
+    return (done() ? end_ : clock_type::now()) - start_;
+  }
+
+  /// Prints throughput and the latency summary as `key=value` pairs on a
+  /// single line.
+  void report(std::ostream& out) const {
+    using std::chrono::duration_cast;
+    auto elapsed = this->elapsed();
+    auto secs = std::chrono::duration<double>(elapsed).count();
+    out << "window=" << window_
+        << " messages=" << completed_
+        << " elapsed_ms="
+        << duration_cast<std::chrono::milliseconds>(elapsed).count()
+        << " msgs_per_s=" << (secs > 0 ? completed_ / secs : 0.0)
+        << " reordered=" << reordered_ << ' ';
+    latency_.print(out);
+    out << std::endl;
+  }
+
+private:
+  struct entry {
+    clock_type::time_point sent;
+    bool done;
+  };
+
+  size_t window_;
+  size_t messages_;
+  uint32_t first_;
+  uint32_t next_;
+  uint32_t base_;
+  size_t completed_;
+  size_t reordered_;
+  latency_histogram latency_;
+  clock_type::time_point start_;
+  clock_type::time_point end_;
+  caf::policy::ring_buffer<entry> inflight_;
+};
+
+/// Filters duplicates from a stream of counters that may arrive out of
+/// order, used by the UDP servers to echo each counter exactly once.
+class counter_filter {
+public:
+  /// Counters further ahead than this are considered garbage.
+  static constexpr uint32_t max_gap = 1u << 20;
+
+  counter_filter() : base_(0) {
+    // nop
+  }
+
+  /// Returns `true` if `counter` has not been seen before.
+  bool insert(uint32_t counter) {
+    auto idx = counter - base_;
+    if (idx >= max_gap)
+      return false;
+    while (seen_.size() <= idx)
+      seen_.push_back(0);
+    if (seen_[idx] != 0)
+      return false;
+    seen_[idx] = 1;
+    while (!seen_.empty() && seen_.front() != 0) {
+      seen_.pop_front();
+      base_ += 1;
+    }
+    return true;
+  }
+
+  /// Returns the lowest counter not seen yet.
+  uint32_t next() const {
+    return base_;
+  }
+
+private:
+  uint32_t base_;
+  caf::policy::ring_buffer<char> seen_;
+};
+
+} // namespace bench
+
+#endif // PIPELINE_WINDOW_HPP
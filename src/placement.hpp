@@ -0,0 +1,192 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "caf/actor_system.hpp"
+#include "caf/io/middleman.hpp"
+#include "caf/io/network/multiplexer.hpp"
+
+namespace bench {
+
+/// Parses a CPU list in the format the kernel uses in sysfs, e.g., "0-3,6".
+inline bool parse_cpu_list(const std::string& str, std::vector<int>& cpus) {
+  cpus.clear();
+  std::istringstream in{str};
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    if (range.empty())
+      continue;
+    char* end = nullptr;
+    auto first = std::strtol(range.c_str(), &end, 10);
+    auto last = first;
+    if (*end == '-')
+      last = std::strtol(end + 1, &end, 10);
+    if (*end != '\0' && *end != '\n')
+      return false;
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for (auto cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(static_cast<int>(cpu));
+  }
+  return !cpus.empty();
+}
+
+/// Formats `cpus` as comma-separated list, "-" if empty.
+inline std::string format_cpu_list(const std::vector<int>& cpus) {
+  if (cpus.empty())
+    return "-";
+  std::string result;
+  for (auto cpu : cpus) {
+    if (!result.empty())
+      result += ',';
+    result += std::to_string(cpu);
+  }
+  return result;
+}
+
+/// Returns the CPUs of a NUMA node, empty if the node does not exist.
+inline std::vector<int> numa_node_cpus(int node) {
+  std::vector<int> result;
+  std::ifstream in{"/sys/devices/system/node/node" + std::to_string(node)
+                   + "/cpulist"};
+  std::string line;
+  if (in && std::getline(in, line))
+    parse_cpu_list(line, result);
+  return result;
+}
+
+/// Returns the kernel's ID for the calling thread.
+inline pid_t current_thread_id() {
+  return static_cast<pid_t>(::syscall(SYS_gettid));
+}
+
+/// Returns the IDs of all threads in this process.
+inline std::vector<pid_t> process_threads() {
+  std::vector<pid_t> result;
+  auto dir = ::opendir("/proc/self/task");
+  if (dir == nullptr)
+    return result;
+  while (auto entry = ::readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      result.push_back(static_cast<pid_t>(std::atoi(entry->d_name)));
+  }
+  ::closedir(dir);
+  return result;
+}
+
+/// Restricts thread `tid` to `cpus`.
+inline bool pin_thread(pid_t tid, const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus)
+    CPU_SET(cpu, &set);
+  if (::sched_setaffinity(tid, sizeof(set), &set) != 0) {
+    std::cerr << "cannot pin thread " << tid << " to "
+              << format_cpu_list(cpus) << ": " << std::strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// Returns the ID of the thread running the multiplexer of `sys`. Newbs run
+/// their handlers on this thread.
+inline pid_t multiplexer_thread(caf::actor_system& sys) {
+  std::promise<pid_t> tid;
+  auto result = tid.get_future();
+  sys.middleman().backend().post([&] {
+    tid.set_value(current_thread_id());
+  });
+  return result.get();
+}
+
+/// Where the threads of a benchmark run. The I/O thread is the multiplexer
+/// thread or, for benchmarks without CAF networking, the thread doing the
+/// system calls. All other threads, such as the scheduler workers, share
+/// the worker CPUs. Threads are pinned after they started, allocations they
+/// make from then on land on the NUMA node of their CPUs.
+struct placement {
+  std::vector<int> io_cpus;
+  std::vector<int> worker_cpus;
+  int numa_node = -1;
+  pid_t io_thread = 0;
+
+  /// Reads the placement from config options. A NUMA node provides the
+  /// default for lists that are not given. Returns `false` and prints an
+  /// error if an option is invalid.
+  bool init(const std::string& io, const std::string& workers, int node) {
+    numa_node = node;
+    std::vector<int> node_cpus;
+    if (node >= 0) {
+      node_cpus = numa_node_cpus(node);
+      if (node_cpus.empty()) {
+        std::cerr << "unknown NUMA node: " << node << std::endl;
+        return false;
+      }
+    }
+    auto read = [&](const std::string& str, const char* name,
+                    std::vector<int>& cpus) {
+      if (str.empty()) {
+        cpus = node_cpus;
+        return true;
+      }
+      if (parse_cpu_list(str, cpus))
+        return true;
+      std::cerr << "invalid CPU list for " << name << ": " << str
+                << std::endl;
+      return false;
+    };
+    return read(io, "I/O thread", io_cpus)
+           && read(workers, "workers", worker_cpus);
+  }
+
+  bool empty() const {
+    return io_cpus.empty() && worker_cpus.empty();
+  }
+
+  /// Pins all threads of this process to the worker CPUs, except for
+  /// `io_tid`, which goes to the I/O CPUs.
+  bool apply(pid_t io_tid) {
+    io_thread = io_tid;
+    auto ok = true;
+    if (!worker_cpus.empty())
+      for (auto tid : process_threads())
+        if (tid != io_tid)
+          ok = pin_thread(tid, worker_cpus) && ok;
+    if (!io_cpus.empty())
+      ok = pin_thread(io_tid, io_cpus) && ok;
+    return ok;
+  }
+
+  /// Pins the multiplexer thread of `sys` to the I/O CPUs.
+  bool apply(caf::actor_system& sys) {
+    return apply(multiplexer_thread(sys));
+  }
+
+  /// Prints the placement as `key=value` pairs on a single line.
+  void print(std::ostream& out) const {
+    out << "placement io_cpus=" << format_cpu_list(io_cpus)
+        << " worker_cpus=" << format_cpu_list(worker_cpus)
+        << " numa_node=" << numa_node
+        << " io_thread=" << io_thread << std::endl;
+  }
+};
+
+} // namespace bench
+
+#endif // PLACEMENT_HPP
@@ -15,6 +15,10 @@
 #include <netdb.h>
 #include <netinet/tcp.h>
 
+#include "busy_poll.hpp"
+#include "pipeline_window.hpp"
+#include "placement.hpp"
+
 using namespace caf;
 using namespace std;
 using namespace std::chrono;
@@ -27,6 +31,13 @@ public:
   std::string host = "127.0.0.1";
   bool is_server = false;
   uint32_t messages = 10000;
+  size_t window = 1;
+  std::string histogram_out;
+  std::string pin_io;
+  std::string pin_workers;
+  int numa_node = -1;
+  size_t busy_poll_us = 0;
+  int so_busy_poll_us = 0;
   bool traditional = false;
 
   config() {
@@ -35,6 +46,13 @@ public:
     .add(host, "host,H", "set host")
     .add(is_server, "server,s", "set server")
     .add(messages, "messages,m", "set number of exchanged messages")
+    .add(window, "window,w", "set number of messages in flight (client)")
+    .add(histogram_out, "histogram-out", "write latency percentiles as CSV")
+    .add(pin_io, "pin-io", "pin the socket thread to CPUs, e.g., 0-1,4")
+    .add(pin_workers, "pin-workers", "pin all other threads to CPUs")
+    .add(numa_node, "numa-node", "default to the CPUs of this NUMA node")
+    .add(busy_poll_us, "busy-poll", "spin this many us before blocking")
+    .add(so_busy_poll_us, "so-busy-poll", "set SO_BUSY_POLL to this many us")
     .add(traditional, "traditional,t", "use traditional style brokers");
   }
 };
@@ -46,8 +64,51 @@ void tcp_nodelay(int fd, bool new_value) {
              static_cast<unsigned>(sizeof(flag)));
 }
 
+void so_busy_poll(int fd, int usecs) {
+  if (usecs <= 0)
+    return;
+#ifdef SO_BUSY_POLL
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0)
+    std::cerr << "cannot set SO_BUSY_POLL: " << strerror(errno) << std::endl;
+#else
+  std::cerr << "SO_BUSY_POLL is not available" << std::endl;
+#endif
+}
+
+// Reads like `recv`, but spins on non-blocking reads for up to `interval`
+// before blocking. Counts hits and misses like `policy::busy_poll`.
+ssize_t spin_recv(int fd, void* buf, size_t len, microseconds interval,
+                  policy::busy_poll_stats& stats) {
+  if (interval.count() == 0)
+    return recv(fd, buf, len, 0);
+  auto n = recv(fd, buf, len, MSG_DONTWAIT);
+  if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+    return n;
+  auto deadline = steady_clock::now() + interval;
+  do {
+    policy::busy_poll<policy::tcp_transport>::relax();
+    stats.spins += 1;
+    n = recv(fd, buf, len, MSG_DONTWAIT);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      stats.hits += 1;
+      return n;
+    }
+  } while (steady_clock::now() < deadline);
+  stats.misses += 1;
+  return recv(fd, buf, len, 0);
+}
+
 void caf_main(actor_system& sys, const config& cfg) {
+  // All socket calls happen on this thread.
+  bench::placement placement;
+  if (!placement.init(cfg.pin_io, cfg.pin_workers, cfg.numa_node)
+      || !placement.apply(bench::current_thread_id()))
+    return;
+  placement.print(std::cerr);
   const size_t buf_size = 256;
+  auto spin = microseconds(cfg.busy_poll_us);
+  auto use_busy_poll = cfg.busy_poll_us > 0 || cfg.so_busy_poll_us > 0;
+  policy::busy_poll_stats stats;
   if (!cfg.is_server) {
     const char* host = cfg.host.c_str();
     const uint16_t port = cfg.port;
@@ -77,28 +138,65 @@ void caf_main(actor_system& sys, const config& cfg) {
       return;
     }
     tcp_nodelay(sockfd, true);
-    auto start = system_clock::now();
-    while (received_messages < cfg.messages) {
+    so_busy_poll(sockfd, cfg.so_busy_poll_us);
+    bench::pipeline_window window;
+    window.reset(cfg.window, cfg.messages);
+    // Tops up the window, echoes are checked in order as they come in.
+    auto send_window = [&]() -> bool {
       send_buf.clear();
       binary_serializer bs(sys, send_buf);
-      bs(received_messages);
+      while (window.can_send())
+        bs(window.send());
+      if (send_buf.empty())
+        return true;
       n = write(sockfd, send_buf.data(), send_buf.size());
       if (n < 0) {
         std::cerr << "ERROR writing to socket: " << strerror(errno) << std::endl;
-        return;
+        return false;
       }
-      n = read(sockfd, recv_buf.data(), recv_buf.size());
-      if (n < 0) {
-        std::cerr << "ERROR reading from socket: " << strerror(errno) << std::endl;
+      return true;
+    };
+    size_t pending = 0;
+    auto start = system_clock::now();
+    if (!send_window())
+      return;
+    while (!window.done()) {
+      n = spin_recv(sockfd, recv_buf.data() + pending,
+                    recv_buf.size() - pending, spin, stats);
+      if (n <= 0) {
+        std::cerr << "ERROR reading from socket: "
+                  << (n < 0 ? strerror(errno) : "connection closed")
+                  << std::endl;
         return;
       }
-      received_messages += 1;
-      if (received_messages % 100 == 0)
-        std::cerr << "got " << received_messages << std::endl;
+      pending += static_cast<size_t>(n);
+      size_t pos = 0;
+      for (; pending - pos >= sizeof(uint32_t); pos += sizeof(uint32_t)) {
+        uint32_t counter;
+        binary_deserializer bd(sys, recv_buf.data() + pos, sizeof(uint32_t));
+        bd(counter);
+        if (counter != window.oldest() || !window.receive(counter)) {
+          std::cerr << "ERROR got counter " << counter << ", expected "
+                    << window.oldest() << std::endl;
+          return;
+        }
+        received_messages += 1;
+        if (received_messages % 100 == 0)
+          std::cerr << "got " << received_messages << std::endl;
+      }
+      // Keep a partial counter for the next read.
+      memmove(recv_buf.data(), recv_buf.data() + pos, pending - pos);
+      pending -= pos;
+      if (!send_window())
+        return;
     }
     std::cout << "got all messages!" << std::endl;
     auto end = system_clock::now();
     std::cout << duration_cast<milliseconds>(end - start).count() << "ms" << std::endl;
+    window.report(std::cerr);
+    if (use_busy_poll)
+      stats.print(std::cerr);
+    bench::write_csv(window.latency(), cfg.histogram_out);
     close(sockfd);
   } else {
     const char* host = "0.0.0.0";
@@ -134,8 +232,10 @@ void caf_main(actor_system& sys, const config& cfg) {
         close(socket_fd);
         exit(2);
       }
+      so_busy_poll(accept_fd, cfg.so_busy_poll_us);
+      stats = policy::busy_poll_stats{};
       for (;;) {
-        num_bytes = recv(accept_fd, data_buffer, buf_size, 0);
+        num_bytes = spin_recv(accept_fd, data_buffer, buf_size, spin, stats);
         if (num_bytes == 0) {
           std::cerr << "client shut down" << std::endl;
           break;
@@ -149,6 +249,8 @@ void caf_main(actor_system& sys, const config& cfg) {
           break;
         }
       }
+      if (use_busy_poll)
+        stats.print(std::cerr);
       close(accept_fd);
     }
     close(socket_fd);
@@ -0,0 +1,362 @@
+#ifndef REORDER_BUFFER_HPP
+#define REORDER_BUFFER_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "caf/io/newb.hpp"
+#include "caf/policy/newb_ordering.hpp"
+
+#include "header_codec.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Holds messages that arrived ahead of the next expected sequence number.
+/// Slots form a circular array indexed by the lower bits of the sequence
+/// number and an occupancy bitmap marks which slots hold a message, so
+/// finding the messages that are ready is a scan over 64 slots per step.
+/// Slots keep their storage, after warming up storing a message does not
+/// allocate. The capacity is fixed, which caps memory at `capacity` times
+/// the largest message.
+class reorder_buffer {
+public:
+  /// Classification of an incoming sequence number.
+  enum result {
+    /// Next in line, deliver right away.
+    in_order,
+    /// Ahead of the next expected message but within capacity.
+    early,
+    /// Further ahead than the buffer can hold.
+    overflow,
+    /// Before the next expected message, already delivered or skipped.
+    late,
+    /// Already waiting in the buffer.
+    duplicate
+  };
+
+  /// Creates a buffer for at least `capacity` messages, rounded up to a
+  /// power of two between 64 and half the sequence number space.
+  explicit reorder_buffer(size_t capacity = 64) : next_(0), size_(0) {
+    size_t cap = 64;
+    while (cap < capacity && cap < max_capacity)
+      cap <<= 1;
+    slots_.resize(cap);
+    bits_.resize(cap / 64);
+    mask_ = cap - 1;
+  }
+
+  // -- properties -------------------------------------------------------------
+
+  /// Returns the next expected sequence number.
+  sequence_type next() const {
+    return next_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t capacity() const {
+    return slots_.size();
+  }
+
+  /// Returns the sequence number of the first waiting message. Requires a
+  /// non-empty buffer.
+  sequence_type first() const {
+    return static_cast<sequence_type>(next_ + find_set());
+  }
+
+  result classify(sequence_type seq) const {
+    auto dist = static_cast<sequence_type>(seq - next_);
+    if (dist == 0)
+      return in_order;
+    if (dist >= half_space)
+      return late;
+    if (dist >= slots_.size())
+      return overflow;
+    return test(index(seq)) ? duplicate : early;
+  }
+
+  // -- modifiers --------------------------------------------------------------
+
+  /// Advances past a message that was delivered without being stored.
+  void advance() {
+    next_ += 1;
+  }
+
+  /// Stores a copy of an early message.
+  void store(sequence_type seq, const char* data, size_t size) {
+    auto i = index(seq);
+    slots_[i].assign(data, data + size);
+    bits_[i / 64] |= uint64_t{1} << (i % 64);
+    size_ += 1;
+  }
+
+  /// Hands all messages that are now in line to `f` in order and advances
+  /// past them. Stops at the first error `f` returns.
+  template <class F>
+  error release(F f) {
+    while (size_ > 0 && test(index(next_))) {
+      auto i = index(next_);
+      // Take all consecutive messages of this word at once.
+      auto run = count_ones(bits_[i / 64] >> (i % 64));
+      for (size_t k = 0; k < run; ++k) {
+        auto j = i + k;
+        bits_[j / 64] &= ~(uint64_t{1} << (j % 64));
+        size_ -= 1;
+        next_ += 1;
+        if (auto err = f(slots_[j].data(), slots_[j].size()))
+          return err;
+      }
+    }
+    return none;
+  }
+
+  /// Gives up on the missing messages before the first waiting one.
+  /// Returns how many sequence numbers were skipped.
+  size_t skip_gap() {
+    if (size_ == 0)
+      return 0;
+    auto gap = find_set();
+    next_ += static_cast<sequence_type>(gap);
+    return gap;
+  }
+
+  /// Continues at `seq` with an empty buffer.
+  void reset(sequence_type seq) {
+    for (auto& word : bits_)
+      word = 0;
+    size_ = 0;
+    next_ = seq;
+  }
+
+private:
+  static constexpr size_t half_space = size_t{1} << (8 * sizeof(sequence_type)
+                                                     - 1);
+  static constexpr size_t max_capacity = half_space;
+
+  size_t index(sequence_type seq) const {
+    return seq & mask_;
+  }
+
+  bool test(size_t i) const {
+    return (bits_[i / 64] >> (i % 64)) & 1;
+  }
+
+  /// Returns the number of consecutive set bits from the lowest bit on.
+  static size_t count_ones(uint64_t word) {
+    if (~word == 0)
+      return 64;
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctzll(~word));
+#else
+    size_t n = 0;
+    for (; (word & 1) != 0; word >>= 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  /// Returns the number of the lowest set bit, 64 if none.
+  static size_t lowest_set(uint64_t word) {
+    if (word == 0)
+      return 64;
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctzll(word));
+#else
+    size_t n = 0;
+    for (; (word & 1) == 0; word >>= 1)
+      ++n;
+    return n;
+#endif
+  }
+
+  /// Returns the distance from `next_` to the first occupied slot. Requires
+  /// a non-empty buffer.
+  size_t find_set() const {
+    auto start = index(next_);
+    auto word = start / 64;
+    auto bit = start % 64;
+    // The first word only counts from `bit` on, it comes up again at the
+    // end of the scan for the slots before `bit`.
+    auto pos = lowest_set(bits_[word] >> bit);
+    if (pos < 64 - bit)
+      return pos;
+    auto dist = 64 - bit;
+    for (size_t n = 1; n <= bits_.size(); ++n) {
+      auto w = bits_[(word + n) % bits_.size()];
+      if (w != 0)
+        return dist + lowest_set(w);
+      dist += 64;
+    }
+    return dist;
+  }
+
+  sequence_type next_;
+  size_t size_;
+  size_t mask_;
+  std::vector<std::vector<char>> slots_;
+  std::vector<uint64_t> bits_;
+};
+
+/// What `reorder<Next>` does with a message that is too far ahead to fit
+/// into its buffer.
+enum class reorder_overflow {
+  /// Give up on the oldest gaps until the message fits, like `ordering<Next>`
+  /// does once more than `middleman.max-pending-messages` are waiting.
+  skip,
+  /// Keep waiting for the gap and drop the message. The sender has to send
+  /// it again, e.g., after a retransmission timeout.
+  backpressure
+};
+
+/// Drop-in replacement for `ordering<Next>` with the same header on the
+/// wire. Early messages wait in a `reorder_buffer` instead of a `std::map`,
+/// with `middleman.reorder-capacity` slots (default 64). The option
+/// `middleman.reorder-overflow` selects the `reorder_overflow` policy,
+/// either "skip" (default) or "backpressure". A single timeout of
+/// `pending_to` per gap bounds the wait for missing messages.
+///
+/// Below `sack_reliability`, whose receive window of 32 datagrams is smaller
+/// than the capacity, the buffer never overflows.
+template <class Next>
+struct reorder {
+  using message_type = typename Next::message_type;
+  using result_type = typename Next::result_type;
+  using timeout_atom = atom_constant<atom("reorder")>;
+
+  reorder(io::network::newb<message_type>* parent)
+    : parent(parent),
+      next(parent),
+      buf(get_or(parent->system().config(), "middleman.reorder-capacity",
+                 size_t{64})),
+      on_overflow(get_or(parent->system().config(),
+                         "middleman.reorder-overflow", std::string{"skip"})
+                      == "backpressure"
+                    ? reorder_overflow::backpressure
+                    : reorder_overflow::skip),
+      seq_write(0),
+      pending_to(std::chrono::milliseconds(100)),
+      timer_armed(false),
+      skipped(0),
+      refused(0),
+      dropped(0) {
+    // nop
+  }
+
+  // -- receiving --------------------------------------------------------------
+
+  error read(char* bytes, size_t count) {
+    if (count < ordering_header_len)
+      return sec::unexpected_message;
+    ordering_header hdr;
+    header_codec<ordering_header>::decode(bytes, hdr);
+    auto payload = bytes + ordering_header_len;
+    auto len = count - ordering_header_len;
+    switch (buf.classify(hdr.seq_num)) {
+      case reorder_buffer::in_order:
+        buf.advance();
+        if (auto err = next.read(payload, len))
+          return err;
+        return release();
+      case reorder_buffer::early:
+        buf.store(hdr.seq_num, payload, len);
+        arm_timeout();
+        return none;
+      case reorder_buffer::overflow:
+        if (on_overflow == reorder_overflow::backpressure) {
+          refused += 1;
+          return none;
+        }
+        while (buf.classify(hdr.seq_num) == reorder_buffer::overflow) {
+          if (buf.empty()) {
+            skipped += static_cast<sequence_type>(hdr.seq_num - buf.next());
+            buf.reset(hdr.seq_num);
+            break;
+          }
+          skipped += buf.skip_gap();
+          if (auto err = release())
+            return err;
+        }
+        return read(bytes, count);
+      default:
+        dropped += 1;
+        return none;
+    }
+  }
+
+  error release() {
+    return buf.release([&](char* bytes, size_t count) {
+      return next.read(bytes, count);
+    });
+  }
+
+  // -- timeouts ---------------------------------------------------------------
+
+  /// Waits at most `pending_to` for the gap in front of the first waiting
+  /// message, the timeout carries its sequence number.
+  void arm_timeout() {
+    if (timer_armed || buf.empty())
+      return;
+    timer_armed = true;
+    parent->set_timeout(pending_to, timeout_atom::value,
+                        static_cast<uint32_t>(buf.first()));
+  }
+
+  error timeout(atom_value atm, uint32_t id) {
+    if (atm != timeout_atom::value)
+      return next.timeout(atm, id);
+    timer_armed = false;
+    // Give up on the gap if it is still there, otherwise a newer gap gets its
+    // own timeout.
+    if (!buf.empty() && buf.first() == static_cast<sequence_type>(id)) {
+      skipped += buf.skip_gap();
+      if (auto err = release())
+        return err;
+    }
+    arm_timeout();
+    return none;
+  }
+
+  // -- sending ----------------------------------------------------------------
+
+  void write_header(io::network::byte_buffer& buf,
+                    io::network::header_writer* hw) {
+    append_header(buf, ordering_header{seq_write++});
+    next.write_header(buf, hw);
+  }
+
+  void prepare_for_sending(io::network::byte_buffer& buf, size_t hstart,
+                           size_t offset, size_t plen) {
+    next.prepare_for_sending(buf, hstart, offset + ordering_header_len, plen);
+  }
+
+  // -- member variables -------------------------------------------------------
+
+  io::network::newb<message_type>* parent;
+  Next next;
+  reorder_buffer buf;
+  reorder_overflow on_overflow;
+  sequence_type seq_write;
+  std::chrono::milliseconds pending_to;
+  bool timer_armed;
+
+  // Statistics: sequence numbers given up on, messages dropped for lack of
+  // space and late or duplicate messages.
+  size_t skipped;
+  size_t refused;
+  size_t dropped;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // REORDER_BUFFER_HPP
@@ -0,0 +1,125 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace caf {
+namespace policy {
+
+/// FIFO queue on top of a contiguous array with power-of-two capacity. The
+/// storage is allocated once at construction, pushing and popping only move
+/// two indexes. If a push finds the ring full, the capacity doubles. This is
+/// the only path that allocates and it should never be taken in steady state
+/// when the initial capacity fits the workload.
+template <class T>
+class ring_buffer {
+public:
+  explicit ring_buffer(size_t capacity = 64)
+    : head_(0),
+      size_(0) {
+    size_t cap = 1;
+    while (cap < capacity)
+      cap <<= 1;
+    buf_.resize(cap);
+    mask_ = cap - 1;
+  }
+
+  // -- properties -------------------------------------------------------------
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  bool full() const {
+    return size_ == buf_.size();
+  }
+
+  size_t capacity() const {
+    return buf_.size();
+  }
+
+  // -- element access ---------------------------------------------------------
+
+  /// Returns the `i`-th element counted from the front.
+  T& operator[](size_t i) {
+    return buf_[(head_ + i) & mask_];
+  }
+
+  const T& operator[](size_t i) const {
+    return buf_[(head_ + i) & mask_];
+  }
+
+  T& front() {
+    return buf_[head_];
+  }
+
+  const T& front() const {
+    return buf_[head_];
+  }
+
+  T& back() {
+    return (*this)[size_ - 1];
+  }
+
+  const T& back() const {
+    return (*this)[size_ - 1];
+  }
+
+  // -- modifiers --------------------------------------------------------------
+
+  void push_back(T x) {
+    if (full())
+      grow();
+    buf_[(head_ + size_) & mask_] = std::move(x);
+    size_ += 1;
+  }
+
+  void pop_front() {
+    head_ = (head_ + 1) & mask_;
+    size_ -= 1;
+  }
+
+  /// Drops the first `n` elements.
+  void pop_front(size_t n) {
+    head_ = (head_ + n) & mask_;
+    size_ -= n;
+  }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  void swap(ring_buffer& other) {
+    buf_.swap(other.buf_);
+    std::swap(head_, other.head_);
+    std::swap(size_, other.size_);
+    std::swap(mask_, other.mask_);
+  }
+
+private:
+  void grow() {
+    std::vector<T> tmp(buf_.size() * 2);
+    for (size_t i = 0; i < size_; ++i)
+      tmp[i] = std::move((*this)[i]);
+    buf_.swap(tmp);
+    head_ = 0;
+    mask_ = buf_.size() - 1;
+  }
+
+  std::vector<T> buf_;
+  size_t head_;
+  size_t size_;
+  size_t mask_;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // RING_BUFFER_HPP
@@ -0,0 +1,424 @@
+#ifndef SACK_RELIABILITY_HPP
+#define SACK_RELIABILITY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include "caf/io/newb.hpp"
+#include "caf/logger.hpp"
+#include "caf/meta/type_name.hpp"
+
+#include "header_codec.hpp"
+#include "ring_buffer.hpp"
+#include "timer_wheel.hpp"
+
+namespace caf {
+namespace policy {
+
+using sack_atom = atom_constant<atom("sack")>;
+
+/// Header for `sack_reliability`. Every datagram carries the acknowledgement
+/// state of its sender: `ack` is cumulative (all sequence numbers below have
+/// been received) and bit `i` of `sack_bits` acknowledges `ack + 1 + i`.
+struct sack_header {
+  uint32_t seq;
+  uint32_t ack;
+  uint32_t sack_bits;
+  uint8_t flags;
+
+  static constexpr uint8_t data_flag = 0x01;
+};
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& fun, sack_header& hdr) {
+  return fun(meta::type_name("sack_header"), hdr.seq, hdr.ack, hdr.sack_bits,
+             hdr.flags);
+}
+
+constexpr size_t sack_header_len = 3 * sizeof(uint32_t) + sizeof(uint8_t);
+
+template <>
+struct header_codec<sack_header> {
+  static constexpr size_t size = sack_header_len;
+
+  static void encode(char* out, const sack_header& hdr) {
+    store_be(out, hdr.seq);
+    store_be(out + 4, hdr.ack);
+    store_be(out + 8, hdr.sack_bits);
+    store_be(out + 12, hdr.flags);
+  }
+
+  static void decode(const char* in, sack_header& hdr) {
+    hdr.seq = load_be<uint32_t>(in);
+    hdr.ack = load_be<uint32_t>(in + 4);
+    hdr.sack_bits = load_be<uint32_t>(in + 8);
+    hdr.flags = load_be<uint8_t>(in + 12);
+  }
+};
+
+/// Reliability layer with a sliding window, cumulative plus selective
+/// acknowledgements and a single retransmission timer for all unacknowledged
+/// datagrams. The retransmission timeout adapts to RTT samples as described
+/// in RFC 6298. Acknowledgements piggyback on outgoing data where possible,
+/// a pure ACK is only sent if the application did not write anything while
+/// handling the received message.
+///
+/// At most `window` datagrams are in flight, the receiver could not track
+/// more. Datagrams written while the window is full wait in the layer and go
+/// out as acknowledgements open it again. Their bytes are already in the
+/// buffer of the transport at that point, the layer replaces them with a
+/// pure ACK, so the transport never sees an empty chunk.
+///
+/// The layer can be used instead of `reliability<Next>`. Timers live in a
+/// `timer_wheel` that advances on every read, at most one `(sack_atom,
+/// uint32_t)` message for the earliest deadline sits in the mailbox. These
+/// messages must be forwarded to `proto->timeout` just like the timeouts of
+/// `reliability<Next>`.
+///
+/// Retransmissions whose original arrived after all produce duplicates. The
+/// receive window already records which datagrams arrived, so the layer
+/// drops duplicates before they reach `Next` and counts them in
+/// `duplicates`. Setting `middleman.sack-suppress-duplicates` to `false`
+/// passes them up like `reliability<Next>` does.
+template <class Next>
+struct sack_reliability {
+  using message_type = typename Next::message_type;
+  using result_type = typename Next::result_type;
+  using clock_type = std::chrono::steady_clock;
+  using duration = std::chrono::microseconds;
+
+  /// The receiver can track this many datagrams beyond the cumulative ACK.
+  static constexpr uint32_t window = 32;
+
+  /// Number of selectively acknowledged successors that trigger a fast
+  /// retransmit of a missing datagram.
+  static constexpr uint32_t dup_threshold = 3;
+
+  struct unacked_entry {
+    io::network::byte_buffer data;
+    clock_type::time_point sent;
+    uint32_t retransmissions = 0;
+    bool acked = false;
+  };
+
+  sack_reliability(io::network::newb<message_type>* parent)
+    : parent(parent),
+      next(parent),
+      snd_una(0),
+      snd_next(0),
+      rcv_next(0),
+      rcv_bits(0),
+      ack_pending(false),
+      timers(std::chrono::milliseconds(1)),
+      rto_timer(0),
+      wakeup(timer_wheel::time_point::max()),
+      wakeup_id(0),
+      srtt(0),
+      rttvar(0),
+      rto(std::chrono::milliseconds(40)),
+      min_rto(std::chrono::milliseconds(5)),
+      max_rto(std::chrono::seconds(1)),
+      unacked(window * 2),
+      suppress_duplicates(get_or(parent->system().config(),
+                                 "middleman.sack-suppress-duplicates", true)),
+      retransmitted(0),
+      duplicates(0) {
+    // nop
+  }
+
+  // -- receiving --------------------------------------------------------------
+
+  error read(char* bytes, size_t count) {
+    if (count < sack_header_len)
+      return sec::unexpected_message;
+    advance_timers();
+    sack_header hdr;
+    header_codec<sack_header>::decode(bytes, hdr);
+    handle_ack(hdr.ack, hdr.sack_bits);
+    if ((hdr.flags & sack_header::data_flag) == 0)
+      return none;
+    if (suppress_duplicates && received(hdr.seq)) {
+      // Acknowledge again, our ACK may have been lost.
+      duplicates += 1;
+      send_ack();
+      return none;
+    }
+    if (!accept(hdr.seq)) {
+      // Outside of our window, the sender will retransmit it.
+      return none;
+    }
+    // Writing anything while the next layer handles the message carries the
+    // acknowledgement, otherwise we send a pure ACK afterwards.
+    ack_pending = true;
+    auto err = next.read(bytes + sack_header_len, count - sack_header_len);
+    if (ack_pending)
+      send_ack();
+    return err;
+  }
+
+  /// Returns whether `seq` arrived before, i.e., it is below `rcv_next` or
+  /// marked in the receive window.
+  bool received(uint32_t seq) const {
+    auto dist = static_cast<int32_t>(seq - rcv_next);
+    if (dist < 0)
+      return true;
+    if (dist == 0 || static_cast<uint32_t>(dist) > window)
+      return false;
+    return ((rcv_bits >> (dist - 1)) & 1) != 0;
+  }
+
+  /// Records `seq` in the receive window. Returns `false` if `seq` is too
+  /// far ahead to be tracked.
+  bool accept(uint32_t seq) {
+    auto dist = static_cast<int32_t>(seq - rcv_next);
+    if (dist < 0) {
+      // Already received, acknowledge again in case our ACK got lost.
+      return true;
+    }
+    if (dist == 0) {
+      rcv_next += 1;
+      while ((rcv_bits & 1) != 0) {
+        rcv_bits >>= 1;
+        rcv_next += 1;
+      }
+      rcv_bits >>= 1;
+      return true;
+    }
+    if (static_cast<uint32_t>(dist) > window)
+      return false;
+    rcv_bits |= uint32_t{1} << (dist - 1);
+    return true;
+  }
+
+  void send_ack() {
+    ack_pending = false;
+    auto& buf = parent->trans->wr_buf();
+    append_header(buf, sack_header{0, rcv_next, rcv_bits, 0});
+    parent->trans->flush(parent);
+  }
+
+  // -- acknowledgements -------------------------------------------------------
+
+  void handle_ack(uint32_t ack, uint32_t bits) {
+    auto now = clock_type::now();
+    auto acked_any = false;
+    // Cumulative part.
+    while (!unacked.empty() && static_cast<int32_t>(ack - snd_una) > 0) {
+      auto& entry = unacked.front();
+      if (!entry.acked)
+        sample_rtt(entry, now);
+      unacked.pop_front();
+      snd_una += 1;
+      acked_any = true;
+    }
+    // Selective part.
+    auto highest_sacked = size_t{0};
+    for (uint32_t i = 0; bits != 0 && i < window; ++i, bits >>= 1) {
+      if ((bits & 1) == 0)
+        continue;
+      auto idx = static_cast<int32_t>(ack + 1 + i - snd_una);
+      if (idx < 0 || static_cast<size_t>(idx) >= unacked.size())
+        continue;
+      auto& entry = unacked[static_cast<size_t>(idx)];
+      if (!entry.acked) {
+        sample_rtt(entry, now);
+        entry.acked = true;
+        acked_any = true;
+      }
+      highest_sacked = std::max(highest_sacked, static_cast<size_t>(idx));
+    }
+    while (!unacked.empty() && unacked.front().acked) {
+      unacked.pop_front();
+      snd_una += 1;
+    }
+    send_held(now);
+    // Fast retransmit for holes with enough acknowledged successors.
+    if (highest_sacked >= dup_threshold) {
+      auto limit = std::min(highest_sacked + 1, unacked.size());
+      for (size_t i = 0; i + dup_threshold < limit; ++i) {
+        auto& entry = unacked[i];
+        if (!entry.acked && entry.retransmissions == 0)
+          retransmit(entry, now);
+      }
+    }
+    if (acked_any)
+      restart_timer();
+  }
+
+  /// Updates SRTT, RTTVAR and RTO as described in RFC 6298. Skips datagrams
+  /// that were retransmitted (Karn's algorithm).
+  void sample_rtt(const unacked_entry& entry, clock_type::time_point now) {
+    if (entry.retransmissions > 0)
+      return;
+    auto r = std::chrono::duration_cast<duration>(now - entry.sent);
+    if (srtt.count() == 0) {
+      srtt = r;
+      rttvar = r / 2;
+    } else {
+      auto err = srtt > r ? srtt - r : r - srtt;
+      rttvar = (3 * rttvar + err) / 4;
+      srtt = (7 * srtt + r) / 8;
+    }
+    rto = std::min(std::max(srtt + 4 * rttvar, min_rto), max_rto);
+  }
+
+  // -- retransmission ---------------------------------------------------------
+
+  void retransmit(unacked_entry& entry, clock_type::time_point now) {
+    auto& buf = parent->trans->wr_buf();
+    buf.insert(buf.end(), entry.data.begin(), entry.data.end());
+    parent->trans->flush(parent);
+    entry.sent = now;
+    entry.retransmissions += 1;
+    retransmitted += 1;
+  }
+
+  void restart_timer() {
+    timers.cancel(rto_timer);
+    rto_timer = 0;
+    if (unacked.empty())
+      return;
+    auto deadline = clock_type::now() + rto;
+    rto_timer = timers.arm(deadline, 0);
+    schedule_wakeup(deadline);
+  }
+
+  /// Makes sure a timeout message arrives no later than `deadline`. Later
+  /// deadlines are covered by the message already in flight, which re-arms
+  /// itself for the next expiry of the wheel. The message is due at the tick
+  /// boundary where `advance` fires the timer, arriving any earlier would
+  /// only schedule another wakeup.
+  void schedule_wakeup(timer_wheel::time_point deadline) {
+    deadline = timers.round_up(deadline);
+    if (deadline >= wakeup)
+      return;
+    wakeup = deadline;
+    wakeup_id += 1;
+    auto delay = std::max(deadline - clock_type::now(),
+                          timer_wheel::duration::zero());
+    auto us = std::chrono::duration_cast<duration>(delay);
+    if (us < delay)
+      us += duration{1};
+    parent->set_timeout(us, sack_atom::value, wakeup_id);
+  }
+
+  void advance_timers() {
+    timers.advance(clock_type::now(), [&](uint64_t) { on_rto(); });
+  }
+
+  /// Retransmits everything that has been waiting for at least one RTO,
+  /// starting with the oldest datagram, and backs off.
+  void on_rto() {
+    rto_timer = 0;
+    auto now = clock_type::now();
+    for (size_t i = 0; i < unacked.size(); ++i) {
+      auto& entry = unacked[i];
+      if (!entry.acked && (i == 0 || now - entry.sent >= rto))
+        retransmit(entry, now);
+    }
+    rto = std::min(rto * 2, max_rto);
+    restart_timer();
+  }
+
+  error timeout(atom_value atm, uint32_t id) {
+    if (atm != sack_atom::value)
+      return next.timeout(atm, id);
+    // Messages for an earlier wakeup than the current one are stale.
+    if (id != wakeup_id)
+      return none;
+    wakeup = timer_wheel::time_point::max();
+    advance_timers();
+    if (!timers.empty())
+      schedule_wakeup(timers.next_expiry());
+    return none;
+  }
+
+  // -- sending ----------------------------------------------------------------
+
+  void write_header(io::network::byte_buffer& buf,
+                    io::network::header_writer* hw) {
+    append_header(buf, sack_header{snd_next, rcv_next, rcv_bits,
+                                   sack_header::data_flag});
+    ack_pending = false;
+    next.write_header(buf, hw);
+  }
+
+  void prepare_for_sending(io::network::byte_buffer& buf, size_t hstart,
+                           size_t offset, size_t plen) {
+    next.prepare_for_sending(buf, hstart, offset + sack_header_len, plen);
+    snd_next += 1;
+    if (unacked.size() >= window || !held.empty()) {
+      held.emplace_back(buf.begin() + hstart, buf.end());
+      buf.resize(hstart);
+      append_header(buf, sack_header{0, rcv_next, rcv_bits, 0});
+      return;
+    }
+    unacked_entry entry;
+    entry.data.assign(buf.begin() + hstart, buf.end());
+    entry.sent = clock_type::now();
+    unacked.push_back(std::move(entry));
+    if (rto_timer == 0)
+      restart_timer();
+  }
+
+  /// Sends held datagrams as long as the window allows, with the current
+  /// acknowledgement state in their headers.
+  void send_held(clock_type::time_point now) {
+    while (!held.empty() && unacked.size() < window) {
+      auto seq = snd_una + static_cast<uint32_t>(unacked.size());
+      unacked_entry entry;
+      entry.data = std::move(held.front());
+      held.pop_front();
+      header_codec<sack_header>::encode(entry.data.data(),
+                                        sack_header{seq, rcv_next, rcv_bits,
+                                                    sack_header::data_flag});
+      auto& buf = parent->trans->wr_buf();
+      buf.insert(buf.end(), entry.data.begin(), entry.data.end());
+      parent->trans->flush(parent);
+      entry.sent = now;
+      unacked.push_back(std::move(entry));
+    }
+  }
+
+  // -- member variables -------------------------------------------------------
+
+  io::network::newb<message_type>* parent;
+  Next next;
+
+  // Sender state, `unacked[i]` holds datagram `snd_una + i` and `held[i]`
+  // datagram `snd_una + unacked.size() + i`.
+  uint32_t snd_una;
+  uint32_t snd_next;
+  std::deque<io::network::byte_buffer> held;
+
+  // Receiver state, bit `i` of `rcv_bits` is datagram `rcv_next + 1 + i`.
+  uint32_t rcv_next;
+  uint32_t rcv_bits;
+  bool ack_pending;
+
+  // Retransmission timer, `wakeup` is the deadline of the timeout message
+  // currently in flight.
+  timer_wheel timers;
+  timer_wheel::handle rto_timer;
+  timer_wheel::time_point wakeup;
+  uint32_t wakeup_id;
+  duration srtt;
+  duration rttvar;
+  duration rto;
+  duration min_rto;
+  duration max_rto;
+
+  ring_buffer<unacked_entry> unacked;
+  bool suppress_duplicates;
+
+  // Statistics: datagrams sent again and duplicates dropped on arrival.
+  size_t retransmitted;
+  size_t duplicates;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // SACK_RELIABILITY_HPP
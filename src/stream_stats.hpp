@@ -0,0 +1,154 @@
+#ifndef STREAM_STATS_HPP
+#define STREAM_STATS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+namespace bench {
+
+/// Returns the CPU time all threads of the process used so far, in user and
+/// kernel mode.
+inline std::chrono::microseconds process_cpu_time() {
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return std::chrono::microseconds::zero();
+  auto to_us = [](const timeval& tv) {
+    return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+  };
+  return std::chrono::microseconds(to_us(usage.ru_utime)
+                                   + to_us(usage.ru_stime));
+}
+
+/// Counters of a one-way stream for the streaming benchmarks. The sender
+/// counts what it writes and samples the bytes waiting in its transport, the
+/// receiver reports what arrived. `print` covers the time since its last
+/// call, `summary` the whole run since `start`, including the CPU time the
+/// process used meanwhile.
+class stream_stats {
+public:
+  using clock_type = std::chrono::steady_clock;
+
+  stream_stats()
+    : cpu_started_(0),
+      cpu_last_(0),
+      backlog_(0),
+      max_backlog_(0) {
+    // nop
+  }
+
+  void start(clock_type::time_point now) {
+    started_ = now;
+    last_ = now;
+    cpu_started_ = process_cpu_time();
+    cpu_last_ = cpu_started_;
+    interval_ = counters{};
+    total_ = counters{};
+    backlog_ = 0;
+    max_backlog_ = 0;
+  }
+
+  void on_sent(size_t bytes) {
+    interval_.sent_msgs += 1;
+    interval_.sent_bytes += bytes;
+  }
+
+  void on_delivered(uint64_t msgs, uint64_t bytes) {
+    interval_.delivered_msgs += msgs;
+    interval_.delivered_bytes += bytes;
+  }
+
+  /// Records the bytes waiting in the transport.
+  void sample_backlog(size_t bytes) {
+    backlog_ = bytes;
+    max_backlog_ = std::max(max_backlog_, bytes);
+  }
+
+  /// Prints the rates since the last call as `key=value` pairs without a
+  /// line break, so callers can append their own, and starts a new interval.
+  void print(std::ostream& out, clock_type::time_point now) {
+    auto secs = std::chrono::duration<double>(now - last_).count();
+    out << "t_ms=" << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        now - started_).count()
+        << " sent_mbps=" << mbps(interval_.sent_bytes, secs)
+        << " goodput_mbps=" << mbps(interval_.delivered_bytes, secs)
+        << " sent_per_s=" << per_second(interval_.sent_msgs, secs)
+        << " delivered_per_s=" << per_second(interval_.delivered_msgs, secs)
+        << " backlog_kb=" << backlog_ / 1024.0
+        << " max_backlog_kb=" << max_backlog_ / 1024.0;
+    total_.sent_msgs += interval_.sent_msgs;
+    total_.sent_bytes += interval_.sent_bytes;
+    total_.delivered_msgs += interval_.delivered_msgs;
+    total_.delivered_bytes += interval_.delivered_bytes;
+    interval_ = counters{};
+    max_backlog_ = backlog_;
+    last_ = now;
+    cpu_last_ = process_cpu_time();
+  }
+
+  /// Prints the rates of the run up to the last `print` as `key=value`
+  /// pairs on a single line. `cpu_ms` is the CPU time of the whole process,
+  /// `cpu_share` relates it to the elapsed time, i.e., 1.0 is a core busy
+  /// for the whole run.
+  void summary(std::ostream& out, size_t chunk_size) const {
+    auto secs = std::chrono::duration<double>(last_ - started_).count();
+    auto cpu = std::chrono::duration<double>(cpu_last_ - cpu_started_);
+    out << "final chunk_size=" << chunk_size
+        << " elapsed_ms=" << std::chrono::duration_cast<
+                               std::chrono::milliseconds>(last_ - started_)
+                               .count()
+        << " sent=" << total_.sent_msgs
+        << " delivered=" << total_.delivered_msgs
+        << " msgs_per_s=" << per_second(total_.delivered_msgs, secs)
+        << " bytes_per_s=" << per_second(total_.delivered_bytes, secs)
+        << " goodput_mbps=" << mbps(total_.delivered_bytes, secs)
+        << " cpu_ms=" << cpu.count() * 1000
+        << " cpu_share=" << (secs > 0 ? cpu.count() / secs : 0.0)
+        << std::endl;
+  }
+
+private:
+  struct counters {
+    uint64_t sent_msgs = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t delivered_msgs = 0;
+    uint64_t delivered_bytes = 0;
+  };
+
+  static double per_second(uint64_t n, double secs) {
+    return secs > 0 ? n / secs : 0.0;
+  }
+
+  static double mbps(uint64_t bytes, double secs) {
+    return per_second(bytes, secs) * 8 / 1e6;
+  }
+
+  clock_type::time_point started_;
+  clock_type::time_point last_;
+  std::chrono::microseconds cpu_started_;
+  std::chrono::microseconds cpu_last_;
+  counters interval_;
+  counters total_;
+  size_t backlog_;
+  size_t max_backlog_;
+};
+
+/// Chunk sizes for sweeps of the streaming benchmarks, powers of two from
+/// `first` to `last`. Defaults to 128 B to 64 KiB.
+inline std::vector<size_t> sweep_sizes(size_t first = 128,
+                                       size_t last = 65536) {
+  std::vector<size_t> result;
+  for (auto size = first; size <= last; size *= 2)
+    result.push_back(size);
+  return result;
+}
+
+} // namespace bench
+
+#endif // STREAM_STATS_HPP
@@ -0,0 +1,412 @@
+#ifndef TCP_VECTORED_TRANSPORT_HPP
+#define TCP_VECTORED_TRANSPORT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <limits.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+#include "caf/io/newb.hpp"
+#include "caf/logger.hpp"
+#include "caf/policy/newb_tcp.hpp"
+
+#include "ring_buffer.hpp"
+#include "write_arena.hpp"
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)                             \
+  && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define NEWB_HAVE_ZEROCOPY
+#endif
+
+namespace caf {
+namespace policy {
+
+/// Counters of a `tcp_vectored_transport` in zero-copy mode. The kernel
+/// falls back to copying if it cannot send from the pages directly, e.g.,
+/// for loopback connections, and reports this in the completion.
+struct zerocopy_stats {
+  size_t sends = 0;
+  size_t completions = 0;
+  size_t copied = 0;
+
+  /// Prints the counters as `key=value` pairs on a single line.
+  void print(std::ostream& out) const {
+    out << "zerocopy sends=" << sends
+        << " completions=" << completions
+        << " copied=" << copied << std::endl;
+  }
+};
+
+/// TCP transport that writes with `sendmsg` instead of `send`. Besides the
+/// bytes written via `wr_buf`, messages can refer to payloads the
+/// application owns with `write_external`. A single `sendmsg` call hands the
+/// kernel the headers from the send buffer and the payloads where they are,
+/// so the payload is never copied into the send buffer. Reading works like
+/// `tcp_transport`.
+///
+/// Layers that store the payload length in their header compute it from the
+/// bytes written via `wr_buf`, which excludes external payloads. This suits
+/// layers without a length field, such as `raw`, or applications that write
+/// the length themselves.
+///
+/// In zero-copy mode, writes of at least `zerocopy_threshold` bytes use
+/// `MSG_ZEROCOPY` and the kernel does not copy them either. It reads the
+/// memory until it confirms the send via the error queue of the socket, so
+/// the send buffer and the owners of external payloads stay in flight until
+/// then and the arena gets a spare buffer instead. The multiplexer must never
+/// see the error queue as the only event on the socket, it would treat it as
+/// an error. Once all data went out but confirmations are missing, the
+/// transport therefore parks the socket: it leaves the multiplexer entirely
+/// and calls `schedule_recheck` with a delay and an ID. Its owner calls
+/// `recheck` with that ID after the delay, usually from a timeout of the
+/// newb. Each recheck harvests the confirmations and doubles the delay up to
+/// `max_recheck_delay` until all sends are confirmed, then the socket resumes
+/// reading. New writes end the wait right away. Reads are delayed while
+/// parked, at most by the time the confirmations take. Without a
+/// `schedule_recheck`, the transport stays registered for write events
+/// instead and harvests on each of them, which keeps the I/O thread busy
+/// while the confirmations are underway. If the socket does not support
+/// `SO_ZEROCOPY`, the transport falls back to copying.
+struct tcp_vectored_transport : public tcp_transport {
+  using byte_buffer = io::network::byte_buffer;
+  using newb_base = io::network::newb_base;
+  using rw_state = io::network::rw_state;
+  using native_socket = io::network::native_socket;
+  using owner_list = std::vector<std::shared_ptr<const void>>;
+  using recheck_fun = std::function<void(std::chrono::microseconds, uint32_t)>;
+
+#ifdef IOV_MAX
+  static constexpr size_t default_max_segments = IOV_MAX;
+#else
+  static constexpr size_t default_max_segments = 1024;
+#endif
+
+  /// A send buffer and the external payloads the kernel may still read.
+  struct in_flight {
+    uint32_t last_send;
+    byte_buffer buf;
+    owner_list owners;
+  };
+
+  explicit tcp_vectored_transport(bool zerocopy = false,
+                                  size_t max_segments = default_max_segments)
+    : max_segments(max_segments),
+      zerocopy(zerocopy),
+      zerocopy_threshold(8192),
+      configured(false),
+      send_zerocopy(false),
+      next_send(0),
+      in_flight_bufs(16),
+      parked(false),
+      recheck_id(0),
+      recheck_delay(0),
+      min_recheck_delay(50),
+      max_recheck_delay(1000) {
+    arena.reserve(offline_buffer, send_buffer);
+    iovs.reserve(max_segments);
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  rw_state write_some(newb_base* parent) override {
+    CAF_LOG_TRACE(CAF_ARG(arena.chunks()));
+    if (!configured)
+      configure(parent->fd());
+    if (!in_flight_bufs.empty() && reap_completions(parent->fd()) < 0)
+      return rw_state::failure;
+    if (arena.empty())
+      prepare_next_write(parent);
+    if (!writing || arena.empty())
+      return rw_state::success;
+    iovs.clear();
+    size_t total = 0;
+    arena.gather(send_buffer, arena.chunks(),
+                 [&](size_t, const char* data, size_t len) -> bool {
+                   iovec iov;
+                   iov.iov_base = const_cast<char*>(data);
+                   iov.iov_len = len;
+                   iovs.push_back(iov);
+                   total += len;
+                   return iovs.size() < max_segments;
+                 });
+    msghdr msg;
+    memset(&msg, 0, sizeof(msghdr));
+    msg.msg_iov = iovs.data();
+    msg.msg_iovlen = iovs.size();
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+#ifdef NEWB_HAVE_ZEROCOPY
+    auto use_zerocopy = zerocopy && total >= zerocopy_threshold;
+    if (use_zerocopy)
+      flags |= MSG_ZEROCOPY;
+#endif
+    auto sres = ::sendmsg(parent->fd(), &msg, flags);
+    if (sres < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return rw_state::success;
+      CAF_LOG_ERROR("sendmsg failed:" << CAF_ARG(errno));
+      return rw_state::failure;
+    }
+#ifdef NEWB_HAVE_ZEROCOPY
+    if (use_zerocopy) {
+      // The kernel numbers zero-copy sends per socket, starting at 0.
+      send_zerocopy = true;
+      next_send += 1;
+      stats.sends += 1;
+    }
+#endif
+    // The kernel may take only part of the data, the rest goes out with the
+    // next write event.
+    arena.consume_bytes(static_cast<size_t>(sres));
+    if (arena.empty())
+      prepare_next_write(parent);
+    return rw_state::success;
+  }
+
+  void prepare_next_write(newb_base* parent) override {
+    // Owners of payloads that were copied can go right away.
+    if (send_zerocopy)
+      retire_send_buffer();
+    else
+      retired.clear();
+    if (arena.swap(offline_buffer, send_buffer))
+      return;
+    if (in_flight_bufs.empty()) {
+      parent->stop_writing();
+      writing = false;
+    } else if (schedule_recheck) {
+      park(parent);
+    }
+  }
+
+  byte_buffer& wr_buf() override {
+    arena.mark(offline_buffer);
+    return offline_buffer;
+  }
+
+  void flush(newb_base* parent) override {
+    if (arena.pending(offline_buffer) && !writing) {
+      unpark(parent);
+      parent->start_writing();
+      writing = true;
+      prepare_next_write(parent);
+    }
+  }
+
+  /// Appends `size` bytes at `data` to the stream without copying them and
+  /// flushes. `owner` keeps the payload alive until it has been sent.
+  void write_external(newb_base* parent, const char* data, size_t size,
+                      std::shared_ptr<const void> owner) {
+    arena.append_external(offline_buffer, data, size, std::move(owner));
+    flush(parent);
+  }
+
+  void write_external(newb_base* parent,
+                      std::shared_ptr<const byte_buffer> payload) {
+    auto data = payload->data();
+    auto size = payload->size();
+    write_external(parent, data, size, std::move(payload));
+  }
+
+  /// Returns the bytes waiting to be written, including external payloads.
+  size_t backlog() const {
+    return arena.backlog(offline_buffer);
+  }
+
+  // -- zero-copy --------------------------------------------------------------
+
+  void configure(native_socket fd) {
+    configured = true;
+    if (!zerocopy)
+      return;
+#ifdef NEWB_HAVE_ZEROCOPY
+    int on = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0) {
+      arena.retire_to(&retired);
+      return;
+    }
+    CAF_LOG_ERROR("cannot set SO_ZEROCOPY:" << CAF_ARG(errno));
+#else
+    static_cast<void>(fd);
+    CAF_LOG_ERROR("MSG_ZEROCOPY is not available");
+#endif
+    zerocopy = false;
+  }
+
+  /// Removes the socket from the multiplexer until all sends are confirmed.
+  void park(newb_base* parent) {
+    parent->stop_writing();
+    writing = false;
+    if (!parked) {
+      parent->stop_reading();
+      parked = true;
+    }
+    recheck_id += 1;
+    recheck_delay = min_recheck_delay;
+    schedule_recheck(recheck_delay, recheck_id);
+  }
+
+  void unpark(newb_base* parent) {
+    if (!parked)
+      return;
+    parked = false;
+    recheck_id += 1;
+    parent->start_reading();
+  }
+
+  /// Harvests confirmations after the delay passed to `schedule_recheck`.
+  /// Calls for an earlier ID than the current one are stale.
+  void recheck(newb_base* parent, uint32_t id) {
+    if (!parked || id != recheck_id)
+      return;
+    // Errors surface on the next read.
+    if (reap_completions(parent->fd()) < 0 || in_flight_bufs.empty()) {
+      unpark(parent);
+      return;
+    }
+    recheck_delay = std::min(recheck_delay * 2, max_recheck_delay);
+    schedule_recheck(recheck_delay, recheck_id);
+  }
+
+  /// Keeps the send buffer and the owners of all external payloads sent
+  /// since the last call until the kernel confirmed the last zero-copy send,
+  /// continues with a spare buffer.
+  void retire_send_buffer() {
+    send_zerocopy = false;
+    in_flight entry;
+    entry.last_send = next_send - 1;
+    entry.buf.swap(send_buffer);
+    entry.owners.swap(retired);
+    in_flight_bufs.push_back(std::move(entry));
+    if (spare_bufs.empty()) {
+      send_buffer.reserve(arena.capacity());
+    } else {
+      send_buffer.swap(spare_bufs.back());
+      spare_bufs.pop_back();
+    }
+  }
+
+  /// Reads all confirmations from the error queue and releases the buffers
+  /// they cover. Returns the number of confirmations or -1 on error.
+  int reap_completions(native_socket fd) {
+    int result = 0;
+#ifdef NEWB_HAVE_ZEROCOPY
+    char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+    for (;;) {
+      msghdr msg;
+      memset(&msg, 0, sizeof(msghdr));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return result;
+        CAF_LOG_ERROR("reading the error queue failed:" << CAF_ARG(errno));
+        return -1;
+      }
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+           cm = CMSG_NXTHDR(&msg, cm)) {
+        if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+              || (cm->cmsg_level == SOL_IPV6
+                  && cm->cmsg_type == IPV6_RECVERR)))
+          continue;
+        sock_extended_err err;
+        memcpy(&err, CMSG_DATA(cm), sizeof(err));
+        if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+          CAF_LOG_ERROR("unexpected error queue entry:"
+                        << CAF_ARG(err.ee_origin) << CAF_ARG(err.ee_errno));
+          return -1;
+        }
+        // Sends `ee_info` through `ee_data` are done.
+        auto count = err.ee_data - err.ee_info + 1;
+        stats.completions += count;
+        if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0)
+          stats.copied += count;
+        release(err.ee_data);
+        result += 1;
+      }
+    }
+#else
+    static_cast<void>(fd);
+    return result;
+#endif
+  }
+
+  /// Releases the buffers of all sends up to `last`. TCP confirms sends in
+  /// order.
+  void release(uint32_t last) {
+    while (!in_flight_bufs.empty()
+           && static_cast<int32_t>(in_flight_bufs.front().last_send - last)
+                <= 0) {
+      auto& entry = in_flight_bufs.front();
+      entry.owners.clear();
+      entry.buf.clear();
+      spare_bufs.push_back(std::move(entry.buf));
+      in_flight_bufs.pop_front();
+    }
+  }
+
+  size_t max_segments;
+  write_arena arena;
+  std::vector<iovec> iovs;
+
+  // State for zero-copy sends.
+  bool zerocopy;
+  size_t zerocopy_threshold;
+  bool configured;
+  bool send_zerocopy;
+  uint32_t next_send;
+  owner_list retired;
+  ring_buffer<in_flight> in_flight_bufs;
+  std::vector<byte_buffer> spare_bufs;
+  zerocopy_stats stats;
+
+  // State for waiting on confirmations outside of the multiplexer.
+  recheck_fun schedule_recheck;
+  bool parked;
+  uint32_t recheck_id;
+  std::chrono::microseconds recheck_delay;
+  std::chrono::microseconds min_recheck_delay;
+  std::chrono::microseconds max_recheck_delay;
+};
+
+/// Accepts TCP connections like `accept_tcp`, but runs each new newb on a
+/// `tcp_vectored_transport`.
+template <class Message>
+struct accept_tcp_vectored : public accept_tcp<Message> {
+  explicit accept_tcp_vectored(bool zerocopy = false) : zerocopy(zerocopy) {
+    // nop
+  }
+
+  std::pair<io::network::native_socket, io::network::transport_ptr>
+  accept_event(io::network::newb_base* parent) override {
+    auto res = accept_tcp<Message>::accept_event(parent);
+    if (res.first != io::network::invalid_native_socket)
+      res.second.reset(new tcp_vectored_transport(zerocopy));
+    return res;
+  }
+
+  bool zerocopy;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // TCP_VECTORED_TRANSPORT_HPP
@@ -0,0 +1,296 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace caf {
+namespace policy {
+
+/// Hierarchical timer wheel with four levels of 64 slots each. Arming and
+/// cancelling a timer are O(1), expired timers are collected in batches by
+/// `advance`. The wheel does not run on its own, its owner calls `advance`
+/// whenever it gets a chance, e.g., on every read event, and keeps at most
+/// one wake-up scheduled for `next_expiry()`.
+///
+/// Each timer carries a 64-bit value that is passed to the callback of
+/// `advance` on expiry. Entries are stored in a slab, slots are intrusive
+/// doubly linked lists of slab indexes.
+class timer_wheel {
+public:
+  using clock_type = std::chrono::steady_clock;
+  using time_point = clock_type::time_point;
+  using duration = clock_type::duration;
+
+  /// Identifies an armed timer, 0 is never a valid handle.
+  using handle = uint64_t;
+
+  explicit timer_wheel(duration tick = std::chrono::milliseconds(1),
+                       time_point start = clock_type::now())
+    : tick_(tick),
+      start_(start),
+      current_(0),
+      size_(0),
+      arms_(0),
+      cancels_(0),
+      expirations_(0) {
+    for (auto& head : heads_)
+      head = nil;
+  }
+
+  // -- properties -------------------------------------------------------------
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  duration tick() const {
+    return tick_;
+  }
+
+  size_t arms() const {
+    return arms_;
+  }
+
+  size_t cancels() const {
+    return cancels_;
+  }
+
+  size_t expirations() const {
+    return expirations_;
+  }
+
+  // -- timers -----------------------------------------------------------------
+
+  /// Arms a timer that expires at `deadline` (rounded up to the next tick).
+  handle arm(time_point deadline, uint64_t data) {
+    uint32_t idx;
+    if (free_.empty()) {
+      idx = static_cast<uint32_t>(entries_.size());
+      entries_.emplace_back();
+    } else {
+      idx = free_.back();
+      free_.pop_back();
+    }
+    auto& e = entries_[idx];
+    e.expiry = std::max(to_tick(deadline, true), current_);
+    e.data = data;
+    e.active = true;
+    insert(idx);
+    size_ += 1;
+    arms_ += 1;
+    return (static_cast<uint64_t>(e.gen) << 32) | idx;
+  }
+
+  /// Cancels the timer identified by `hdl`. Returns `false` if the timer
+  /// already expired or was cancelled before.
+  bool cancel(handle hdl) {
+    auto idx = static_cast<uint32_t>(hdl & 0xFFFFFFFF);
+    auto gen = static_cast<uint32_t>(hdl >> 32);
+    if (hdl == 0 || idx >= entries_.size())
+      return false;
+    auto& e = entries_[idx];
+    if (e.gen != gen || !e.active)
+      return false;
+    e.active = false;
+    size_ -= 1;
+    cancels_ += 1;
+    // Entries that are about to expire get released by `advance`.
+    if (e.slot != expiring) {
+      unlink(idx);
+      release(idx);
+    }
+    return true;
+  }
+
+  /// Processes all ticks up to `now` and calls `f(data)` for each expired
+  /// timer. The callback may arm and cancel timers. Returns the number of
+  /// expired timers.
+  template <class F>
+  size_t advance(time_point now, F f) {
+    // Rounding down here and up in `arm` makes sure no timer fires early.
+    auto target = to_tick(now, false);
+    auto before = expirations_;
+    while (current_ <= target) {
+      if (size_ == 0) {
+        current_ = target + 1;
+        break;
+      }
+      auto t = current_;
+      auto slot = static_cast<uint32_t>(t & mask);
+      // Refill level 0 from the upper levels whenever it wraps around.
+      if (slot == 0)
+        cascade(1, t);
+      current_ = t + 1;
+      // Detach the slot first, the callback may arm new timers.
+      auto idx = heads_[slot];
+      heads_[slot] = nil;
+      for (auto i = idx; i != nil; i = entries_[i].next)
+        entries_[i].slot = expiring;
+      while (idx != nil) {
+        auto nxt = entries_[idx].next;
+        auto fire = entries_[idx].active;
+        auto data = entries_[idx].data;
+        release(idx);
+        if (fire) {
+          size_ -= 1;
+          expirations_ += 1;
+          f(data);
+        }
+        idx = nxt;
+      }
+    }
+    return expirations_ - before;
+  }
+
+  /// Returns the earliest point at which `advance` may fire a timer or
+  /// `time_point::max()` if no timer is armed. Timers in the upper levels
+  /// only move to level 0 when it gets refilled, so the result is never later
+  /// than the next refill while any of them is armed. It is exact if all
+  /// timers are less than 64 ticks ahead.
+  time_point next_expiry() const {
+    if (size_ == 0)
+      return time_point::max();
+    // A pending refill happens at the start of the current tick already.
+    auto refill = (current_ & mask) == 0 ? current_ : (current_ | mask) + 1;
+    auto result = refill;
+    auto found = false;
+    for (uint64_t t = current_; t < current_ + slots; ++t) {
+      if (heads_[t & mask] != nil) {
+        result = t;
+        found = true;
+        break;
+      }
+    }
+    if (found && result > refill && upper_levels_armed())
+      result = refill;
+    return to_time(result);
+  }
+
+  /// Returns the start of the tick at which a timer armed for `deadline`
+  /// expires, i.e., when `advance` fires it at the earliest.
+  time_point round_up(time_point deadline) const {
+    return to_time(to_tick(deadline, true));
+  }
+
+private:
+  static constexpr uint32_t nil = std::numeric_limits<uint32_t>::max();
+  static constexpr uint16_t expiring = std::numeric_limits<uint16_t>::max();
+  static constexpr unsigned slot_bits = 6;
+  static constexpr uint64_t slots = uint64_t{1} << slot_bits;
+  static constexpr uint64_t mask = slots - 1;
+  static constexpr unsigned levels = 4;
+
+  struct entry {
+    uint64_t expiry = 0;
+    uint64_t data = 0;
+    uint32_t prev = nil;
+    uint32_t next = nil;
+    uint32_t gen = 1;
+    uint16_t slot = 0;
+    bool active = false;
+  };
+
+  uint64_t to_tick(time_point t, bool round_up) const {
+    if (t <= start_)
+      return 0;
+    auto d = t - start_;
+    if (round_up)
+      d += tick_ - duration{1};
+    return static_cast<uint64_t>(d / tick_);
+  }
+
+  time_point to_time(uint64_t t) const {
+    return start_ + tick_ * static_cast<duration::rep>(t);
+  }
+
+  bool upper_levels_armed() const {
+    for (auto slot = slots; slot < levels * slots; ++slot)
+      if (heads_[slot] != nil)
+        return true;
+    return false;
+  }
+
+  void insert(uint32_t idx) {
+    auto& e = entries_[idx];
+    auto delta = e.expiry - current_;
+    unsigned level = 0;
+    while (level + 1 < levels
+           && delta >= (uint64_t{1} << (slot_bits * (level + 1))))
+      ++level;
+    // Timers beyond the range of the wheel wait in the last slot of the top
+    // level and get cascaded until they are in range.
+    auto pos = e.expiry;
+    auto range = uint64_t{1} << (slot_bits * levels);
+    if (delta >= range)
+      pos = current_ + range - 1;
+    auto slot = static_cast<uint16_t>(level * slots
+                                      + ((pos >> (slot_bits * level)) & mask));
+    e.slot = slot;
+    e.prev = nil;
+    e.next = heads_[slot];
+    if (e.next != nil)
+      entries_[e.next].prev = idx;
+    heads_[slot] = idx;
+  }
+
+  void unlink(uint32_t idx) {
+    auto& e = entries_[idx];
+    if (e.prev != nil)
+      entries_[e.prev].next = e.next;
+    else
+      heads_[e.slot] = e.next;
+    if (e.next != nil)
+      entries_[e.next].prev = e.prev;
+  }
+
+  void release(uint32_t idx) {
+    auto& e = entries_[idx];
+    e.active = false;
+    e.gen += 1;
+    e.prev = nil;
+    e.next = nil;
+    free_.push_back(idx);
+  }
+
+  /// Moves all timers in the current slot of `level` to lower levels.
+  void cascade(unsigned level, uint64_t t) {
+    if (level >= levels)
+      return;
+    auto pos = (t >> (slot_bits * level)) & mask;
+    // Cascade the next level first if this one wraps around as well.
+    if (pos == 0)
+      cascade(level + 1, t);
+    auto slot = level * slots + pos;
+    auto idx = heads_[slot];
+    heads_[slot] = nil;
+    while (idx != nil) {
+      auto nxt = entries_[idx].next;
+      insert(idx);
+      idx = nxt;
+    }
+  }
+
+  duration tick_;
+  time_point start_;
+  uint64_t current_;
+  size_t size_;
+  size_t arms_;
+  size_t cancels_;
+  size_t expirations_;
+  std::vector<entry> entries_;
+  std::vector<uint32_t> free_;
+  uint32_t heads_[levels * slots];
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // TIMER_WHEEL_HPP
@@ -0,0 +1,374 @@
+#ifndef UDP_MMSG_TRANSPORT_HPP
+#define UDP_MMSG_TRANSPORT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "caf/io/newb.hpp"
+#include "caf/io/network/default_multiplexer.hpp"
+#include "caf/io/network/ip_endpoint.hpp"
+#include "caf/logger.hpp"
+
+#include "buffer_pool.hpp"
+#include "write_arena.hpp"
+
+namespace caf {
+namespace policy {
+
+/// UDP transport that does not write datagrams one by one. Flushing only
+/// registers the newb for write events, all chunks collected in the offline
+/// buffer until the multiplexer reports the socket as writable are then
+/// handed to the kernel with a single `sendmmsg` call (at most `max_batch`
+/// per call). Reading works the same way in reverse: a single `recvmmsg`
+/// call fills a ring of `max_batch` buffers that are handed to the protocol
+/// one by one before the transport asks the kernel again.
+///
+/// Payloads written with `write_external` stay where the application keeps
+/// them. Their datagrams go out as several segments, e.g., the headers from
+/// the send buffer followed by the payload, and the kernel gathers them.
+///
+/// Receive buffers come from a `buffer_pool` that can be shared by all
+/// transports on the same multiplexer. The protocol reads the payload
+/// directly from the pooled buffer and the buffer goes back to the pool once
+/// the newb is done with the message. Idle transports do not hold on to any
+/// receive buffers.
+struct udp_mmsg_transport : public io::network::transport {
+  using byte_buffer = io::network::byte_buffer;
+  using newb_base = io::network::newb_base;
+  using rw_state = io::network::rw_state;
+  using native_socket = io::network::native_socket;
+
+  explicit udp_mmsg_transport(size_t max_batch = 64,
+                              std::shared_ptr<buffer_pool> pool = nullptr)
+    : maximum(std::numeric_limits<uint16_t>::max()),
+      pool(std::move(pool)),
+      first_message(true),
+      writing(false),
+      max_batch(max_batch),
+      max_refills(16),
+      refills(0),
+      rx_pos(0),
+      rx_count(0) {
+    // The newb keeps calling `read_some` until we report that the socket is
+    // drained, see `max_refills` for the upper bound.
+    max_consecutive_reads
+      = std::numeric_limits<decltype(max_consecutive_reads)>::max();
+    if (!this->pool)
+      this->pool = std::make_shared<buffer_pool>(maximum);
+    arena.reserve(offline_buffer, send_buffer);
+    msgs.resize(max_batch);
+    iovs.resize(max_batch);
+    rx_bufs.resize(max_batch);
+    rx_msgs.resize(max_batch);
+    rx_iovs.resize(max_batch);
+    rx_addrs.resize(max_batch);
+  }
+
+  // -- reading ----------------------------------------------------------------
+
+  rw_state read_some(newb_base* parent) override {
+    CAF_LOG_TRACE(CAF_ARG(parent->fd()) << CAF_ARG(rx_pos)
+                  << CAF_ARG(rx_count));
+    if (rx_pos == rx_count) {
+      // Yield to the multiplexer from time to time even if there is more to
+      // read. Stopping only at this point ensures that no datagrams are left
+      // in the ring while the socket is no longer readable.
+      if (refills == max_refills) {
+        refills = 0;
+        return rw_state::indeterminate;
+      }
+      auto res = refill(parent->fd());
+      if (res != rw_state::success) {
+        refills = 0;
+        return res;
+      }
+      refills += 1;
+    }
+    // Hand out the next datagram without copying, the previous receive
+    // buffer has been processed by the protocol at this point.
+    recycle_receive_buffer();
+    receive_buffer.swap(rx_bufs[rx_pos]);
+    auto& hdr = rx_msgs[rx_pos].msg_hdr;
+    memcpy(sender.address(), &rx_addrs[rx_pos], hdr.msg_namelen);
+    *sender.length() = static_cast<size_t>(hdr.msg_namelen);
+    received_bytes = rx_msgs[rx_pos].msg_len;
+    rx_pos += 1;
+    if (first_message) {
+      endpoint = sender;
+      first_message = false;
+    }
+    return rw_state::success;
+  }
+
+  bool should_deliver() override {
+    return received_bytes != 0 && sender == endpoint;
+  }
+
+  void prepare_next_read(newb_base*) override {
+    received_bytes = 0;
+    recycle_receive_buffer();
+  }
+
+  void recycle_receive_buffer() {
+    if (!receive_buffer.empty()) {
+      pool->release(std::move(receive_buffer));
+      receive_buffer.clear();
+    }
+  }
+
+  void configure_read(io::receive_policy::config) override {
+    // nop
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  rw_state write_some(newb_base* parent) override {
+    CAF_LOG_TRACE(CAF_ARG(arena.chunks()));
+    // Pick up everything written since the flush that registered us.
+    if (arena.empty())
+      prepare_next_write(parent);
+    if (!writing)
+      return rw_state::success;
+    auto sres = send_chunks(parent, std::min(arena.chunks(), max_batch));
+    if (sres < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return rw_state::success;
+      CAF_LOG_ERROR("sendmmsg failed:" << CAF_ARG(errno));
+      return rw_state::failure;
+    }
+    return rw_state::success;
+  }
+
+  /// Sends the first `n` chunks of the send buffer as datagrams and drops
+  /// them from the arena. Returns the number of datagrams sent or -1 on
+  /// error, leaving `errno` as the system call set it.
+  int send_chunks(newb_base* parent, size_t n) {
+    if (arena.has_external())
+      gather_segments(n);
+    else {
+      iovs.resize(max_batch);
+      for (size_t i = 0; i < n; ++i) {
+        iovs[i].iov_base = send_buffer.data() + arena.offset(i);
+        iovs[i].iov_len = arena.size(i);
+        prepare_message(i, &iovs[i], 1);
+      }
+    }
+    auto sres = send_batch(parent->fd(), n);
+    if (sres < 0)
+      return sres;
+    arena.consume(static_cast<size_t>(sres));
+    if (arena.empty())
+      prepare_next_write(parent);
+    return sres;
+  }
+
+  void prepare_next_write(newb_base* parent) override {
+    if (!arena.swap(offline_buffer, send_buffer)) {
+      parent->stop_writing();
+      writing = false;
+    }
+  }
+
+  byte_buffer& wr_buf() override {
+    arena.mark(offline_buffer);
+    return offline_buffer;
+  }
+
+  void flush(newb_base* parent) override {
+    // Defer switching buffers to the write event to batch as many datagrams
+    // as possible into one system call.
+    if (arena.pending(offline_buffer) && !writing) {
+      parent->start_writing();
+      writing = true;
+    }
+  }
+
+  /// Adds `size` bytes at `data` to the datagram written last, without
+  /// copying them, and flushes. Writes via `wr_buf` go in front of the
+  /// payload, i.e., the newb writes the headers first. `owner` keeps the
+  /// payload alive until the datagram has been sent.
+  void write_external(newb_base* parent, const char* data, size_t size,
+                      std::shared_ptr<const void> owner) {
+    arena.append_external(offline_buffer, data, size, std::move(owner));
+    flush(parent);
+  }
+
+  void write_external(newb_base* parent,
+                      std::shared_ptr<const byte_buffer> payload) {
+    auto data = payload->data();
+    auto size = payload->size();
+    write_external(parent, data, size, std::move(payload));
+  }
+
+  /// Returns the bytes waiting to be written, including external payloads.
+  size_t backlog() const {
+    return arena.backlog(offline_buffer);
+  }
+
+  expected<native_socket>
+  connect(const std::string& host, uint16_t port,
+          optional<io::network::protocol::network> preferred = none) override {
+    auto res = io::network::new_remote_udp_endpoint_impl(host, port,
+                                                         preferred);
+    if (!res)
+      return res.error();
+    endpoint = res->second;
+    first_message = false;
+    return res->first;
+  }
+
+  // -- batching ---------------------------------------------------------------
+
+  void prepare_message(size_t i, iovec* iov, size_t iovlen) {
+    auto& hdr = msgs[i].msg_hdr;
+    hdr.msg_name = endpoint.address();
+    hdr.msg_namelen = static_cast<socklen_t>(*endpoint.length());
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = iovlen;
+    hdr.msg_control = nullptr;
+    hdr.msg_controllen = 0;
+    hdr.msg_flags = 0;
+  }
+
+  /// Prepares the first `n` chunks as datagrams with one segment per inline
+  /// range and external payload.
+  void gather_segments(size_t n) {
+    iovs.clear();
+    iov_ends.assign(n, 0);
+    arena.gather(send_buffer, n,
+                 [&](size_t i, const char* data, size_t len) -> bool {
+                   iovec iov;
+                   iov.iov_base = const_cast<char*>(data);
+                   iov.iov_len = len;
+                   iovs.push_back(iov);
+                   iov_ends[i] = iovs.size();
+                   return true;
+                 });
+    // Set the pointers only now, pushing may have moved the segments.
+    size_t begin = 0;
+    for (size_t i = 0; i < n; ++i) {
+      auto end = std::max(begin, iov_ends[i]);
+      prepare_message(i, iovs.data() + begin, end - begin);
+      begin = end;
+    }
+  }
+
+  /// Reads up to `max_batch` datagrams into the receive ring.
+  rw_state refill(native_socket fd) {
+    for (size_t i = 0; i < max_batch; ++i) {
+      if (rx_bufs[i].empty())
+        rx_bufs[i] = pool->acquire();
+      rx_iovs[i].iov_base = rx_bufs[i].data();
+      rx_iovs[i].iov_len = rx_bufs[i].size();
+      auto& hdr = rx_msgs[i].msg_hdr;
+      hdr.msg_name = &rx_addrs[i];
+      hdr.msg_namelen = sizeof(sockaddr_storage);
+      hdr.msg_iov = &rx_iovs[i];
+      hdr.msg_iovlen = 1;
+      hdr.msg_control = nullptr;
+      hdr.msg_controllen = 0;
+      hdr.msg_flags = 0;
+      rx_msgs[i].msg_len = 0;
+    }
+    rx_pos = 0;
+    rx_count = 0;
+    auto rres = receive_batch(fd, max_batch);
+    auto err = errno;
+    rx_count = rres > 0 ? static_cast<size_t>(rres) : 0;
+    // Return buffers we did not need.
+    for (auto i = rx_count; i < max_batch; ++i) {
+      pool->release(std::move(rx_bufs[i]));
+      rx_bufs[i].clear();
+    }
+    if (rres < 0) {
+      if (err == EAGAIN || err == EWOULDBLOCK)
+        return rw_state::indeterminate;
+      CAF_LOG_ERROR("recvmmsg failed:" << CAF_ARG(err));
+      return rw_state::failure;
+    }
+    return rx_count > 0 ? rw_state::success : rw_state::indeterminate;
+  }
+
+  /// Receives up to `n` datagrams, returns the number of datagrams received
+  /// or -1 on error.
+  int receive_batch(native_socket fd, size_t n) {
+#ifdef __linux__
+    return ::recvmmsg(fd, rx_msgs.data(), static_cast<unsigned>(n), 0,
+                      nullptr);
+#else
+    int received = 0;
+    for (size_t i = 0; i < n; ++i) {
+      auto rres = ::recvmsg(fd, &rx_msgs[i].msg_hdr, 0);
+      if (rres < 0)
+        return received > 0 ? received : -1;
+      rx_msgs[i].msg_len = static_cast<unsigned>(rres);
+      ++received;
+    }
+    return received;
+#endif
+  }
+
+  /// Sends the first `n` prepared messages, returns the number of datagrams
+  /// sent or -1 on error.
+  int send_batch(native_socket fd, size_t n) {
+#ifdef __linux__
+    return ::sendmmsg(fd, msgs.data(), static_cast<unsigned>(n), 0);
+#else
+    int sent = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (::sendmsg(fd, &msgs[i].msg_hdr, 0) < 0)
+        return sent > 0 ? sent : -1;
+      ++sent;
+    }
+    return sent;
+#endif
+  }
+
+  // State for reading.
+  size_t maximum;
+  std::shared_ptr<buffer_pool> pool;
+  bool first_message;
+
+  // State for writing.
+  bool writing;
+  write_arena arena;
+
+  // Scratch space for the batched system calls.
+  size_t max_batch;
+#ifndef __linux__
+  struct mmsghdr {
+    msghdr msg_hdr;
+    unsigned msg_len;
+  };
+#endif
+  std::vector<mmsghdr> msgs;
+  std::vector<iovec> iovs;
+  std::vector<size_t> iov_ends;
+
+  // Receive ring, `rx_pos` is the next datagram to hand out.
+  size_t max_refills;
+  size_t refills;
+  size_t rx_pos;
+  size_t rx_count;
+  std::vector<byte_buffer> rx_bufs;
+  std::vector<mmsghdr> rx_msgs;
+  std::vector<iovec> rx_iovs;
+  std::vector<sockaddr_storage> rx_addrs;
+
+  // Endpoints for sending and receiving.
+  io::network::ip_endpoint endpoint;
+  io::network::ip_endpoint sender;
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // UDP_MMSG_TRANSPORT_HPP
@@ -0,0 +1,777 @@
+#ifndef URING_TRANSPORT_HPP
+#define URING_TRANSPORT_HPP
+
+#ifdef NEWB_HAVE_LIBURING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "caf/io/newb.hpp"
+#include "caf/io/network/default_multiplexer.hpp"
+#include "caf/io/network/ip_endpoint.hpp"
+#include "caf/logger.hpp"
+#include "caf/policy/newb_tcp.hpp"
+
+#include "buffer_pool.hpp"
+#include "ring_buffer.hpp"
+#include "write_arena.hpp"
+
+// Provided buffer rings and multishot receives need liburing 2.4.
+#if defined(IO_URING_VERSION_MAJOR)                                            \
+  && (IO_URING_VERSION_MAJOR > 2                                               \
+      || (IO_URING_VERSION_MAJOR == 2 && IO_URING_VERSION_MINOR >= 4))
+#define NEWB_URING_MULTISHOT
+#endif
+
+namespace caf {
+namespace policy {
+
+/// Completion-based transport on top of io_uring. Receives are queued to the
+/// ring ahead of time and sends are handed over as one batch of submissions
+/// instead of waiting for the socket to become writable.
+///
+/// The CAF multiplexer only knows about readiness, so the transport
+/// registers an eventfd with the ring and returns it from `connect` in place
+/// of the socket. The newb thus gets a read event whenever completions are
+/// waiting and `read_some` harvests all of them: send completions release
+/// the send buffer, receive completions yield messages for the protocol.
+/// Any requests queued while processing the completions, such as re-armed
+/// receives and the next batch of sends, go out with a single
+/// `io_uring_submit` call. The transport never registers for write events.
+///
+/// Derived classes implement the socket specific parts, see
+/// `tcp_uring_transport` and `udp_uring_transport`.
+struct uring_transport : public io::network::transport {
+  using byte_buffer = io::network::byte_buffer;
+  using newb_base = io::network::newb_base;
+  using rw_state = io::network::rw_state;
+  using native_socket = io::network::native_socket;
+
+  // The lower 8 bits of the user data identify the operation.
+  static constexpr uint64_t op_recv = 1;
+  static constexpr uint64_t op_send = 2;
+  static constexpr uint64_t op_mask = 0xFF;
+
+  explicit uring_transport(unsigned entries = 256, size_t capacity = 4096)
+    : entries(entries),
+      ring_ready(false),
+      efd(-1),
+      sock(io::network::invalid_native_socket),
+      max_reaps(16),
+      reaps(0),
+      queued(0),
+      writing(false),
+      inflight(0),
+      arena(capacity),
+      submits(0),
+      sqes(0),
+      completions(0) {
+    // Messages may be pending in our buffers even if no new completions
+    // arrived, `read_some` decides when to yield.
+    max_consecutive_reads
+      = std::numeric_limits<decltype(max_consecutive_reads)>::max();
+    arena.reserve(offline_buffer, send_buffer);
+  }
+
+  ~uring_transport() override {
+    stop_ring();
+    if (sock != io::network::invalid_native_socket)
+      io::network::close_socket(sock);
+  }
+
+  // -- reading ----------------------------------------------------------------
+
+  rw_state read_some(newb_base*) override {
+    CAF_LOG_TRACE(CAF_ARG(efd) << CAF_ARG(reaps));
+    if (!can_deliver()) {
+      // Yield to the multiplexer from time to time. Our eventfd has been
+      // cleared at this point, signal it again to come back for the rest.
+      if (reaps == max_reaps) {
+        reaps = 0;
+        if (io_uring_cq_ready(&ring) > 0)
+          signal();
+        return rw_state::indeterminate;
+      }
+      if (!reap())
+        return rw_state::failure;
+      reaps += 1;
+      if (!can_deliver()) {
+        reaps = 0;
+        return rw_state::indeterminate;
+      }
+    }
+    deliver();
+    return rw_state::success;
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  rw_state write_some(newb_base*) override {
+    // Sends complete on the ring, we never ask for write events.
+    return rw_state::success;
+  }
+
+  void prepare_next_write(newb_base*) override {
+    if (arena.swap(offline_buffer, send_buffer))
+      queue_writes();
+    else
+      writing = false;
+  }
+
+  byte_buffer& wr_buf() override {
+    arena.mark(offline_buffer);
+    return offline_buffer;
+  }
+
+  void flush(newb_base* parent) override {
+    // While sends are in flight, new chunks collect in the offline buffer
+    // and go out as one batch once the ring reports the sends as complete.
+    if (!offline_buffer.empty() && !writing) {
+      writing = true;
+      prepare_next_write(parent);
+      submit();
+    }
+  }
+
+  // -- ring management --------------------------------------------------------
+
+  /// Takes ownership of `fd` and sets up the ring. Returns the eventfd the
+  /// newb should use as its handle.
+  expected<native_socket> setup(native_socket fd) {
+    sock = fd;
+    auto res = io_uring_queue_init(entries, &ring, 0);
+    if (res < 0) {
+      CAF_LOG_ERROR("io_uring_queue_init failed:" << CAF_ARG(-res));
+      return sec::runtime_error;
+    }
+    ring_ready = true;
+    efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0) {
+      CAF_LOG_ERROR("eventfd failed:" << CAF_ARG(errno));
+      return sec::runtime_error;
+    }
+    res = io_uring_register_eventfd(&ring, efd);
+    if (res < 0) {
+      CAF_LOG_ERROR("io_uring_register_eventfd failed:" << CAF_ARG(-res));
+      ::close(efd);
+      efd = -1;
+      return sec::runtime_error;
+    }
+    start_reading();
+    submit();
+    return efd;
+  }
+
+  /// Tears down the ring, pending requests get canceled. The eventfd
+  /// belongs to the newb from here on.
+  void stop_ring() {
+    if (!ring_ready)
+      return;
+    ring_ready = false;
+    release_buffers();
+    io_uring_queue_exit(&ring);
+  }
+
+  /// Returns a submission queue entry, submits the queued entries first if
+  /// the queue is full.
+  io_uring_sqe* next_sqe() {
+    auto sqe = io_uring_get_sqe(&ring);
+    if (sqe == nullptr) {
+      submit();
+      sqe = io_uring_get_sqe(&ring);
+    }
+    queued += 1;
+    return sqe;
+  }
+
+  /// Hands all queued entries to the kernel with one system call.
+  void submit() {
+    if (queued == 0)
+      return;
+    auto res = io_uring_submit(&ring);
+    if (res < 0) {
+      CAF_LOG_ERROR("io_uring_submit failed:" << CAF_ARG(-res));
+      return;
+    }
+    submits += 1;
+    sqes += queued;
+    queued = 0;
+  }
+
+  /// Processes all completions on the ring. Returns `false` if the
+  /// connection failed.
+  bool reap() {
+    // Clear the eventfd before looking at the ring, completions posted from
+    // here on signal it again.
+    uint64_t events;
+    if (::read(efd, &events, sizeof(events)) < 0 && errno != EAGAIN)
+      CAF_LOG_ERROR("reading from eventfd failed:" << CAF_ARG(errno));
+    io_uring_cqe* cqes[64];
+    auto ok = true;
+    unsigned n;
+    while ((n = io_uring_peek_batch_cqe(&ring, cqes, 64)) > 0) {
+      for (unsigned i = 0; i < n; ++i) {
+        if ((cqes[i]->user_data & op_mask) == op_send)
+          ok = handle_send(*cqes[i]) && ok;
+        else
+          ok = handle_recv(*cqes[i]) && ok;
+      }
+      io_uring_cq_advance(&ring, n);
+      completions += n;
+    }
+    submit();
+    return ok;
+  }
+
+  /// Wakes up the multiplexer for this transport.
+  void signal() {
+    uint64_t one = 1;
+    if (::write(efd, &one, sizeof(one)) < 0)
+      CAF_LOG_ERROR("writing to eventfd failed:" << CAF_ARG(errno));
+  }
+
+  // -- customization points ---------------------------------------------------
+
+  /// Queues the initial receive requests.
+  virtual void start_reading() = 0;
+
+  /// Returns whether a message for the protocol is ready.
+  virtual bool can_deliver() const = 0;
+
+  /// Moves the next message into the receive buffer.
+  virtual void deliver() = 0;
+
+  /// Processes a receive completion.
+  virtual bool handle_recv(const io_uring_cqe& cqe) = 0;
+
+  /// Processes a send completion.
+  virtual bool handle_send(const io_uring_cqe& cqe) = 0;
+
+  /// Queues sends for the chunks in the send buffer.
+  virtual void queue_writes() = 0;
+
+  /// Releases resources registered with the ring.
+  virtual void release_buffers() {
+    // nop
+  }
+
+  // Ring state.
+  unsigned entries;
+  io_uring ring;
+  bool ring_ready;
+  int efd;
+  native_socket sock;
+  size_t max_reaps;
+  size_t reaps;
+  size_t queued;
+
+  // State for writing.
+  bool writing;
+  size_t inflight;
+  write_arena arena;
+
+  // Statistics.
+  size_t submits;
+  size_t sqes;
+  size_t completions;
+};
+
+/// Stream transport on io_uring. A single multishot receive picks buffers
+/// from a ring of `rx_buffers` provided buffers and keeps producing
+/// completions until the buffers run out. Without kernel support for
+/// multishot receives, the transport falls back to one receive at a time.
+/// Received bytes collect in a stream buffer that is cut into messages
+/// according to the current receive policy.
+///
+/// The send buffers are registered with the ring and written with
+/// `IORING_OP_WRITE_FIXED`, which saves pinning the pages on every send.
+/// They are registered again if a buffer had to grow.
+struct tcp_uring_transport : public uring_transport {
+  static constexpr uint16_t buffer_group = 0;
+
+  explicit tcp_uring_transport(unsigned entries = 256,
+                               unsigned rx_buffers = 64,
+                               size_t rx_buffer_size = 4096)
+    : uring_transport(entries),
+      rx_buffers(rx_buffers),
+      rx_buffer_size(rx_buffer_size),
+      multishot(false),
+      stream_pos(0),
+      read_flag(io::receive_policy_flag::at_least),
+      read_size(1),
+      registered(false),
+      tx_done(0) {
+    rx_single.resize(rx_buffer_size);
+    memset(reg, 0, sizeof(reg));
+#ifdef NEWB_URING_MULTISHOT
+    br = nullptr;
+    rx_pool.resize(rx_buffers * rx_buffer_size);
+#endif
+  }
+
+  ~tcp_uring_transport() override {
+    // Complete pending receives before their buffers go away.
+    if (sock != io::network::invalid_native_socket)
+      ::shutdown(sock, SHUT_RDWR);
+    stop_ring();
+  }
+
+  // -- reading ----------------------------------------------------------------
+
+  void start_reading() override {
+#ifdef NEWB_URING_MULTISHOT
+    int res = 0;
+    br = io_uring_setup_buf_ring(&ring, rx_buffers, buffer_group, 0, &res);
+    if (br != nullptr) {
+      auto mask = io_uring_buf_ring_mask(rx_buffers);
+      for (unsigned i = 0; i < rx_buffers; ++i)
+        io_uring_buf_ring_add(br, rx_pool.data() + i * rx_buffer_size,
+                              static_cast<unsigned>(rx_buffer_size),
+                              static_cast<unsigned short>(i), mask,
+                              static_cast<int>(i));
+      io_uring_buf_ring_advance(br, static_cast<int>(rx_buffers));
+      multishot = true;
+    } else {
+      CAF_LOG_DEBUG("no provided buffers, falling back to single receives:"
+                    << CAF_ARG(-res));
+    }
+#endif
+    arm_receive();
+  }
+
+  void arm_receive() {
+    auto sqe = next_sqe();
+#ifdef NEWB_URING_MULTISHOT
+    if (multishot) {
+      io_uring_prep_recv_multishot(sqe, sock, nullptr, 0, 0);
+      sqe->flags |= IOSQE_BUFFER_SELECT;
+      sqe->buf_group = buffer_group;
+      sqe->user_data = op_recv;
+      return;
+    }
+#endif
+    io_uring_prep_recv(sqe, sock, rx_single.data(), rx_single.size(), 0);
+    sqe->user_data = op_recv;
+  }
+
+  bool handle_recv(const io_uring_cqe& cqe) override {
+    if (cqe.res == 0) {
+      CAF_LOG_DEBUG("connection closed by peer");
+      return false;
+    }
+    if (cqe.res < 0) {
+#ifdef NEWB_URING_MULTISHOT
+      if (cqe.res == -ENOBUFS) {
+        // All buffers were in use, we return them right away so try again.
+        arm_receive();
+        return true;
+      }
+      if (cqe.res == -EINVAL && multishot) {
+        CAF_LOG_DEBUG("multishot receive not supported");
+        multishot = false;
+        arm_receive();
+        return true;
+      }
+#endif
+      CAF_LOG_ERROR("receive failed:" << CAF_ARG(-cqe.res));
+      return false;
+    }
+    auto len = static_cast<size_t>(cqe.res);
+#ifdef NEWB_URING_MULTISHOT
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      auto bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      auto data = rx_pool.data() + bid * rx_buffer_size;
+      append(data, len);
+      io_uring_buf_ring_add(br, data, static_cast<unsigned>(rx_buffer_size),
+                            static_cast<unsigned short>(bid),
+                            io_uring_buf_ring_mask(rx_buffers), 0);
+      io_uring_buf_ring_advance(br, 1);
+      if (!(cqe.flags & IORING_CQE_F_MORE))
+        arm_receive();
+      return true;
+    }
+#endif
+    append(rx_single.data(), len);
+    arm_receive();
+    return true;
+  }
+
+  void append(const char* data, size_t len) {
+    if (stream_pos > 0 && stream_pos >= stream.size() / 2) {
+      stream.erase(stream.begin(),
+                   stream.begin() + static_cast<std::ptrdiff_t>(stream_pos));
+      stream_pos = 0;
+    }
+    stream.insert(stream.end(), data, data + len);
+  }
+
+  bool can_deliver() const override {
+    auto available = stream.size() - stream_pos;
+    if (read_flag == io::receive_policy_flag::at_most)
+      return available > 0;
+    return available > 0 && available >= read_size;
+  }
+
+  void deliver() override {
+    auto available = stream.size() - stream_pos;
+    size_t n;
+    switch (read_flag) {
+      case io::receive_policy_flag::exactly:
+        n = read_size;
+        break;
+      case io::receive_policy_flag::at_most:
+        n = std::min(available, read_size);
+        break;
+      default:
+        n = available;
+    }
+    if (receive_buffer.size() < n)
+      receive_buffer.resize(n);
+    memcpy(receive_buffer.data(), stream.data() + stream_pos, n);
+    received_bytes = n;
+    stream_pos += n;
+    if (stream_pos == stream.size()) {
+      stream.clear();
+      stream_pos = 0;
+    }
+  }
+
+  bool should_deliver() override {
+    return received_bytes != 0;
+  }
+
+  void prepare_next_read(newb_base*) override {
+    received_bytes = 0;
+  }
+
+  void configure_read(io::receive_policy::config config) override {
+    read_flag = config.first;
+    read_size = config.second;
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  void queue_writes() override {
+    if (tx_done == 0)
+      register_buffers();
+    auto data = send_buffer.data() + tx_done;
+    auto len = static_cast<unsigned>(send_buffer.size() - tx_done);
+    auto sqe = next_sqe();
+    if (registered) {
+      int index = reg[0].iov_base == send_buffer.data() ? 0 : 1;
+      io_uring_prep_write_fixed(sqe, sock, data, len, 0, index);
+    } else {
+      io_uring_prep_send(sqe, sock, data, len, 0);
+    }
+    sqe->user_data = op_send;
+    inflight = 1;
+  }
+
+  bool handle_send(const io_uring_cqe& cqe) override {
+    inflight = 0;
+    if (cqe.res < 0) {
+      CAF_LOG_ERROR("send failed:" << CAF_ARG(-cqe.res));
+      return false;
+    }
+    tx_done += static_cast<size_t>(cqe.res);
+    if (tx_done < send_buffer.size()) {
+      queue_writes();
+      return true;
+    }
+    tx_done = 0;
+    prepare_next_write(nullptr);
+    return true;
+  }
+
+  /// Registers both write buffers with the ring unless they are registered
+  /// already. Only called while no send is in flight.
+  void register_buffers() {
+    auto matches = [&](const iovec& iov) {
+      return (iov.iov_base == send_buffer.data()
+              && iov.iov_len == send_buffer.capacity())
+             || (iov.iov_base == offline_buffer.data()
+                 && iov.iov_len == offline_buffer.capacity());
+    };
+    if (registered && matches(reg[0]) && matches(reg[1]))
+      return;
+    if (registered)
+      io_uring_unregister_buffers(&ring);
+    reg[0].iov_base = send_buffer.data();
+    reg[0].iov_len = send_buffer.capacity();
+    reg[1].iov_base = offline_buffer.data();
+    reg[1].iov_len = offline_buffer.capacity();
+    // Fails if the memlock limit is too low, sends then take the regular
+    // path.
+    registered = io_uring_register_buffers(&ring, reg, 2) == 0;
+  }
+
+  void release_buffers() override {
+#ifdef NEWB_URING_MULTISHOT
+    if (br != nullptr) {
+      io_uring_free_buf_ring(&ring, br, rx_buffers, buffer_group);
+      br = nullptr;
+    }
+#endif
+    if (registered) {
+      io_uring_unregister_buffers(&ring);
+      registered = false;
+    }
+  }
+
+  expected<native_socket>
+  connect(const std::string& host, uint16_t port,
+          optional<io::network::protocol::network> preferred = none) override {
+    auto res = io::network::new_tcp_connection(host, port, preferred);
+    if (!res)
+      return res.error();
+    return setup(*res);
+  }
+
+  // State for reading.
+  unsigned rx_buffers;
+  size_t rx_buffer_size;
+  bool multishot;
+#ifdef NEWB_URING_MULTISHOT
+  io_uring_buf_ring* br;
+  std::vector<char> rx_pool;
+#endif
+  std::vector<char> rx_single;
+  byte_buffer stream;
+  size_t stream_pos;
+  io::receive_policy_flag read_flag;
+  size_t read_size;
+
+  // State for writing.
+  bool registered;
+  iovec reg[2];
+  size_t tx_done;
+};
+
+/// Datagram transport on io_uring. Keeps `rx_slots` receives queued on the
+/// ring, each with its own buffer from a `buffer_pool` that is handed to
+/// the protocol without copying, similar to `udp_mmsg_transport`. Flushing
+/// queues one `sendmsg` per chunk, linked to keep them in order, and
+/// submits them together.
+///
+/// Receives that are queued at the same time may complete in a different
+/// order than the datagrams arrived. Protocols that care use the ordering
+/// layer anyway.
+struct udp_uring_transport : public uring_transport {
+  explicit udp_uring_transport(size_t rx_slots = 16, size_t max_batch = 64,
+                               unsigned entries = 256,
+                               std::shared_ptr<buffer_pool> pool = nullptr)
+    : uring_transport(entries),
+      maximum(std::numeric_limits<uint16_t>::max()),
+      pool(std::move(pool)),
+      first_message(true),
+      ready(rx_slots),
+      max_batch(std::min(max_batch, entries - rx_slots)) {
+    if (!this->pool)
+      this->pool = std::make_shared<buffer_pool>(maximum);
+    // The kernel keeps pointers to these, they must not move.
+    slots.resize(rx_slots);
+    tx_msgs.resize(this->max_batch);
+    tx_iovs.resize(this->max_batch);
+  }
+
+  ~udp_uring_transport() override {
+    stop_ring();
+  }
+
+  // -- reading ----------------------------------------------------------------
+
+  struct rx_slot {
+    byte_buffer buf;
+    msghdr hdr;
+    iovec iov;
+    sockaddr_storage addr;
+    size_t len;
+  };
+
+  void start_reading() override {
+    for (size_t i = 0; i < slots.size(); ++i)
+      arm_receive(i);
+  }
+
+  void arm_receive(size_t i) {
+    auto& slot = slots[i];
+    if (slot.buf.empty())
+      slot.buf = pool->acquire();
+    slot.iov.iov_base = slot.buf.data();
+    slot.iov.iov_len = slot.buf.size();
+    memset(&slot.hdr, 0, sizeof(slot.hdr));
+    slot.hdr.msg_name = &slot.addr;
+    slot.hdr.msg_namelen = sizeof(sockaddr_storage);
+    slot.hdr.msg_iov = &slot.iov;
+    slot.hdr.msg_iovlen = 1;
+    auto sqe = next_sqe();
+    io_uring_prep_recvmsg(sqe, sock, &slot.hdr, 0);
+    sqe->user_data = op_recv | (static_cast<uint64_t>(i) << 8);
+  }
+
+  bool handle_recv(const io_uring_cqe& cqe) override {
+    auto i = static_cast<size_t>(cqe.user_data >> 8);
+    if (cqe.res < 0) {
+      // An ICMP error from an earlier send, the socket is still usable.
+      if (cqe.res == -ECONNREFUSED) {
+        arm_receive(i);
+        return true;
+      }
+      CAF_LOG_ERROR("recvmsg failed:" << CAF_ARG(-cqe.res));
+      return false;
+    }
+    slots[i].len = static_cast<size_t>(cqe.res);
+    ready.push_back(i);
+    return true;
+  }
+
+  bool can_deliver() const override {
+    return !ready.empty();
+  }
+
+  void deliver() override {
+    auto i = ready.front();
+    ready.pop_front();
+    auto& slot = slots[i];
+    recycle_receive_buffer();
+    receive_buffer.swap(slot.buf);
+    memcpy(sender.address(), &slot.addr, slot.hdr.msg_namelen);
+    *sender.length() = static_cast<size_t>(slot.hdr.msg_namelen);
+    received_bytes = slot.len;
+    if (first_message) {
+      endpoint = sender;
+      first_message = false;
+    }
+    // Goes out with the next submission.
+    arm_receive(i);
+  }
+
+  bool should_deliver() override {
+    return received_bytes != 0 && sender == endpoint;
+  }
+
+  void prepare_next_read(newb_base*) override {
+    received_bytes = 0;
+    recycle_receive_buffer();
+  }
+
+  void recycle_receive_buffer() {
+    if (!receive_buffer.empty()) {
+      pool->release(std::move(receive_buffer));
+      receive_buffer.clear();
+    }
+  }
+
+  void configure_read(io::receive_policy::config) override {
+    // nop
+  }
+
+  // -- writing ----------------------------------------------------------------
+
+  void queue_writes() override {
+    auto n = std::min(arena.chunks(), max_batch);
+    // A chain of linked requests must not span two submissions.
+    if (io_uring_sq_space_left(&ring) < n)
+      submit();
+    for (size_t i = 0; i < n; ++i) {
+      tx_iovs[i].iov_base = send_buffer.data() + arena.offset(i);
+      tx_iovs[i].iov_len = arena.size(i);
+      auto& hdr = tx_msgs[i];
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_name = endpoint.address();
+      hdr.msg_namelen = static_cast<socklen_t>(*endpoint.length());
+      hdr.msg_iov = &tx_iovs[i];
+      hdr.msg_iovlen = 1;
+      auto sqe = next_sqe();
+      io_uring_prep_sendmsg(sqe, sock, &hdr, 0);
+      sqe->user_data = op_send;
+      if (i + 1 < n)
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    inflight = n;
+  }
+
+  bool handle_send(const io_uring_cqe& cqe) override {
+    // Lost datagrams are up to the reliability layer, a failed request
+    // cancels the rest of its chain.
+    if (cqe.res < 0 && cqe.res != -ECANCELED)
+      CAF_LOG_DEBUG("sendmsg failed:" << CAF_ARG(-cqe.res));
+    arena.consume();
+    inflight -= 1;
+    if (inflight == 0) {
+      if (arena.empty())
+        prepare_next_write(nullptr);
+      else
+        queue_writes();
+    }
+    return true;
+  }
+
+  expected<native_socket>
+  connect(const std::string& host, uint16_t port,
+          optional<io::network::protocol::network> preferred = none) override {
+    auto res = io::network::new_remote_udp_endpoint_impl(host, port,
+                                                         preferred);
+    if (!res)
+      return res.error();
+    endpoint = res->second;
+    first_message = false;
+    return setup(res->first);
+  }
+
+  // State for reading.
+  size_t maximum;
+  std::shared_ptr<buffer_pool> pool;
+  bool first_message;
+  std::vector<rx_slot> slots;
+  ring_buffer<size_t> ready;
+
+  // State for writing.
+  size_t max_batch;
+  std::vector<msghdr> tx_msgs;
+  std::vector<iovec> tx_iovs;
+
+  // Endpoints for sending and receiving.
+  io::network::ip_endpoint endpoint;
+  io::network::ip_endpoint sender;
+};
+
+/// Accepts TCP connections like `accept_tcp`, but runs each new newb on a
+/// `tcp_uring_transport`.
+template <class Message>
+struct accept_tcp_uring : public accept_tcp<Message> {
+  std::pair<io::network::native_socket, io::network::transport_ptr>
+  accept_event(io::network::newb_base* parent) override {
+    auto res = accept_tcp<Message>::accept_event(parent);
+    if (res.first == io::network::invalid_native_socket)
+      return res;
+    auto tptr = new tcp_uring_transport;
+    io::network::transport_ptr trans{tptr};
+    auto efd = tptr->setup(res.first);
+    if (!efd) {
+      CAF_LOG_ERROR("failed to set up io_uring for accepted connection");
+      return {io::network::invalid_native_socket, nullptr};
+    }
+    return {*efd, std::move(trans)};
+  }
+};
+
+} // namespace policy
+} // namespace caf
+
+#endif // NEWB_HAVE_LIBURING
+
+#endif // URING_TRANSPORT_HPP
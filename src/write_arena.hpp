@@ -0,0 +1,260 @@
+#ifndef WRITE_ARENA_HPP
+#define WRITE_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "ring_buffer.hpp"
+
+namespace caf {
+namespace policy {
+
+/// Bookkeeping for the outgoing data of a transport. The newb appends chunks
+/// to the offline buffer via `wr_buf()` while the send buffer is being
+/// written, both buffers switch roles once the send buffer is done. The arena
+/// pre-sizes both buffers once and never shrinks them, and it records chunk
+/// boundaries as end offsets in two fixed-capacity `ring_buffer`s instead of
+/// chunk sizes in a `std::deque`. After warming up, writing does not
+/// allocate.
+///
+/// Chunks can also refer to memory outside of the buffers, e.g., a payload
+/// owned by the application, via `append_external`. Transports that send
+/// with `sendmsg`, `writev` or `sendmmsg` pick up such chunks as multiple
+/// segments with `gather` and the payload is never copied.
+class write_arena {
+public:
+  using buffer_type = std::vector<char>;
+
+  /// Memory outside of the buffers that goes in front of byte `pos` of the
+  /// buffer within chunk number `chunk`.
+  struct external {
+    size_t chunk;
+    size_t pos;
+    const char* data;
+    size_t size;
+    std::shared_ptr<const void> owner;
+  };
+
+  explicit write_arena(size_t capacity = 4096, size_t max_chunks = 256)
+    : capacity_(capacity),
+      base_(0),
+      skip_(0),
+      marked_(0),
+      first_(0),
+      retired_(nullptr),
+      send_ends_(max_chunks),
+      offline_ends_(max_chunks),
+      send_ext_(max_chunks),
+      offline_ext_(max_chunks) {
+    // nop
+  }
+
+  /// Reserves `capacity()` bytes for both buffers.
+  void reserve(buffer_type& offline, buffer_type& send) const {
+    offline.reserve(capacity_);
+    send.reserve(capacity_);
+  }
+
+  /// Closes the chunk at the end of `offline`, called by `wr_buf()` before
+  /// handing out the buffer for the next chunk.
+  void mark(const buffer_type& offline) {
+    auto begin = offline_ends_.empty() ? size_t{0} : offline_ends_.back();
+    if (offline.size() > begin
+        || (!offline_ext_.empty() && offline_ext_.back().chunk == marked_)) {
+      offline_ends_.push_back(offline.size());
+      marked_ += 1;
+    }
+  }
+
+  /// Adds `size` bytes at `data` to the chunk currently written to
+  /// `offline` without copying them. `owner` keeps the memory alive until
+  /// the chunk has been sent.
+  void append_external(const buffer_type& offline, const char* data,
+                       size_t size, std::shared_ptr<const void> owner) {
+    offline_ext_.push_back(external{marked_, offline.size(), data, size,
+                                    std::move(owner)});
+  }
+
+  /// Moves the owners of sent external data to `out` instead of releasing
+  /// them. For transports whose data stays in use after the system call
+  /// returned, e.g., with `MSG_ZEROCOPY`. Passing `nullptr` restores the
+  /// default.
+  void retire_to(std::vector<std::shared_ptr<const void>>* out) {
+    retired_ = out;
+  }
+
+  /// Returns whether `offline` has anything to send.
+  bool pending(const buffer_type& offline) const {
+    return !offline.empty() || !offline_ext_.empty();
+  }
+
+  /// Drops all data in `send` and moves the chunks in `offline` over.
+  /// Returns `false` if there is nothing to send.
+  bool swap(buffer_type& offline, buffer_type& send) {
+    send.clear();
+    send_ends_.clear();
+    drop_external(send_ext_.size());
+    base_ = 0;
+    skip_ = 0;
+    if (!pending(offline))
+      return false;
+    mark(offline);
+    send.swap(offline);
+    send_ends_.swap(offline_ends_);
+    send_ext_.swap(offline_ext_);
+    first_ = marked_ - send_ends_.size();
+    return true;
+  }
+
+  /// Returns the number of chunks in the send buffer not yet consumed.
+  size_t chunks() const {
+    return send_ends_.size();
+  }
+
+  bool empty() const {
+    return chunks() == 0;
+  }
+
+  /// Returns the offset of the `i`-th unsent chunk in the send buffer.
+  size_t offset(size_t i = 0) const {
+    return i == 0 ? base_ : send_ends_[i - 1];
+  }
+
+  /// Returns the size of the `i`-th unsent chunk in the send buffer, i.e.,
+  /// without external data.
+  size_t size(size_t i = 0) const {
+    return send_ends_[i] - offset(i);
+  }
+
+  /// Returns whether any unsent chunk refers to external data.
+  bool has_external() const {
+    return !send_ext_.empty();
+  }
+
+  /// Returns the size of the `i`-th unsent chunk, including external data
+  /// and minus what `consume_bytes` already took from the first chunk.
+  size_t total_size(size_t i = 0) const {
+    auto result = size(i);
+    for (size_t j = 0; j < send_ext_.size(); ++j)
+      if (send_ext_[j].chunk == first_ + i)
+        result += send_ext_[j].size;
+    return i == 0 ? result - skip_ : result;
+  }
+
+  /// Returns the bytes not sent yet, in `offline` and in the send buffer,
+  /// including external data.
+  size_t backlog(const buffer_type& offline) const {
+    auto result = offline.size();
+    for (size_t i = 0; i < offline_ext_.size(); ++i)
+      result += offline_ext_[i].size;
+    if (!empty())
+      result += send_ends_.back() - base_;
+    for (size_t i = 0; i < send_ext_.size(); ++i)
+      result += send_ext_[i].size;
+    return result - skip_;
+  }
+
+  /// Calls `f(i, data, size)` for each segment of the first `n` unsent
+  /// chunks in order, where `i` is the chunk. Stops early if `f` returns
+  /// `false`.
+  template <class F>
+  void gather(const buffer_type& send, size_t n, F f) const {
+    size_t ext = 0;
+    auto skip = skip_;
+    // Hands a segment to `f` after dropping the bytes consumed already.
+    auto emit = [&](size_t i, const char* data, size_t len) -> bool {
+      if (skip >= len) {
+        skip -= len;
+        return true;
+      }
+      data += skip;
+      len -= skip;
+      skip = 0;
+      return f(i, data, len);
+    };
+    for (size_t i = 0; i < n && i < send_ends_.size(); ++i) {
+      auto pos = offset(i);
+      for (; ext < send_ext_.size() && send_ext_[ext].chunk == first_ + i;
+           ++ext) {
+        auto& seg = send_ext_[ext];
+        if (seg.pos > pos && !emit(i, send.data() + pos, seg.pos - pos))
+          return;
+        pos = seg.pos;
+        if (!emit(i, seg.data, seg.size))
+          return;
+      }
+      if (send_ends_[i] > pos && !emit(i, send.data() + pos,
+                                       send_ends_[i] - pos))
+        return;
+    }
+  }
+
+  /// Marks the next `n` chunks as sent.
+  void consume(size_t n = 1) {
+    if (n == 0)
+      return;
+    base_ = send_ends_[n - 1];
+    send_ends_.pop_front(n);
+    first_ += n;
+    skip_ = 0;
+    size_t done = 0;
+    while (done < send_ext_.size() && send_ext_[done].chunk < first_)
+      ++done;
+    drop_external(done);
+  }
+
+  /// Marks the next `n` bytes as sent, which may end in the middle of a
+  /// chunk. For stream transports that can write partially.
+  void consume_bytes(size_t n) {
+    while (n > 0 && !empty()) {
+      auto remaining = total_size(0);
+      if (n < remaining) {
+        skip_ += n;
+        return;
+      }
+      n -= remaining;
+      consume(1);
+    }
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+private:
+  // Releases the first `n` external segments of the send buffer.
+  void drop_external(size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      auto& owner = send_ext_[i].owner;
+      if (retired_ != nullptr && owner)
+        retired_->push_back(std::move(owner));
+      owner.reset();
+    }
+    send_ext_.pop_front(n);
+  }
+
+  size_t capacity_;
+  size_t base_;
+  size_t skip_;
+  size_t marked_;
+  size_t first_;
+  std::vector<std::shared_ptr<const void>>* retired_;
+  ring_buffer<size_t> send_ends_;
+  ring_buffer<size_t> offline_ends_;
+  ring_buffer<external> send_ext_;
+  ring_buffer<external> offline_ext_;
+};
+
+/// Pre-sizes the buffers of transports that do not use a `write_arena`, such
+/// as the TCP and UDP transports that ship with CAF.
+template <class Transport>
+void presize_buffers(Transport& trans, size_t capacity = 4096) {
+  trans.offline_buffer.reserve(capacity);
+  trans.send_buffer.reserve(capacity);
+}
+
+} // namespace policy
+} // namespace caf
+
+#endif // WRITE_ARENA_HPP